@@ -54,7 +54,7 @@ struct GenericProjectionJac : ceres::CostFunction
             double * residual, double ** jacobian) const;
     
     bool _variableIntrinsics;
-    ICamera * _camera;
+    const ICamera * _camera; // the model, the intrinsics come with the parameters
     const Vector2dVec _proj;
     const Vector3dVec _grid;
     const vector<TransformationStatus> _transformStatusVec;
@@ -0,0 +1,64 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+On-disk cache of the calibration grid detections.
+An entry is keyed by the hash of the image file content together with
+the board geometry and the detector parameters, so that a calibration
+with another camera model or other solver settings does not detect the corners again
+*/
+
+#pragma once
+
+#include "std.h"
+#include "io.h"
+#include "eigen.h"
+
+//bump it whenever the detector or the file layout changes
+const uint32_t CORNER_CACHE_VERSION = 2;
+
+//hash of everything the detection depends on
+//pyramidLevels = 0 gives the same keys as before the pyramid mode
+uint64_t cornerCacheKey(const vector<uint8_t> & fileData, int Nx, int Ny,
+        int initRadius, bool improveDetection, int pyramidLevels = 0);
+
+class CornerCache
+{
+public:
+    //an empty fileName disables the cache
+    CornerCache(const string & fileName);
+
+    bool enabled() const { return not _fileName.empty(); }
+
+    //an empty cornerVec is a cached failure
+    bool find(uint64_t key, Vector2dVec & cornerVec) const;
+
+    void insert(uint64_t key, const Vector2dVec & cornerVec);
+
+    //writes the file if new entries have been inserted
+    bool save();
+
+    int size() const { return _entryMap.size(); }
+
+private:
+    bool load();
+
+    string _fileName;
+    map<uint64_t, Vector2dVec> _entryMap;
+    bool _modified = false;
+};
+
@@ -17,18 +17,25 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
     
 #pragma once
 
+#include <memory>
+
 #include "eigen.h"
 #include "ceres.h"
 #include "ocv.h"
 #include "std.h"
 //#include "io.h"
 
+class ThreadPool;
+
 class SubpixelCorner : public ceres::FirstOrderFunction 
 {
 public:
     SubpixelCorner(const Mat32f & gradu, const Mat32f & gradv, const Vector2d pt0,
                  const int steps = 7, const double length = 7);
             
+    //moves the problem to another corner of the same gradient images
+    void setCorner(const Vector2d pt0, const double length);
+            
     bool Evaluate(const double* parameters,
                         double* cost,
                         double* gradient) const;
@@ -37,8 +44,8 @@ public:
 
     const Grid2D<float> _graduGrid, _gradvGrid;
     vector<double> stepVec;
-    const double _stepLength;
-    const Vector2d _prior;
+    double _stepLength;
+    Vector2d _prior;
 };
 
 double findMinDistance(const Vector2dVec & cornerVec, const int rows, const int cols);
@@ -56,11 +63,35 @@ public:
     
     void setImage(const Mat8u & img);
     
+    //improveCorners splits the corners between the threads of threadPool
+    //NULL (default) means the calling thread only
+    void setThreadPool(ThreadPool * threadPool) { _threadPool = threadPool; }
+    
     bool detectPattern(Vector2dVec & ptVec);
     
     //out : _src, _imgrad, _resp, _avgVal
     void computeResponse(const double SIGMA_1, const double SIGMA_2);
     
+    //the responses for every SIGMA_2 of sigmaVec in a single pass over the image rows
+    //useResponse(level) makes one of them current, as computeResponse would
+    void computeResponses(const double SIGMA_1, const vector<double> & sigmaVec);
+    void useResponse(const int level);
+    
+    //detectPattern computes the responses of all its scales at once
+    //pays off when the pattern is often found at the second or the third scale only
+    void setFusedResponse(bool fused) { _fusedResponse = fused; }
+    
+    const Mat32f & getResponse() const { return _resp; }
+    
+    //the gradients used by improveCorners
+    const Mat32f & getGradX() const { return _gradx; }
+    const Mat32f & getGradY() const { return _grady; }
+    
+    //detectPattern assembles the grid on the image downscaled levels times by 2,
+    //then looks for every corner in a small full-resolution window around its prediction
+    //0 (default) means the full resolution
+    void setPyramidLevels(int levels) { _pyramidLevels = levels; }
+    
     //out : _hypHeap, _detected
     void selectCandidates();
     
@@ -96,13 +127,35 @@ public:
     
 private:
 
+    bool detectPatternPyramid(Vector2dVec & ptVec);
+    
+    //the response maps inside the windows only, the rest of the maps is not initialized
+    void computeWindowResponse(const double SIGMA_1, const double SIGMA_2, const vector<Rect> & windowVec);
+
+    void showResponse();
+
     const bool DEBUG;
     //DETECTION
+    //the current level of _levelVec
     Mat32f _resp, _imgrad;
     Mat32f _gradx, _grady;
     Mat8u _src1, _src2;
     double _avgVal;
     
+    struct ResponseLevel
+    {
+        Mat8u src2;
+        Mat32f resp, imgrad, gradx, grady;
+        double avgVal;
+    };
+    vector<ResponseLevel> _levelVec;
+    bool _fusedResponse;
+    
+    //pyramid mode
+    int _pyramidLevels;
+    int _scaleIdx; // the index of the scale at which the pattern has been detected
+    std::unique_ptr<CornerDetector> _coarseDetector;
+    
     //for debug
     Mat8u _detected;
     
@@ -125,6 +178,8 @@ private:
     const bool IMPROVE_DETECTION;
     int INIT_RADIUS;
     
+    ThreadPool * _threadPool;
+    
     //STRUCTURES AND FUNCTIONS
     
     struct TimePoint
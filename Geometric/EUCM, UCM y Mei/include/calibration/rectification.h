@@ -0,0 +1,112 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Rectification maps from a generic camera to a virtual pinhole camera
+and their on-disk cache
+*/
+
+#pragma once
+
+#include <functional>
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "json.h"
+
+#include "geometry/geometry.h"
+#include "projection/generic_camera.h"
+#include "utils/stage_timing.h"
+
+//bump it whenever the map computation or the file layout changes
+const uint32_t RECTIFICATION_MAP_VERSION = 3;
+
+struct RectificationMap
+{
+    //fixed-point maps as produced by cv::convertMaps
+    Mat map1; //CV_16SC2, integer coordinates
+    Mat map2; //CV_16UC1, interpolation table indices, empty for nearest-neighbour maps
+
+    bool empty() const { return map1.empty(); }
+};
+
+//creates EUCM, UCM or Mei depending on the number of parameters
+//returns NULL if the number is not supported
+ICamera * createCamera(const vector<double> & params);
+
+//pinhole parameters are W, H, u0, v0, f
+//projections which fall out of the original image are marked by -1 if maskInvalid is set
+void initRemap(const vector<double> & cameraParams, const vector<double> & pinholeParams,
+        const Transf & xi, Mat32f & mapX, Mat32f & mapY, bool maskInvalid = false);
+
+//hash of everything the map depends on
+uint64_t rectificationHash(const vector<double> & cameraParams,
+        const vector<double> & pinholeParams, const Transf & xi, bool maskInvalid,
+        bool nnInterpolation = false);
+
+//false if the file does not exist or does not match the hash
+bool loadRectificationMap(const string & fileName, uint64_t hash, RectificationMap & rectMap);
+
+bool saveRectificationMap(const string & fileName, uint64_t hash, const RectificationMap & rectMap);
+
+string rectificationMapFileName(const string & cacheDir, uint64_t hash);
+
+//loads the map from cacheDir or computes and stores it there
+//an empty cacheDir disables the cache
+//nnInterpolation rounds the coordinates for cv::INTER_NEAREST and leaves map2 empty
+void getRectificationMap(const vector<double> & cameraParams, const vector<double> & pinholeParams,
+        const Transf & xi, const string & cacheDir, RectificationMap & rectMap,
+        bool maskInvalid = false, bool nnInterpolation = false);
+
+/*
+Batch rectification: decoding, remapping and encoding run in separate thread groups
+connected by bounded queues, so that the codecs and the disk I/O overlap with remap
+*/
+
+struct BatchSettings
+{
+    int decoderCount = 2;
+    int workerCount = 2;
+    int encoderCount = 2;
+    int queueSize = 8; //frames buffered between two stages
+};
+
+//reads the optional "batch" node, the missing fields keep their default values
+BatchSettings readBatchSettings(const ptree & root);
+
+struct BatchReport
+{
+    int frameCount = 0;
+    int failedCount = 0;
+    double wallTime = 0;
+    StageTiming decode, remap, encode;
+    StageTiming latency; //from the beginning of decoding to the end of encoding
+
+    void print() const;
+};
+
+using ImageDecoder = std::function<Mat(const string &)>;
+using ImageProcessor = std::function<void(const Mat &, Mat &)>;
+
+//processes inputVec[i] into outputVec[i]
+//an empty decoded image is reported and skipped
+BatchReport rectifyBatch(const vector<string> & inputVec, const vector<string> & outputVec,
+        const ImageDecoder & decode, const ImageProcessor & process,
+        const BatchSettings & settings = BatchSettings());
+
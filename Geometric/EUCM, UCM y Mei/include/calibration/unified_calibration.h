@@ -17,6 +17,8 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <memory>
+
 #include "std.h"
 #include "io.h"
 #include "ocv.h"
@@ -49,6 +51,9 @@ struct ImageData
     vector<string> imageNameVec;
     bool useImages = true;
     
+    //the detected grids are cached there, empty means no cache
+    string cornerCacheFile;
+    
     int imageWidth, imageHeight;
     
     //transformation chain information
@@ -77,6 +82,20 @@ struct ImageData
     bool saveOutlierImages = false;
     double drawScale = 7;
     
+    //threads for the grid extraction, 0 means one per core
+    //the interactive modes (check_extraction, user_guided) are always serial
+    int threadCount = 0;
+    
+    //the grid is detected on the image downscaled pyramidLevels times by 2,
+    //the corners are then located at the full resolution, 0 means no pyramid
+    int pyramidLevels = 0;
+    
+    //the key of the image in a saved solution, "#i" if there are no images
+    string imageName(int i) const
+    {
+        return useImages ? imageNameVec[i] : "#" + to_string(i);
+    }
+    
     int getFirstExtractedIdx() const
     {
         int i = 0;
@@ -86,6 +105,57 @@ struct ImageData
     }
 };
 
+/*
+Settings of the global Ceres solve.
+The problem has a bundle structure: the intrinsics are shared, every image has its own pose.
+The Schur complement eliminates the poses, so the reduced system contains only
+the intrinsics and the global transformations and DENSE_SCHUR fits it best.
+*/
+struct CalibrationSolverSettings
+{
+    int threadCount = 0; //0 means one per core
+    string linearSolver = "DENSE_SCHUR";
+    string preconditioner = "JACOBI"; //used by the iterative solvers only
+    int maxIterations = 1000;
+    double functionTolerance = 1e-15;
+    double gradientTolerance = 1e-15;
+    double parameterTolerance = 1e-15;
+};
+
+//reads the optional "solver" node, the missing fields keep their default values
+CalibrationSolverSettings readSolverSettings(const ptree & root);
+
+//throws if the linear solver or the preconditioner is not known to Ceres
+void applySolverSettings(const CalibrationSolverSettings & settings, Solver::Options & options);
+
+//wall time of the calibration phases in seconds, summed over the info files
+struct CalibrationTiming
+{
+    double load = 0; //parsing and building the problem
+    double detect = 0; //grid extraction, corner cache included
+    double init = 0; //initial board poses and global transformations
+    double solve = 0;
+    double covariance = 0;
+};
+
+/*
+A solved calibration as written by GenericCameraCalibration::saveSolution.
+Given as "warm_start" it makes the calibration incremental:
+the intrinsics, the global transformations and the poses of the images it contains
+start from the saved values, only the new images go through estimateInitialGrid.
+*/
+struct CalibrationSolution
+{
+    map<string, string> cameraTypeMap;
+    map<string, vector<double>> intrinsicMap;
+    map<string, Array6d> globalTransformMap;
+    //sequence name -> image name -> pose
+    map<string, map<string, Array6d>> sequencePoseMap;
+};
+
+//throws if the file cannot be read
+CalibrationSolution readCalibrationSolution(const string & fileName);
+
 //TODO choose the model in the parameter file, not as a template parameter
 //TODO make different verbosity levels
 class GenericCameraCalibration
@@ -102,12 +172,38 @@ protected:
     map<string, TransformInfo> transformInfoMap;
     map<string, ICamera*> cameraMap;
     map<string, bool> cameraConstantMap; //TODO make a structure
+    map<string, string> cameraTypeMap;
     Problem globalProblem;
     
     //reprojection problem descriptors
     vector<ImageData> dataVec;
     ptree root;
     
+    //model sweep settings, see setCameraModel and setSharedDetections
+    string sweepModel;
+    vector<double> sweepInitValue;
+    std::shared_ptr<const vector<vector<Vector2dVec>>> sharedDetections;
+    
+    CalibrationSolverSettings solverSettings;
+    Solver::Summary solverSummary;
+    
+    //incremental calibration, see CalibrationSolution
+    CalibrationSolution warmStart;
+    //compute writes the solution there, empty means no output
+    string solutionFile;
+    
+    //the "report" node, compute writes a JSON summary there, empty means no report
+    string reportFile;
+    //plus the raw residuals of every data entry, see writeReport
+    bool reportResiduals = false;
+    //row-major covariance of the non-constant intrinsics
+    map<string, vector<double>> covarianceMap;
+    CalibrationTiming timing;
+    
+    //no console output in compute and writeImageResidual
+    bool quiet = false;
+    string outputPrefix;
+    
     void parseTransforms();
     
     void parseCameras();
@@ -137,6 +233,9 @@ protected:
     
     void writeImageResidual(const ImageData & data, const string & fileName) const;
     
+    //fills up covarianceMap, leaves it empty if the problem is rank deficient
+    void computeCovariance();
+    
     //TODO implement
     void writeOdometryResidual(/*????*/ const string & fileName) const;
     
@@ -176,9 +275,119 @@ public:
     }
     
     bool addResiduals(const string & infoFileName);
+    
+    //taken from the "solver" node of the last file which has one
+    const CalibrationSolverSettings & getSolverSettings() const { return solverSettings; }
+    void setSolverSettings(const CalibrationSolverSettings & settings) { solverSettings = settings; }
+    
+    //of the last compute
+    const Solver::Summary & getSolverSummary() const { return solverSummary; }
+    
+    //// MODEL SWEEP
+    
+    //every non-constant camera is calibrated with model ("eucm", "ucm" or "mei")
+    //instead of the one given in the file, must be called before addResiduals
+    //by default only fu, fv, u0, v0 are taken from the file
+    void setCameraModel(const string & model, const vector<double> & initValue = vector<double>())
+    {
+        sweepModel = model;
+        sweepInitValue = initValue;
+    }
+    
+    //the grids detected by a calibration of the same files, as returned by getDetections
+    //replace the image processing, must be called before addResiduals
+    void setSharedDetections(std::shared_ptr<const vector<vector<Vector2dVec>>> detections)
+    {
+        sharedDetections = detections;
+    }
+    
+    //detectedCornersVec of every data entry
+    vector<vector<Vector2dVec>> getDetections() const
+    {
+        vector<vector<Vector2dVec>> detections;
+        for (auto & data : dataVec) detections.push_back(data.detectedCornersVec);
+        return detections;
+    }
+    
+    //the image names of every data entry, "#i" if there are no images
+    vector<vector<string>> getImageNames() const
+    {
+        vector<vector<string>> nameVec;
+        for (auto & data : dataVec)
+        {
+            nameVec.emplace_back();
+            for (int i = 0; i < data.detectedCornersVec.size(); i++)
+            {
+                nameVec.back().push_back(data.imageName(i));
+            }
+        }
+        return nameVec;
+    }
+    
+    const map<string, vector<double>> & getIntrinsicMap() const { return intrinsicMap; }
+    
+    void setQuiet(bool value) { quiet = value; }
+    
+    //prepended to the residual file names
+    void setOutputPrefix(const string & prefix) { outputPrefix = prefix; }
+    
+    //the "save_solution" key of the info files, can be reset after addResiduals
+    void setSolutionFile(const string & fileName) { solutionFile = fileName; }
+    
+    //the intrinsics, the global transformations and the initialized poses
+    //in the format of readCalibrationSolution
+    void saveSolution(const string & fileName) const;
+    
+    /*
+    The result of the last compute as JSON: the intrinsics with their covariance,
+    the global transformations, the RMS and max reprojection error of every image,
+    the solver summary and the time of every phase.
+    With binaryResiduals every data entry also gets <prefix>residuals_<i>.bin,
+    4 doubles per corner (du, dv, u, v) like the first columns of image_error_<i>.txt;
+    the grids follow the image order and "offset" gives the first row of every image.
+    */
+    void writeReport(const string & fileName, bool binaryResiduals = false) const;
+    
+    const CalibrationTiming & getTiming() const { return timing; }
+    
+    //root mean square reprojection error over all the grids
+    //rmsVec gets the error of every image of every data entry, 0 if there is no grid
+    //maxVec, if given, the largest error of every image the same way
+    //residualVec, if given, 4 doubles per corner (du, dv, u, v) of every data entry in the image order
+    double computeReprojectionError(vector<vector<double>> & rmsVec,
+            vector<vector<double>> * maxVec = NULL, vector<vector<double>> * residualVec = NULL) const;
+
+};
+
+struct CalibrationSweepResult
+{
+    string model;
+    double rpe = 0;
+    double solveTime = 0;
+    bool converged = false;
+    map<string, vector<double>> intrinsicMap;
+    vector<vector<double>> imageRmsVec;
+};
 
+struct CalibrationSweepReport
+{
+    vector<CalibrationSweepResult> resultVec;
+    vector<vector<string>> imageNameVec;
+    double detectionTime = 0;
+    double wallTime = 0;
+    
+    void print() const;
 };
 
+/*
+Calibrates the same data with every model of modelVec.
+The grids are detected once, then the problems are solved concurrently
+by up to threadCount threads (0 means one per core).
+The residuals go to <model>_image_error_<i>.txt
+*/
+CalibrationSweepReport calibrationSweep(const vector<string> & infoFileVec,
+        const vector<string> & modelVec, int threadCount = 0);
+
 
 /* TODO add the residual analysis
     void residualAnalysis(const vector<double> & intrinsic,
@@ -43,6 +43,7 @@ using ceres::GradientProblemSolver;
 
 //misc
 using ceres::BiCubicInterpolator;
+using ceres::Covariance;
 
 template <typename T>
 struct Grid2D
@@ -77,6 +77,20 @@ vector<T> readVector(const ptree & node)
     return valVec;
 }
 
+//the inverse of readVector, a JSON array
+template <typename Container>
+ptree writeVector(const Container & valVec)
+{
+    ptree node;
+    for (auto & val : valVec)
+    {
+        ptree child;
+        child.put_value(val);
+        node.push_back(make_pair("", child));
+    }
+    return node;
+}
+
 inline Transformation<double> readTransform(const ptree & node)
 {
     return transformFromData(readVector<double>(node));
@@ -61,6 +61,11 @@ struct PhotometricCostFunction : ceres::CostFunction
     }
     
     virtual bool Evaluate(double const * const * parameters, double * residual, double ** jacobian) const;
+    
+    // Evaluate instantiated for a particular camera model
+    template<typename Camera>
+    bool evaluate(const Camera & camera, double const * const * parameters,
+            double * residual, double ** jacobian) const;
 
     void lossFunction(const double x, double & rho, double & drhodx) const;
     
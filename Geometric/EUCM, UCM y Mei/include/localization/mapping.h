@@ -144,6 +144,9 @@ public:
     MotionStereo _motionStereo;
     
     ScalePhotometric _localizer;
+    
+    //shared by the localization and the depth map wrapping, sized by stereo_parameters.thread_count
+    ThreadPool _threadPool;
 };
 
 
@@ -97,6 +97,9 @@ public:
     MotionStereo motionStereo;
     
     ScalePhotometric localizer;
+    
+    //shared by the localization and the depth map wrapping, sized by stereo_parameters.thread_count
+    ThreadPool threadPool;
 };
 
 
@@ -41,6 +41,7 @@ public:
             scaleSpace2(nScales, false),
             camPtr2(cam2->clone()),
             _xiBaseCam(0, 0, 0, 0, 0, 0),
+            threadPool(NULL),
             verbosity(0),
             useMotionPrior(true) {}
             
@@ -62,6 +63,9 @@ public:
     DepthMap & depth() { return depthMap; }
     void setDepth(const DepthMap & newDepth) { depthMap = newDepth; }
     
+    // the depth map reconstruction is shared between its threads, NULL to use the calling thread only
+    void setThreadPool(ThreadPool * newThreadPool) { threadPool = newThreadPool; }
+    
     void setBaseImage(const Mat8u & img1);
     void setTargetImage(const Mat8u & img2);
     void setMotionPriorStatus(const bool val);
@@ -95,6 +99,10 @@ private:
     ICamera * camPtr2;
     DepthMap depthMap;
     
+    // reused by initPhotometricData to avoid the allocations
+    MHPack reconstPack;
+    ThreadPool * threadPool;
+    
     //TODO make a parameter structure
     // minimal squared norm of gradient for a pixel to be accepted
     const double GRAD_THRESH = 250;
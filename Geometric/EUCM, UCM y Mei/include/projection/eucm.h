@@ -112,6 +112,60 @@ public:
         return projector(params.data(), src.data(), dst.data()); 
     }
     
+    virtual void projectBatch(const double * x, const double * y, const double * z, int size,
+            double * u, double * v, uint8_t * mask) const
+    {
+        const double & alpha = params[0];
+        const double & beta = params[1];
+        const double & fu = params[2];
+        const double & fv = params[3];
+        const double & u0 = params[4];
+        const double & v0 = params[5];
+        
+        const double gamma = 1. - alpha;
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ConstArrayMap X(x + offset, length), Y(y + offset, length), Z(z + offset, length);
+            ChunkArray denom = alpha * (Z*Z + beta*(X*X + Y*Y)).sqrt() + gamma * Z;
+            ChunkMask valid = denom >= 1e-3;
+            
+            // Check that the point is in the upper hemisphere in case of ellipsoid
+            if (alpha > 0.5)
+            {
+                const double C = (alpha - 1.) / (alpha + alpha - 1.);
+                valid = valid && (Z / denom >= C);
+            }
+            
+            ArrayMap(u + offset, length) = fu * (X / denom) + u0;
+            ArrayMap(v + offset, length) = fv * (Y / denom) + v0;
+            MaskMap(mask + offset, length) = valid.cast<uint8_t>();
+        });
+    }
+    
+    virtual void reconstructBatch(const double * u, const double * v, int size,
+            double * x, double * y, double * z, uint8_t * mask) const
+    {
+        const double & alpha = params[0];
+        const double & beta = params[1];
+        const double & fu = params[2];
+        const double & fv = params[3];
+        const double & u0 = params[4];
+        const double & v0 = params[5];
+        
+        const double gamma = 1. - alpha;
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ArrayMap xn(x + offset, length), yn(y + offset, length);
+            xn = (ConstArrayMap(u + offset, length) - u0) / fu;
+            yn = (ConstArrayMap(v + offset, length) - v0) / fv;
+            
+            ChunkArray u2 = xn * xn + yn * yn;
+            ChunkArray det = 1 - (alpha - gamma)*beta*u2;
+            ArrayMap(z + offset, length) = (1. - u2 * alpha * alpha * beta) / (gamma + alpha*det.sqrt());
+            MaskMap(mask + offset, length) = (det >= 0).cast<uint8_t>();
+        });
+    }
+    
     virtual bool projectionJacobian(const Vector3d & src, double * dudx, double * dvdx) const
     {
         const double & alpha = params[0];
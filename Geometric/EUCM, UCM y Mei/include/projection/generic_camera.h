@@ -26,6 +26,32 @@ Abstract camera class
 
 //TODO replace eigen vectors by double*
 
+// batch kernels process the points by chunks of this size
+// so that the intermediate arrays stay on the stack and in L1
+const int BATCH_CHUNK = 256;
+using ChunkArray = Eigen::Array<double, Dynamic, 1, 0, BATCH_CHUNK, 1>;
+using ChunkMask = Eigen::Array<bool, Dynamic, 1, 0, BATCH_CHUNK, 1>;
+using ConstArrayMap = Map<const Eigen::ArrayXd>;
+using ArrayMap = Map<Eigen::ArrayXd>;
+using MaskMap = Map<Eigen::Array<uint8_t, Dynamic, 1>>;
+
+// structure-of-arrays point buffers for the batch interface
+struct PointCloudSoA
+{
+    vector<double> x, y, z;
+    
+    void resize(int size) { x.resize(size); y.resize(size); z.resize(size); }
+    int size() const { return x.size(); }
+};
+
+struct ImagePointsSoA
+{
+    vector<double> u, v;
+    
+    void resize(int size) { u.resize(size); v.resize(size); }
+    int size() const { return u.size(); }
+};
+
 class ICamera
 {
 public:
@@ -111,6 +137,56 @@ public:
         return res;
     }
     
+    /// batch versions, one virtual call per batch
+    /// mask[i] = 0 if the point i is not projected/reconstructed, the output is then undefined
+    /// the default implementations fall back to the point-wise functions
+    virtual void projectBatch(const double * x, const double * y, const double * z, int size,
+            double * u, double * v, uint8_t * mask) const
+    {
+        for (int i = 0; i < size; i++)
+        {
+            Vector2d pt;
+            mask[i] = projectPoint(Vector3d(x[i], y[i], z[i]), pt);
+            u[i] = pt[0];
+            v[i] = pt[1];
+        }
+    }
+    
+    virtual void reconstructBatch(const double * u, const double * v, int size,
+            double * x, double * y, double * z, uint8_t * mask) const
+    {
+        for (int i = 0; i < size; i++)
+        {
+            Vector3d X;
+            mask[i] = reconstructPoint(Vector2d(u[i], v[i]), X);
+            x[i] = X[0];
+            y[i] = X[1];
+            z[i] = X[2];
+        }
+    }
+    
+    bool projectPointCloud(const PointCloudSoA & src, ImagePointsSoA & dst,
+            vector<uint8_t> & maskVec) const
+    {
+        const int size = src.size();
+        dst.resize(size);
+        maskVec.resize(size);
+        projectBatch(src.x.data(), src.y.data(), src.z.data(), size,
+                dst.u.data(), dst.v.data(), maskVec.data());
+        return std::all_of(maskVec.begin(), maskVec.end(), [](uint8_t m){ return m != 0; });
+    }
+    
+    bool reconstructPointCloud(const ImagePointsSoA & src, PointCloudSoA & dst,
+            vector<uint8_t> & maskVec) const
+    {
+        const int size = src.size();
+        dst.resize(size);
+        maskVec.resize(size);
+        reconstructBatch(src.u.data(), src.v.data(), size,
+                dst.x.data(), dst.y.data(), dst.z.data(), maskVec.data());
+        return std::all_of(maskVec.begin(), maskVec.end(), [](uint8_t m){ return m != 0; });
+    }
+    
     const double * getParams() const { return params.data(); }
     
     int numParams() const { return params.size(); }
@@ -122,4 +198,31 @@ protected:
     std::vector<double> params;
 };
 
+// applies kernel(offset, length) to consecutive chunks of [0, size)
+template<typename Kernel>
+inline void forEachChunk(int size, Kernel kernel)
+{
+    for (int offset = 0; offset < size; offset += BATCH_CHUNK)
+    {
+        kernel(offset, min(BATCH_CHUNK, size - offset));
+    }
+}
+
+// in-place rigid transformation of a point cloud, dst = R * src + t
+inline void transformPointCloud(const Transf & xi, PointCloudSoA & cloud)
+{
+    const Matrix3d R = xi.rotMat();
+    const Vector3d & t = xi.trans();
+    forEachChunk(cloud.size(), [&](int offset, int length)
+    {
+        ArrayMap X(cloud.x.data() + offset, length);
+        ArrayMap Y(cloud.y.data() + offset, length);
+        ArrayMap Z(cloud.z.data() + offset, length);
+        ChunkArray Xt = R(0, 0)*X + R(0, 1)*Y + R(0, 2)*Z + t[0];
+        ChunkArray Yt = R(1, 0)*X + R(1, 1)*Y + R(1, 2)*Z + t[1];
+        Z = R(2, 0)*X + R(2, 1)*Y + R(2, 2)*Z + t[2];
+        X = Xt;
+        Y = Yt;
+    });
+}
 
@@ -74,9 +74,22 @@ public:
     
     // Point jacobian
     void dpdxi(const Vector3d & X2, double * dudxi, double * dvdxi)
+    {
+        dpdxi(*_camera, X2, dudxi, dvdxi);
+    }
+    
+    //brightness jacobian
+    void dfdxi(const Vector3d & X2, const Covector2d & grad, double * dfdxi)
+    {
+        this->dfdxi(*_camera, X2, grad, dfdxi);
+    }
+    
+    // the same with a given camera, either ICamera or a StaticCamera
+    template<typename Camera>
+    void dpdxi(const Camera & camera, const Vector3d & X2, double * dudxi, double * dvdxi) const
     {
         Matrix23drm projJac;
-        if (not _camera->projectionJacobian(X2, projJac.data(), projJac.data() + 3))
+        if (not camera.projectionJacobian(X2, projJac.data(), projJac.data() + 3))
         {
             fill(dudxi, dudxi + 6, 0.);
             fill(dvdxi, dvdxi + 6, 0.);
@@ -94,11 +107,12 @@ public:
         dvdrot = projJac.row(1) * B;
     }
     
-    //brightness jacobian
-    void dfdxi(const Vector3d & X2, const Covector2d & grad, double * dfdxi)
+    template<typename Camera>
+    void dfdxi(const Camera & camera, const Vector3d & X2, const Covector2d & grad,
+            double * dfdxi) const
     {
         Matrix23drm projJac;
-        if (not _camera->projectionJacobian(X2, projJac.data(), projJac.data() + 3))
+        if (not camera.projectionJacobian(X2, projJac.data(), projJac.data() + 3))
         {
             fill(dfdxi, dfdxi + 6, 0.);
             return;
@@ -138,7 +152,14 @@ class InterJacobian
 public:
     InterJacobian(const ICamera * camera,
             const Transf & xi13, const Transf & xi23, bool inverted) :
-    _camera(camera->clone()),
+    InterJacobian(xi13, xi23, inverted)
+    {
+        _camera = camera->clone();
+    }
+    
+    // without a camera, only the overloads which take one can be used
+    InterJacobian(const Transf & xi13, const Transf & xi23, bool inverted) :
+    _camera(NULL),
     R12( xi13.rotMat() * xi23.rotMatInv() ),
     t13( xi13.trans() ),
     M12( R12 *interOmegaRot(xi23.rot()) ) 
@@ -153,9 +174,16 @@ public:
     
     // Point jacobian
     void dpdxi(const Vector3d & X1, double * dudxi, double * dvdxi)
+    {
+        dpdxi(*_camera, X1, dudxi, dvdxi);
+    }
+    
+    // the same with a given camera, either ICamera or a StaticCamera
+    template<typename Camera>
+    void dpdxi(const Camera & camera, const Vector3d & X1, double * dudxi, double * dvdxi) const
     {
         Matrix23drm projJac;
-        _camera->projectionJacobian(X1, projJac.data(), projJac.data() + 3);
+        camera.projectionJacobian(X1, projJac.data(), projJac.data() + 3);
         
         Vector3d t3X = X1 - t13; // projected into the first frame
         
@@ -118,6 +118,64 @@ public:
         return projector(params.data(), src.data(), dst.data());
     }
     
+    virtual void projectBatch(const double * x, const double * y, const double * z, int size,
+            double * u, double * v, uint8_t * mask) const
+    {
+        const double & xi = params[0];
+        const double & k1 = params[1];
+        const double & k2 = params[2];
+        const double & k3 = params[3];
+        const double & k4 = params[4];
+        const double & k5 = params[5];
+        const double & fu = params[6];
+        const double & fv = params[7];
+        const double & u0 = params[8];
+        const double & v0 = params[9];
+        
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ConstArrayMap X(x + offset, length), Y(y + offset, length), Z(z + offset, length);
+            ChunkArray denominv = 1. / (Z + xi*(Z*Z + X*X + Y*Y).sqrt());
+            
+            // Project the point to the mu plane
+            ChunkArray xn = X * denominv;
+            ChunkArray yn = Y * denominv;
+            
+            // Apply the distortion
+            ChunkArray xx = xn*xn, xy = xn*yn, yy = yn*yn;
+            ChunkArray r2 = xx + yy;
+            ChunkArray D = 1. + k1*r2 + k2*r2*r2 + k3*r2*r2*r2;
+            
+            ArrayMap(u + offset, length) = fu * (xn*D + (2.*k4*xy + k5*(r2 + 2.*xx))) + u0;
+            ArrayMap(v + offset, length) = fv * (yn*D + (2.*k5*xy + k4*(r2 + 2.*yy))) + v0;
+            MaskMap(mask + offset, length).setOnes();
+        });
+    }
+    
+    virtual void reconstructBatch(const double * u, const double * v, int size,
+            double * x, double * y, double * z, uint8_t * mask) const
+    {
+        //FIXME the distortion is ignored as in reconstructPoint
+        const double & xi = params[0];
+        const double & fu = params[6];
+        const double & fv = params[7];
+        const double & u0 = params[8];
+        const double & v0 = params[9];
+        
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ArrayMap xn(x + offset, length), yn(y + offset, length);
+            xn = (ConstArrayMap(u + offset, length) - u0) / fu;
+            yn = (ConstArrayMap(v + offset, length) - v0) / fv;
+            
+            ChunkArray u2 = xn * xn + yn * yn;
+            ChunkArray gamma = (1. + u2*(1 - xi*xi)).sqrt();
+            ChunkArray etadenom = xi*xi*u2 - 1;
+            ArrayMap(z + offset, length) = etadenom / (etadenom + xi*(-gamma - xi*u2));
+            MaskMap(mask + offset, length).setOnes();
+        });
+    }
+    
     virtual bool projectionJacobian(const Vector3d & src, double * dudx, double * dvdx) const
     {
         const double & xi = params[0];
@@ -67,6 +67,37 @@ public:
         return true;
     }
 
+    virtual void projectBatch(const double * x, const double * y, const double * z, int size,
+            double * u, double * v, uint8_t * mask) const
+    {
+        const double & u0 = params[0];
+        const double & v0 = params[1];
+        const double & f = params[2];
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ConstArrayMap X(x + offset, length), Y(y + offset, length), Z(z + offset, length);
+            ChunkMask valid = Z >= 1e-2;
+            ArrayMap(u + offset, length) = valid.select(X * f / Z + u0, -1.);
+            ArrayMap(v + offset, length) = valid.select(Y * f / Z + v0, -1.);
+            MaskMap(mask + offset, length) = valid.cast<uint8_t>();
+        });
+    }
+    
+    virtual void reconstructBatch(const double * u, const double * v, int size,
+            double * x, double * y, double * z, uint8_t * mask) const
+    {
+        const double & u0 = params[0];
+        const double & v0 = params[1];
+        const double & f = params[2];
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ArrayMap(x + offset, length) = (ConstArrayMap(u + offset, length) - u0) / f;
+            ArrayMap(y + offset, length) = (ConstArrayMap(v + offset, length) - v0) / f;
+            ArrayMap(z + offset, length).setOnes();
+            MaskMap(mask + offset, length).setOnes();
+        });
+    }
+    
     //TODO implement the projection and distortion Jacobian
     virtual bool projectionJacobian(const Vector3d & src, double * dudx, double * dvdx) const
     {
@@ -0,0 +1,106 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Compile-time camera models.
+A hot loop is written once as a template over the camera type
+and instantiated for every model; dispatchCamera selects the instantiation
+at run time, so that the per-point calls are resolved and inlined statically.
+*/
+
+#pragma once
+
+#include "eigen.h"
+
+#include "projection/generic_camera.h"
+#include "projection/eucm.h"
+#include "projection/ucm.h"
+#include "projection/mei.h"
+
+/*
+Same interface as ICamera, without virtual calls.
+The projection goes through the Projector functor,
+the rest uses the qualified (hence statically bound) member functions of Camera
+*/
+template<typename Camera, template<typename> class Projector>
+class StaticCamera
+{
+public:
+    using CameraType = Camera;
+    static const int INTRINSIC_COUNT = Projector<double>::INTRINSIC_COUNT;
+
+    StaticCamera(const Camera & camera) : _camera(camera) {}
+
+    bool projectPoint(const Vector3d & src, Vector2d & dst) const
+    {
+        Projector<double> projector;
+        return projector(_camera.getParams(), src.data(), dst.data());
+    }
+
+    bool reconstructPoint(const Vector2d & src, Vector3d & dst) const
+    {
+        return _camera.Camera::reconstructPoint(src, dst);
+    }
+
+    bool projectionJacobian(const Vector3d & src, double * dudx, double * dvdx) const
+    {
+        return _camera.Camera::projectionJacobian(src, dudx, dvdx);
+    }
+
+    bool intrinsicJacobian(const Vector3d & src, double * dudalpha, double * dvdalpha) const
+    {
+        return _camera.Camera::intrinsicJacobian(src, dudalpha, dvdalpha);
+    }
+
+    const double * getParams() const { return _camera.getParams(); }
+
+    const Camera & camera() const { return _camera; }
+
+private:
+    const Camera & _camera;
+};
+
+using StaticEnhancedCamera = StaticCamera<EnhancedCamera, EnhancedProjector>;
+using StaticUnifiedCamera = StaticCamera<UnifiedCamera, UnifiedProjector>;
+using StaticMeiCamera = StaticCamera<MeiCamera, MeiProjector>;
+
+/*
+Calls func(camera) with the static camera matching the dynamic type of camera.
+func must be callable with any StaticCamera and with const ICamera &,
+the latter is the virtual fallback for the other models (e.g. Pinhole).
+*/
+template<typename Func>
+auto dispatchCamera(const ICamera & camera, Func && func) -> decltype(func(camera))
+{
+    if (auto cam = dynamic_cast<const EnhancedCamera *>(&camera))
+    {
+        return func(StaticEnhancedCamera(*cam));
+    }
+    else if (auto cam = dynamic_cast<const UnifiedCamera *>(&camera))
+    {
+        return func(StaticUnifiedCamera(*cam));
+    }
+    else if (auto cam = dynamic_cast<const MeiCamera *>(&camera))
+    {
+        return func(StaticMeiCamera(*cam));
+    }
+    else
+    {
+        return func(camera);
+    }
+}
+
@@ -109,6 +109,48 @@ public:
         return projector(params.data(), src.data(), dst.data()); 
     }
     
+    virtual void projectBatch(const double * x, const double * y, const double * z, int size,
+            double * u, double * v, uint8_t * mask) const
+    {
+        const double & xi = params[0];
+        const double & fu = params[1];
+        const double & fv = params[2];
+        const double & u0 = params[3];
+        const double & v0 = params[4];
+        
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ConstArrayMap X(x + offset, length), Y(y + offset, length), Z(z + offset, length);
+            ChunkArray denominv = 1. / (Z + xi*(Z*Z + X*X + Y*Y).sqrt());
+            ArrayMap(u + offset, length) = fu * (X * denominv) + u0;
+            ArrayMap(v + offset, length) = fv * (Y * denominv) + v0;
+            MaskMap(mask + offset, length).setOnes();
+        });
+    }
+    
+    virtual void reconstructBatch(const double * u, const double * v, int size,
+            double * x, double * y, double * z, uint8_t * mask) const
+    {
+        const double & xi = params[0];
+        const double & fu = params[1];
+        const double & fv = params[2];
+        const double & u0 = params[3];
+        const double & v0 = params[4];
+        
+        forEachChunk(size, [&](int offset, int length)
+        {
+            ArrayMap xn(x + offset, length), yn(y + offset, length);
+            xn = (ConstArrayMap(u + offset, length) - u0) / fu;
+            yn = (ConstArrayMap(v + offset, length) - v0) / fv;
+            
+            ChunkArray u2 = xn * xn + yn * yn;
+            ChunkArray gamma = (1. + u2*(1 - xi*xi)).sqrt();
+            ChunkArray etadenom = xi*xi*u2 - 1;
+            ArrayMap(z + offset, length) = etadenom / (etadenom + xi*(-gamma - xi*u2));
+            MaskMap(mask + offset, length).setOnes();
+        });
+    }
+    
     virtual bool projectionJacobian(const Vector3d & src, double * dudx, double * dvdx) const
     {
         const double & xi = params[0];
@@ -0,0 +1,82 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Unit rays of the pixels of a scaled grid, reconstructed once per camera and grid
+and shared by all their users: depth maps, SGM and the renderer.
+NOTE:
+(u, v) = (uConv(x), vConv(y)) is the image point of the grid point (x, y)
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "std.h"
+#include "eigen.h"
+
+#include "projection/generic_camera.h"
+#include "reconstruction/scale_parameters.h"
+
+//bump it whenever the table computation or the file layout changes
+const uint32_t BEARING_TABLE_VERSION = 1;
+
+class BearingTable
+{
+public:
+    // reconstructs the whole grid, (0, 0, 0) where the camera cannot reconstruct
+    BearingTable(const ICamera * camera, const ScaleParameters & params);
+
+    // The table of camera and params, the same object for all the callers while one of them
+    // keeps it; it is computed at the first request, or read from cacheDir if it is there.
+    // An empty cacheDir disables the cache
+    static std::shared_ptr<const BearingTable> get(const ICamera * camera,
+            const ScaleParameters & params, const string & cacheDir = "");
+
+    // hash of the camera model, its parameters and the grid
+    static uint64_t computeHash(const ICamera * camera, const ScaleParameters & params);
+
+    static string fileName(const string & cacheDir, uint64_t hash);
+
+    // false if the file does not exist or does not match the hash and the grid
+    bool load(const string & fileName);
+
+    bool save(const string & fileName) const;
+
+    // idx = x + y*xMax
+    const Vector3d & operator[](const int idx) const { return _rayVec[idx]; }
+    const Vector3d & operator()(const int x, const int y) const { return _rayVec[x + y*_params.xMax]; }
+    bool valid(const int idx) const { return _maskVec[idx]; }
+
+    const Vector3dVec & rays() const { return _rayVec; }
+    const vector<uint8_t> & mask() const { return _maskVec; }
+    const ScaleParameters & scaleParameters() const { return _params; }
+    uint64_t hash() const { return _hash; }
+    int size() const { return _rayVec.size(); }
+
+private:
+    // an empty table for load()
+    BearingTable(const ScaleParameters & params, uint64_t hash) :
+            _params(params),
+            _hash(hash) {}
+
+    ScaleParameters _params;
+    uint64_t _hash;
+    Vector3dVec _rayVec;
+    vector<uint8_t> _maskVec;
+};
+
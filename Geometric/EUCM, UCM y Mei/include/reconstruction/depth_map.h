@@ -24,6 +24,9 @@ NOTE:
 
 #pragma once
 
+#include <typeinfo>
+#include <memory>
+
 #include "io.h"
 #include "std.h"
 #include "eigen.h"
@@ -31,9 +34,11 @@ NOTE:
 
 #include "projection/generic_camera.h"
 #include "reconstruction/scale_parameters.h"
+#include "reconstruction/bearing_table.h"
 #include "reconstruction/mh_pack.h"
 #include "reconstruction/stereo_misc.h"
 
+class ThreadPool;
 
 //TODO move to mh_pack
 enum ReconstructionFlags : uint32_t
@@ -49,36 +54,78 @@ enum ReconstructionFlags : uint32_t
 };
 
 // Performs a filtered merge on the input depths and sigmas
-void filter(double & v1, double & s1, const double v2, const double s2);
+template<typename T>
+void filter(T & v1, T & s1, const double v2, const double s2)
+{
+    const double K = 1. / (s1 + s2);
+    const double v = (v1 * s2 + v2 * s1) * K;
+    s1 = max(s1 * s2 * K, 0.05 * v);
+    v1 = v;
+}
 
-class DepthMap : public ScaleParameters
+/*
+Storage of the hypotheses.
+PLANAR keeps all the depths, then all the sigmas, then all the costs;
+INTERLEAVED keeps (depth, sigma, cost) of every hypothesis together.
+Within a component the index is x + y*xMax + h*hStep in both cases.
+*/
+enum class DepthLayout
 {
+    PLANAR,
+    INTERLEAVED
+};
+
+template<typename T = double, DepthLayout L = DepthLayout::PLANAR>
+class BasicDepthMap : public ScaleParameters
+{
+    template<typename T2, DepthLayout L2> friend class BasicDepthMap;
 public:
-    DepthMap() : 
+    typedef T Scalar;
+    
+    BasicDepthMap() : 
             cameraPtr(NULL),
-            hMax(1) {}
+            hMax(1),
+            hStep(0),
+            componentStep(0) {}
     
     //copy constructor
-    DepthMap(const DepthMap & depth) :
+    BasicDepthMap(const BasicDepthMap & depth) :
             ScaleParameters(depth),
             cameraPtr(depth.cameraPtr->clone()),
-            valVec(depth.valVec),
-            sigmaVec(depth.sigmaVec),
-            costVec(depth.costVec),
+            dataVec(depth.dataVec),
             hMax(depth.hMax),
-            hStep(depth.hStep) {}
+            hStep(depth.hStep),
+            componentStep(depth.componentStep),
+            bearingPtr(std::atomic_load(&depth.bearingPtr)) {}
+    
+    //conversion from another precision or layout
+    template<typename T2, DepthLayout L2>
+    explicit BasicDepthMap(const BasicDepthMap<T2, L2> & depth) :
+            ScaleParameters(depth),
+            cameraPtr(depth.cameraPtr->clone()),
+            hMax(depth.hMax),
+            bearingPtr(std::atomic_load(&depth.bearingPtr))
+    {
+        allocate();
+        for (int i = 0; i < hStep * hMax; i++)
+        {
+            at(i) = depth.at(i);
+            sigma(i) = depth.sigma(i);
+            cost(i) = depth.cost(i);
+        }
+    }
 
     //basic constructor for multi-hypothesis
-    DepthMap(const ICamera * camera, const ScaleParameters & params, const int hMax = 1):
+    BasicDepthMap(const ICamera * camera, const ScaleParameters & params, const int hMax = 1):
             ScaleParameters(params),
             cameraPtr(camera->clone()),
-            valVec(xMax*yMax*hMax, OUT_OF_RANGE),
-            sigmaVec(xMax*yMax*hMax, DEFAULT_SIGMA_DEPTH),
-            costVec(xMax*yMax*hMax, DEFAULT_COST_DEPTH),
-            hMax(hMax),
-            hStep(xMax*yMax) {}
+            hMax(hMax)
+    {
+        allocate();
+        setTo(OUT_OF_RANGE, DEFAULT_SIGMA_DEPTH, DEFAULT_COST_DEPTH);
+    }
 
-    virtual ~DepthMap() 
+    virtual ~BasicDepthMap() 
     {
         if (cameraPtr != NULL)
         {
@@ -87,7 +134,7 @@ public:
         }
     }
     
-    DepthMap & operator = (const DepthMap & other)
+    BasicDepthMap & operator = (const BasicDepthMap & other)
     {
         if (this != &other)
         {
@@ -96,15 +143,38 @@ public:
             delete cameraPtr;
             cameraPtr = other.cameraPtr->clone();
             
-            valVec = other.valVec;
-            sigmaVec = other.sigmaVec;
-            costVec = other.costVec;
+            dataVec = other.dataVec;
             hMax = other.hMax;
             hStep = other.hStep;
+            componentStep = other.componentStep;
+            bearingPtr = std::atomic_load(&other.bearingPtr);
         }
         return *this;
     }
-    
+
+    //same as assigning BasicDepthMap(camera, params, hMax) but reuses the storage
+    //and the camera object when the model does not change
+    void reset(const ICamera * camera, const ScaleParameters & params, const int hMax = 1)
+    {
+        ScaleParameters::operator = (params);
+        if (cameraPtr != NULL and typeid(*cameraPtr) == typeid(*camera)
+                and cameraPtr->numParams() == camera->numParams())
+        {
+            cameraPtr->width = camera->width;
+            cameraPtr->height = camera->height;
+            cameraPtr->setParameters(camera->getParams());
+        }
+        else
+        {
+            delete cameraPtr;
+            cameraPtr = camera->clone();
+        }
+        this->hMax = hMax;
+        bearingPtr.reset();
+        allocate();
+        setTo(OUT_OF_RANGE, DEFAULT_SIGMA_DEPTH, DEFAULT_COST_DEPTH);
+    }
+
     void setDefault()
     {
         setTo(DEFAULT_DEPTH, DEFAULT_SIGMA_DEPTH, DEFAULT_COST_DEPTH);
@@ -114,9 +184,12 @@ public:
         const double sigmaVal, 
         const double costVal = DEFAULT_COST_DEPTH)
     {
-        fill(valVec.begin(), valVec.end(), val);
-        fill(sigmaVec.begin(), sigmaVec.end(), sigmaVal);
-        fill(costVec.begin(), costVec.end(), costVal);
+        for (int i = 0; i < hStep * hMax; i++)
+        {
+            at(i) = val;
+            sigma(i) = sigmaVal;
+            cost(i) = costVal;
+        }
     }
     
     // X is a 3D point in the camera frame
@@ -134,44 +207,78 @@ public:
     void applyMask(const Mat8u & mask);
     
     //check the limits
-    bool isValid(const int x, const int y, const int h = 0) const;
-    bool isValid(const Vector2d pt, const int h=0) const;
+    bool isValid(const int x, const int y, const int h = 0) const
+    {
+        return ( (x >= 0) and (x < xMax) and (y >= 0) and (y < yMax) and (h >= 0) and (h < hMax) );
+    }
+    
+    bool isValid(const Vector2d pt, const int h = 0) const
+    {
+        return isValid(pt[0], pt[1], h);
+    }
     
     // nearest neighbor interpolation
-    double nearest(const int u, const int v, const int h = 0) const;
-    double nearest(const Vector2d pt, const int h = 0) const;
+    double nearest(const int u, const int v, const int h = 0) const
+    {
+        const int xd = xConv(u), yd = yConv(v);
+        return isValid(xd, yd, h) ? at(xd, yd, h) : OUT_OF_RANGE;
+    }
+    
+    double nearest(const Vector2d pt, const int h = 0) const
+    {
+        const int xd = xConv(pt[0]), yd = yConv(pt[1]);
+        return isValid(xd, yd, h) ? at(xd, yd, h) : OUT_OF_RANGE;
+    }
     
     // nearest neighbor interpolation for the uncertainty
-    double nearestSigma(const int u, const int v, const int h = 0) const;
-    double nearestSigma(const Vector2d pt, const int h = 0) const;
+    double nearestSigma(const int u, const int v, const int h = 0) const
+    {
+        const int xd = xConv(u), yd = yConv(v);
+        return isValid(xd, yd, h) ? sigma(xd, yd, h) : OUT_OF_RANGE;
+    }
+    
+    double nearestSigma(const Vector2d pt, const int h = 0) const
+    {
+        const int xd = xConv(pt[0]), yd = yConv(pt[1]);
+        return isValid(xd, yd, h) ? sigma(xd, yd, h) : OUT_OF_RANGE;
+    }
 
     // nearest neighbor interpolation for the hypothesis cost
-    double nearestCost(const int u, const int v, const int h = 0) const;
-    double nearestCost(const Vector2d pt, const int h = 0) const;
+    double nearestCost(const int u, const int v, const int h = 0) const
+    {
+        const int xd = xConv(u), yd = yConv(v);
+        return isValid(xd, yd, h) ? cost(xd, yd, h) : OUT_OF_RANGE;
+    }
+    
+    double nearestCost(const Vector2d pt, const int h = 0) const
+    {
+        const int xd = xConv(pt[0]), yd = yConv(pt[1]);
+        return isValid(xd, yd, h) ? cost(xd, yd, h) : OUT_OF_RANGE;
+    }
     
     // to access the elements directly
-    double & at(const int x, const int y, const int h = 0);
-    const double & at(const int x, const int y, const int h = 0) const;
+    T & at(const int x, const int y, const int h = 0) { return at(x + y*xMax + h*hStep); }
+    const T & at(const int x, const int y, const int h = 0) const { return at(x + y*xMax + h*hStep); }
     
     // to access the elements directly
-    double & at(const int idx);
-    const double & at(const int idx) const;
+    T & at(const int idx) { return dataVec[position(idx)]; }
+    const T & at(const int idx) const { return dataVec[position(idx)]; }
     
     // to access the uncertainty directly
-    double & sigma(const int x, const int y, const int h = 0);
-    const double & sigma(const int x, const int y, const int h = 0) const;
+    T & sigma(const int x, const int y, const int h = 0) { return sigma(x + y*xMax + h*hStep); }
+    const T & sigma(const int x, const int y, const int h = 0) const { return sigma(x + y*xMax + h*hStep); }
     
     // to access the uncertainty directly
-    double & sigma(const int idx);
-    const double & sigma(const int idx) const;
+    T & sigma(const int idx) { return dataVec[position(idx) + componentStep]; }
+    const T & sigma(const int idx) const { return dataVec[position(idx) + componentStep]; }
 
     // to access the hypothesis cost directly
-    double & cost(const int x, const int y, const int h = 0);
-    const double & cost(const int x, const int y, const int h = 0) const;
+    T & cost(const int x, const int y, const int h = 0) { return cost(x + y*xMax + h*hStep); }
+    const T & cost(const int x, const int y, const int h = 0) const { return cost(x + y*xMax + h*hStep); }
     
     // to access the hypothesis cost directly
-    double & cost(const int idx);
-    const double & cost(const int idx) const;
+    T & cost(const int idx) { return dataVec[position(idx) + 2*componentStep]; }
+    const T & cost(const int idx) const { return dataVec[position(idx) + 2*componentStep]; }
     
     Vector2dVec getPointVec(const std::vector<int> & idxVec) const;
     Vector2dVec getPointVec() const;
@@ -198,7 +305,16 @@ public:
     //   use ALL_HYPOTHESES with QUERY_POINT.
     // To use IMAGE_VALUES, insert the value vector into result.valVec. This should
     //   only be used along with QUERY_POINT
-    void reconstruct(MHPack & result, const uint32_t reconstFlags = 0 ) const;
+    // The vectors of result are resized in place, so a pack reused from call to call
+    //   does not allocate. Points which the camera cannot reconstruct are (0, 0, 0).
+    // The rays of the depth pixels come from bearingTable(), the query points are
+    //   reconstructed in batches; both are shared between the threads of threadPool
+    void reconstruct(MHPack & result, const uint32_t reconstFlags = 0,
+            ThreadPool * threadPool = NULL) const;
+    
+    // The rays of the depth pixels, requested from BearingTable::get at the first call,
+    // so that all the maps of the same camera and scale share them
+    const BearingTable & bearingTable() const;
     
     //TODO make it bool and make it return a mask
     void project(const Vector3dVec & pointVec, Vector2dVec & result) const;
@@ -213,10 +329,13 @@ public:
     int getHeight() const { return yMax; }
     int getHypMax() const { return  hMax; }
     
-    static DepthMap generatePlane(const ICamera * camera, const ScaleParameters & params, 
+    //the storage in bytes
+    size_t memorySize() const { return dataVec.size() * sizeof(T); }
+    
+    static BasicDepthMap generatePlane(const ICamera * camera, const ScaleParameters & params, 
             Transformation<double> TcameraPlane, const Vector3dVec & polygonVec);
     
-    void merge(const DepthMap & depth2);
+    void merge(const BasicDepthMap & depth2);
 
     /*
     Takes the depthmap from the first image, reconstructs the pointcloud
@@ -227,26 +346,47 @@ public:
     point in this cloud is projected onto the line of it's original point.
     This new depthmap is the reprojected depthmap.
     */
-    void wrapDepth(const DepthMap& dMap1, const DepthMap& dMap2,
-            const Transformation<double> T12, DepthMap& output) const;
+    void wrapDepth(const BasicDepthMap& dMap1, const BasicDepthMap& dMap2,
+            const Transformation<double> T12, BasicDepthMap& output) const;
 
-    DepthMap wrapDepth(const Transformation<double> T12) const;
+    // Forward warping of the first hypothesis into the frame T12, a single hypothesis map.
+    // The pixels are taken from bearingTable(), moved and projected row by row through
+    // the batch camera interface and splat into a z-buffer, the closest point wins.
+    // The rows are shared between the threads of threadPool, the result does not depend on it
+    BasicDepthMap wrapDepth(const Transformation<double> T12, ThreadPool * threadPool = NULL) const;
 
     // Filters all hypotheses to remove noise, using either a median filter or 
     // average filter, depending on the number of matching neighbour hypotheses
-    void filterNoise();
+    // The pixel filters and the rejection below are split by blocks of rows
+    // between the threads of threadPool, the result does not depend on it
+    void filterNoise(ThreadPool * threadPool = NULL);
 
     // make sure that hypotheses are like h1 h2 0 rhather than h1 0 h2
-    void regularize();
+    void regularize(ThreadPool * threadPool = NULL);
+
+    // Rejects hypotheses above the threshold
+    void costRejection(const double rejectionThreshold = DEFAULT_COST_DEPTH + 16,
+            ThreadPool * threadPool = NULL);
 
     // Returns true if the two depths and sigmas are within an acceptable tolerance of each other
     static bool match(const double v1, const double s1, const double v2, const double s2);
   
-    bool empty() { return valVec.size() == 0; }
+    bool empty() { return dataVec.size() == 0; }
 private:
 
-    void pixelMedianFilter(const int x, const int y, const int h, DepthMap & dst);
-    void pixelAverageFilter(const Vector3iVec & matches, DepthMap & dst);
+    //sets hStep and componentStep, resizes the storage
+    void allocate()
+    {
+        hStep = xMax*yMax;
+        componentStep = (L == DepthLayout::INTERLEAVED) ? 1 : hStep*hMax;
+        dataVec.resize(3*hStep*hMax);
+    }
+    
+    //where the depth of hypothesis idx is stored
+    int position(const int idx) const { return (L == DepthLayout::INTERLEAVED) ? 3*idx : idx; }
+
+    void pixelMedianFilter(const int x, const int y, const int h, BasicDepthMap & dst);
+    void pixelAverageFilter(const Vector3iVec & matches, BasicDepthMap & dst);
 
     //Swap two hypotheses at the same pixel
     void swapHypotheses(const int x, const int y, const int h1, const int h2);
@@ -254,14 +394,24 @@ private:
     //Sort all the hypotheses at a given pixel in the order of ascending cost
     void sortHypStack(const int x, const int y);
 
-    // Rejects hypotheses above the threshold
-    void costRejection(const double rejectionThreshold = DEFAULT_COST_DEPTH + 16);
-
-    std::vector<double> valVec;
-    std::vector<double> sigmaVec; // uncertainty
-    std::vector<double> costVec; // hypothesis cost
+    ICamera * cameraPtr;
+    std::vector<T> dataVec; // depth, uncertainty and hypothesis cost, see DepthLayout
     int hMax; // Number of hypotheses
     int hStep; // Step to get to the next hypothesis
+    int componentStep; // from the depth to the uncertainty and from the uncertainty to the cost
     
-    ICamera * cameraPtr;
+    // see bearingTable(), accessed with std::atomic_load and std::atomic_compare_exchange
+    mutable std::shared_ptr<const BearingTable> bearingPtr;
 };
+
+//the instantiations are in depth_map.cpp
+using DepthMap = BasicDepthMap<double, DepthLayout::PLANAR>;
+using DepthMapF = BasicDepthMap<float, DepthLayout::PLANAR>;
+using InterleavedDepthMap = BasicDepthMap<double, DepthLayout::INTERLEAVED>;
+using InterleavedDepthMapF = BasicDepthMap<float, DepthLayout::INTERLEAVED>;
+
+extern template class BasicDepthMap<double, DepthLayout::PLANAR>;
+extern template class BasicDepthMap<float, DepthLayout::PLANAR>;
+extern template class BasicDepthMap<double, DepthLayout::INTERLEAVED>;
+extern template class BasicDepthMap<float, DepthLayout::INTERLEAVED>;
+
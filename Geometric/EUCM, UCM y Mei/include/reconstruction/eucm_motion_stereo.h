@@ -157,5 +157,9 @@ private:
     vector<uint8_t> gdescriptor;
     vector<uint8_t> gsampleVec;
     vector<int> guVec, gvVec;
+    
+    //reused by compareDescriptor
+    vector<int> gcostVec;
+    DescriptorScratch gscratch;
 };
 
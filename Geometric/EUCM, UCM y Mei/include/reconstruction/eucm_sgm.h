@@ -25,6 +25,9 @@ NOTE:
 
 #pragma once
 
+#include <memory>
+#include <functional>
+
 #include "std.h"
 #include "ocv.h"
 #include "eigen.h"
@@ -35,6 +38,10 @@ NOTE:
 
 #include "reconstruction/scale_parameters.h"
 #include "utils/curve_rasterizer.h"
+#include "utils/thread_pool.h"
+#include "utils/mapped_file.h"
+#include "utils/stage_timing.h"
+#include "reconstruction/bearing_table.h"
 #include "reconstruction/depth_map.h"
 #include "reconstruction/eucm_stereo.h"
 
@@ -51,6 +58,9 @@ struct SgmParameters : public StereoParameters
             else if (pname == "image_based_cost")       imageBasedCost = item.second.get_value<bool>();
             else if (pname == "salient_points_only")    salientPoints = item.second.get_value<bool>();
             else if (pname == "use_uv_cache")           useUVCache = item.second.get_value<bool>();
+            else if (pname == "path_count")             pathCount = item.second.get_value<int>();
+            else if (pname == "thread_count")           threadCount = item.second.get_value<int>();
+            else if (pname == "geometry_cache")         geometryCache = item.second.get_value<string>();
         }
     }
     
@@ -67,6 +77,56 @@ struct SgmParameters : public StereoParameters
     
     //precompute all the epipolar curves
     bool useUVCache = true;
+    
+    //number of aggregation directions, 4 (horizontal and vertical) or 8 (with diagonals)
+    int pathCount = 4;
+    
+    //threads for the cost aggregation, 0 means one per core
+    int threadCount = 0;
+    
+    //directory where the per-pixel epipolar geometry of a fixed rig is cached
+    //empty means no cache
+    string geometryCache;
+};
+
+// per-thread buffers of EnhancedSgm::computeCurveCost
+struct CurveCostScratch
+{
+    CurveCostScratch(const EpipolarDescriptor & descriptorEngine) : 
+            epipolarDescriptor(descriptorEngine) {}
+    
+    // keeps the response of the last computed descriptor
+    EpipolarDescriptor epipolarDescriptor;
+    vector<uint8_t> descriptor;
+    vector<uint8_t> sampleVec;
+    vector<int> costVec;
+    DescriptorScratch descScratch;
+};
+
+// the per-pixel output of the cost stage
+struct SgmCostVolume
+{
+    Mat8u error; // matching error for every disparity
+    Mat8u jumpCost; // image-based jump cost
+    Mat8u salient;
+    Mat8u step; // descriptor step
+    Mat8u skip;
+};
+
+// fills the next synchronized pair, false at the end of the sequence
+using StereoFrameSource = std::function<bool(Mat8u & img1, Mat8u & img2)>;
+
+// receives the depth map of every frame
+// the map is overwritten by the next frame, a copy must be made to keep it
+using DepthSink = std::function<void(int frameIdx, const DepthMap & depth)>;
+
+struct StereoStreamReport
+{
+    int frameCount = 0;
+    double wallTime = 0;
+    StageTiming cost, aggregation, disparity, depth, sink;
+    
+    void print() const;
 };
 
 //TODO revamp, take MotionStereo as a model
@@ -77,15 +137,22 @@ public:
     EnhancedSgm(Transf T12, const EnhancedCamera * cam1,
             const EnhancedCamera * cam2, const SgmParameters & params) :
             EnhancedStereo(cam1, cam2, params),
-            _params(params)
+            _params(params),
+            _threadPool(params.threadCount)
     { 
         setTransformation(T12);
         assert(params.dispMax % 2 == 0);
+        assert(params.pathCount == 4 or params.pathCount == 8);
         createBuffer();
+        computePointGrid();
         computeReconstructed();
-        computeRotated();
-        computePinf();
-        if (params.useUVCache) computeUVCache();
+        if (not loadGeometry())
+        {
+            computeRotated();
+            computePinf();
+            if (params.useUVCache) computeUVCache();
+            saveGeometry();
+        }
     }
     
     virtual ~EnhancedSgm()
@@ -98,12 +165,23 @@ public:
     // An interface function
     void computeStereo(const Mat8u & img1, const Mat8u & img2, DepthMap & depthMap);
     
+    // processes the frames of source until it is exhausted
+    // depthMap and all the buffers are reused from frame to frame;
+    // the cost of frame N+1 is computed while frame N is aggregated
+    // and reconstructed, so source is called from another thread
+    StereoStreamReport computeStereoStream(const StereoFrameSource & source,
+            DepthMap & depthMap, const DepthSink & sink);
+    
     //// EPIPOLAR GEOMETRY
     
-    // computes reconstVec -- reconstruction of every pixel of the first image
+    // computes pointVec1 -- the depth map points on the first image
+    void computePointGrid();
+    
+    // gets bearingTable -- the rays of every pixel of the first image,
+    // cached in geometryCache with the rest of the geometry
     void computeReconstructed();
     
-    // computes reconstRotVec -- reconstVec rotated into the second frame
+    // computes reconstRotVec -- the rays rotated into the second frame
     void computeRotated();
        
     // computes pinfVec -- projections of all the reconstructed points from the first image
@@ -113,16 +191,44 @@ public:
     // calculate the coefficients of the polynomials for all the 
     void computeEpipolarIndices();
     
+    //// GEOMETRY CACHE
+    // pinfPxVec and the UV cache depend only on the rig and the scale,
+    // the rays are cached by BearingTable
+    
+    // hash of the cameras, the transformation and the parameters the geometry depends on
+    uint64_t geometryHash() const;
+    
+    string geometryFileName(uint64_t hash) const;
+    
+    // maps the cache file, the UV cache is used in place
+    // false if the cache is disabled, missing or does not match
+    bool loadGeometry();
+    
+    bool saveGeometry() const;
+    
     //// DYNAMIC PROGRAMMING
     void createBuffer();
+    void createCostVolume(SgmCostVolume & volume) const;
        
     // fill up the error buffer using 2*S-1 pixs along epipolar lines as local desctiprtors
-    void computeCurveCost(const Mat8u & img1, const Mat8u & img2);
+    // the rows are processed in parallel, the result does not depend on the thread count
+    void computeCurveCost(const Mat8u & img1, const Mat8u & img2,
+            SgmCostVolume & volume, ThreadPool & threadPool);
+    void computeCurveCostRow(const Mat8u & img1, const Mat8u & img2, int y,
+            SgmCostVolume & volume, CurveCostScratch & scratch);
     
+    // sums the path costs of all the directions into _costSum
     void computeDynamicProgramming();
     
-    void computeDynamicStep(const int* inCost, const uint8_t * error, int * outCost);
-    void computeDynamicStep2(const int* inCost, const uint32_t * error, int * outCost);
+    // one direction; a path enters (x, y) from (x - dx, y - dy)
+    // the paths of a direction are independent and processed in parallel
+    void aggregatePaths(int dx, int dy);
+    
+    // outCost is kept relative to the best inCost, so that it fits in 16 bits
+    // outCost is also added to costSum
+    void computeDynamicStep(const uint16_t * inCost, const uint8_t * error,
+            uint16_t * outCost, uint16_t * costSum, int jumpCost) const;
+    
     void reconstructDisparityMH();
     void reconstructDisparity();  // using the result of the dynamic programming
     
@@ -132,11 +238,30 @@ public:
     
     // index of an object in a linear array corresponding to pixel [row, col] 
     int getLinearIndex(int x, int y) const { return _params.xMax*y + x; }
+    
+    // i-th point of the cached epipolar curve of (x, y), i = DISPARITY_MARGIN is pinf
+    // (-1, -1) if the point is out of the second image
+    void getCachedPoint(int x, int y, int i, int & u, int & v) const
+    {
+        const int16_t * uvPtr = (const int16_t *)_uvCache.row(y).data 
+                + 2*(x*(_params.dispMax + 2*DISPARITY_MARGIN) + i);
+        if (uvPtr[0] == UV_CACHE_INVALID)
+        {
+            u = -1;
+            v = -1;
+        }
+        else
+        {
+            const Vector2i & pinf = _pinfPxVec[getLinearIndex(x, y)];
+            u = pinf[0] + uvPtr[0];
+            v = pinf[1] + uvPtr[1];
+        }
+    }
       
     CurveRasterizer<int, Polynomial2> getCurveRasteriser(CameraIdx camIdx, int idx,
                                                          uint32_t * flags = NULL) const;
     
-    void skipPixel(int x, int y);
+    void skipPixel(int x, int y, SgmCostVolume & volume);
     
     // reconstruction
     void fillGaps(uint8_t * const data, const int step);
@@ -145,33 +270,35 @@ public:
     
 private:
     
-    std::vector<bool> _maskVec;
-    
     Vector2dVec _pointVec1;  // the depth points on the image 1
-    Vector3dVec _reconstVec;  // reconstruction of every pixel by cam1
-    Vector3dVec _reconstRotVec;  // reconstVec rotated into the second frame
+    std::shared_ptr<const BearingTable> _bearingTable;  // unit rays of every pixel by cam1
+    Vector3dVec _reconstRotVec;  // the rays rotated into the second frame
     Vector2dVec _pinfVec;  // projection of reconstRotVec by cam2
     
     // discretized version
     Vector2iVec _pointPxVec1;
     Vector2iVec _pinfPxVec;
     
-    // to be able to change the jump cost
-    int _jumpCost;
-    
     const int DISPARITY_MARGIN = 20;
-    Mat32s _uCache, _vCache;
-    Mat8u _errorBuffer;
-    Mat8u _costBuffer; //TODO maybe merge with salientBuffer
-    Mat8u _salientBuffer; 
-    Mat8u _stepBuffer;
-    Mat8u _skipBuffer;
-    Mat32s _tableauLeft, _tableauRight; //FIXME check the type through the code
-    Mat32s _tableauTop, _tableauBottom;
+    // (du, dv) pairs relative to the pinf pixel, the curve never gets farther
+    // than dispMax + 2*DISPARITY_MARGIN steps away, so 16 bits are enough
+    const int16_t UV_CACHE_INVALID = INT16_MIN;
+    Mat16s _uvCache;
+    SgmCostVolume _costVolume; // used by the aggregation and the reconstruction
+    SgmCostVolume _nextCostVolume; // filled by the cost stage while streaming
+    Mat16u _costSum; // sum of the path costs over the directions
     Mat32s _smallDisparity;
     Mat32s _finalErrorMat;
     
     
     const SgmParameters _params;
+    
+    ThreadPool _threadPool;
+    
+    // runs the cost stage of the stream, created on demand
+    std::unique_ptr<ThreadPool> _costThreadPool;
+    
+    // keeps the loaded geometry mapped
+    std::unique_ptr<MappedFile> _geometryFile;
 };
 
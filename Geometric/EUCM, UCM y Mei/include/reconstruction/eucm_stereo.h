@@ -78,6 +78,24 @@ returns a verctor of costs for each possible disparity value
 vector<int> compareDescriptor(const vector<uint8_t> & desc,
         const vector<uint8_t> & sampleVec, int flawCost);
 
+/*
+buffers of the dynamic algorithm, they only grow
+so that the per-pixel loops do not allocate once warmed up
+*/
+struct DescriptorScratch
+{
+    vector<uint8_t> thMinVec, thMaxVec;
+    vector<uint16_t> rowA, rowB, rowC;
+};
+
+/*
+same as above, writes sampleCount costs into costVec
+the costs of all the sample positions are computed with 16-bit saturating SIMD lanes
+*/
+void compareDescriptor(const uint8_t * desc, int descLength,
+        const uint8_t * sampleVec, int sampleCount, int flawCost,
+        DescriptorScratch & scratch, int * costVec);
+
 class EnhancedStereo
 {
 public:
@@ -23,6 +23,7 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "eigen.h"
 #include "geometry/geometry.h"
 #include "projection/generic_camera.h"
+#include "reconstruction/bearing_table.h"
 
 #include "render/object.h"
 
@@ -46,6 +47,7 @@ private:
     
     vector<IObject * > _objectVec;
     ICamera * _camera;
+    std::shared_ptr<const BearingTable> _bearingTable; // the rays of _camera
     
     //TODO init all the matrices
     Mat16s _idxMat;
@@ -0,0 +1,76 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+A blocking FIFO of a fixed capacity to connect pipeline stages
+*/
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+
+#include "std.h"
+
+template<typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(int capacity) : _capacity(max(capacity, 1)) {}
+
+    //blocks while the queue is full
+    //returns false if the queue has been closed
+    bool push(T && item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this]{ return _closed or _queue.size() < _capacity; });
+        if (_closed) return false;
+        _queue.push(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    //blocks while the queue is empty
+    //returns false once the queue is closed and drained
+    bool pop(T & item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this]{ return _closed or not _queue.empty(); });
+        if (_queue.empty()) return false;
+        item = std::move(_queue.front());
+        _queue.pop();
+        _notFull.notify_one();
+        return true;
+    }
+
+    //no more items will be pushed, the consumers drain what is left
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+    }
+
+private:
+    const size_t _capacity;
+    bool _closed = false;
+    queue<T> _queue;
+    std::mutex _mutex;
+    std::condition_variable _notEmpty, _notFull;
+};
+
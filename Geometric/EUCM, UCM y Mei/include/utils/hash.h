@@ -0,0 +1,52 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+64-bit FNV-1a hashing of the parameters which on-disk caches depend on
+*/
+
+#pragma once
+
+#include "std.h"
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+inline void hashBytes(uint64_t & hash, const void * data, size_t size)
+{
+    const uint8_t * bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+//the size is hashed too, so that concatenations of different vectors differ
+template<typename T>
+void hashVector(uint64_t & hash, const vector<T> & valVec)
+{
+    const uint64_t size = valVec.size();
+    hashBytes(hash, &size, sizeof(size));
+    hashBytes(hash, valVec.data(), valVec.size() * sizeof(T));
+}
+
+template<typename T>
+void hashValue(uint64_t & hash, const T & val)
+{
+    hashBytes(hash, &val, sizeof(val));
+}
+
@@ -0,0 +1,69 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Read-only memory mapping of a whole file (POSIX)
+*/
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "std.h"
+#include "io.h"
+
+class MappedFile
+{
+public:
+    //an invalid mapping if the file cannot be opened or is empty
+    MappedFile(const string & fileName)
+    {
+        const int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 and fileStat.st_size > 0)
+        {
+            void * addr = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                _data = (const uint8_t *)addr;
+                _size = fileStat.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (_data != NULL) munmap((void *)_data, _size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator = (const MappedFile &) = delete;
+
+    bool valid() const { return _data != NULL; }
+    const uint8_t * data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const uint8_t * _data = NULL;
+    size_t _size = 0;
+};
+
@@ -0,0 +1,278 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Eight unsigned 16-bit lanes with saturating arithmetic
+and four float lanes.
+SSE2 and NEON are used when available, plain loops otherwise.
+All the loads and stores are unaligned.
+*/
+
+#pragma once
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <cstring>
+
+#include "std.h"
+
+#if defined(__SSE2__)
+
+struct U16x8
+{
+    static const int SIZE = 8;
+    __m128i v;
+
+    static U16x8 load(const uint16_t * src) { return {_mm_loadu_si128((const __m128i *)src)}; }
+
+    //widens 8 bytes
+    static U16x8 load(const uint8_t * src)
+    {
+        return {_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)src), _mm_setzero_si128())};
+    }
+
+    static U16x8 broadcast(uint16_t val) { return {_mm_set1_epi16(int16_t(val))}; }
+
+    void store(uint16_t * dst) const { _mm_storeu_si128((__m128i *)dst, v); }
+};
+
+inline U16x8 addSat(U16x8 a, U16x8 b) { return {_mm_adds_epu16(a.v, b.v)}; }
+inline U16x8 subSat(U16x8 a, U16x8 b) { return {_mm_subs_epu16(a.v, b.v)}; }
+//SSE2 has no unsigned 16-bit min: a - (a - b)+
+inline U16x8 minLanes(U16x8 a, U16x8 b) { return {_mm_subs_epu16(a.v, _mm_subs_epu16(a.v, b.v))}; }
+
+#elif defined(__ARM_NEON)
+
+struct U16x8
+{
+    static const int SIZE = 8;
+    uint16x8_t v;
+
+    static U16x8 load(const uint16_t * src) { return {vld1q_u16(src)}; }
+    static U16x8 load(const uint8_t * src) { return {vmovl_u8(vld1_u8(src))}; }
+    static U16x8 broadcast(uint16_t val) { return {vdupq_n_u16(val)}; }
+    void store(uint16_t * dst) const { vst1q_u16(dst, v); }
+};
+
+inline U16x8 addSat(U16x8 a, U16x8 b) { return {vqaddq_u16(a.v, b.v)}; }
+inline U16x8 subSat(U16x8 a, U16x8 b) { return {vqsubq_u16(a.v, b.v)}; }
+inline U16x8 minLanes(U16x8 a, U16x8 b) { return {vminq_u16(a.v, b.v)}; }
+
+#else
+
+struct U16x8
+{
+    static const int SIZE = 8;
+    uint16_t v[SIZE];
+
+    static U16x8 load(const uint16_t * src)
+    {
+        U16x8 res;
+        for (int i = 0; i < SIZE; i++) res.v[i] = src[i];
+        return res;
+    }
+
+    static U16x8 load(const uint8_t * src)
+    {
+        U16x8 res;
+        for (int i = 0; i < SIZE; i++) res.v[i] = src[i];
+        return res;
+    }
+
+    static U16x8 broadcast(uint16_t val)
+    {
+        U16x8 res;
+        for (int i = 0; i < SIZE; i++) res.v[i] = val;
+        return res;
+    }
+
+    void store(uint16_t * dst) const { for (int i = 0; i < SIZE; i++) dst[i] = v[i]; }
+};
+
+inline U16x8 addSat(U16x8 a, U16x8 b)
+{
+    for (int i = 0; i < U16x8::SIZE; i++) a.v[i] = min(int(a.v[i]) + b.v[i], int(UINT16_MAX));
+    return a;
+}
+
+inline U16x8 subSat(U16x8 a, U16x8 b)
+{
+    for (int i = 0; i < U16x8::SIZE; i++) a.v[i] = max(int(a.v[i]) - b.v[i], 0);
+    return a;
+}
+
+inline U16x8 minLanes(U16x8 a, U16x8 b)
+{
+    for (int i = 0; i < U16x8::SIZE; i++) a.v[i] = min(a.v[i], b.v[i]);
+    return a;
+}
+
+#endif
+
+//the smallest lane
+inline uint16_t minElement(U16x8 a)
+{
+    uint16_t buf[U16x8::SIZE];
+    a.store(buf);
+    return *min_element(buf, buf + U16x8::SIZE);
+}
+
+//scalar counterparts for the loop tails
+inline uint16_t addSat(uint16_t a, uint16_t b) { return min(int(a) + b, int(UINT16_MAX)); }
+inline uint16_t subSat(uint16_t a, uint16_t b) { return max(int(a) - b, 0); }
+
+#if defined(__SSE2__)
+
+struct F32x4
+{
+    static const int SIZE = 4;
+    __m128 v;
+
+    static F32x4 load(const float * src) { return {_mm_loadu_ps(src)}; }
+
+    //widens 4 bytes
+    static F32x4 load(const uint8_t * src)
+    {
+        int32_t bytes;
+        std::memcpy(&bytes, src, sizeof(bytes));
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        return {_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero))};
+    }
+
+    static F32x4 broadcast(float val) { return {_mm_set1_ps(val)}; }
+
+    void store(float * dst) const { _mm_storeu_ps(dst, v); }
+};
+
+inline F32x4 operator + (F32x4 a, F32x4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline F32x4 operator - (F32x4 a, F32x4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline F32x4 operator * (F32x4 a, F32x4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline F32x4 sqrtLanes(F32x4 a) { return {_mm_sqrt_ps(a.v)}; }
+//a where a > thresh, zero elsewhere
+inline F32x4 greaterOrZero(F32x4 a, F32x4 thresh) { return {_mm_and_ps(a.v, _mm_cmpgt_ps(a.v, thresh.v))}; }
+
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+
+struct F32x4
+{
+    static const int SIZE = 4;
+    float32x4_t v;
+
+    static F32x4 load(const float * src) { return {vld1q_f32(src)}; }
+
+    //widens 4 bytes
+    static F32x4 load(const uint8_t * src)
+    {
+        uint32_t bytes;
+        std::memcpy(&bytes, src, sizeof(bytes));
+        const uint16x8_t words = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(bytes)));
+        return {vcvtq_f32_u32(vmovl_u16(vget_low_u16(words)))};
+    }
+
+    static F32x4 broadcast(float val) { return {vdupq_n_f32(val)}; }
+    void store(float * dst) const { vst1q_f32(dst, v); }
+};
+
+inline F32x4 operator + (F32x4 a, F32x4 b) { return {vaddq_f32(a.v, b.v)}; }
+inline F32x4 operator - (F32x4 a, F32x4 b) { return {vsubq_f32(a.v, b.v)}; }
+inline F32x4 operator * (F32x4 a, F32x4 b) { return {vmulq_f32(a.v, b.v)}; }
+inline F32x4 sqrtLanes(F32x4 a) { return {vsqrtq_f32(a.v)}; }
+inline F32x4 greaterOrZero(F32x4 a, F32x4 thresh)
+{
+    return {vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vcgtq_f32(a.v, thresh.v)))};
+}
+
+#else
+
+struct F32x4
+{
+    static const int SIZE = 4;
+    float v[SIZE];
+
+    template<typename T>
+    static F32x4 load(const T * src)
+    {
+        F32x4 res;
+        for (int i = 0; i < SIZE; i++) res.v[i] = src[i];
+        return res;
+    }
+
+    static F32x4 broadcast(float val)
+    {
+        F32x4 res;
+        for (int i = 0; i < SIZE; i++) res.v[i] = val;
+        return res;
+    }
+
+    void store(float * dst) const { for (int i = 0; i < SIZE; i++) dst[i] = v[i]; }
+};
+
+inline F32x4 operator + (F32x4 a, F32x4 b)
+{
+    for (int i = 0; i < F32x4::SIZE; i++) a.v[i] += b.v[i];
+    return a;
+}
+
+inline F32x4 operator - (F32x4 a, F32x4 b)
+{
+    for (int i = 0; i < F32x4::SIZE; i++) a.v[i] -= b.v[i];
+    return a;
+}
+
+inline F32x4 operator * (F32x4 a, F32x4 b)
+{
+    for (int i = 0; i < F32x4::SIZE; i++) a.v[i] *= b.v[i];
+    return a;
+}
+
+inline F32x4 sqrtLanes(F32x4 a)
+{
+    for (int i = 0; i < F32x4::SIZE; i++) a.v[i] = std::sqrt(a.v[i]);
+    return a;
+}
+
+inline F32x4 greaterOrZero(F32x4 a, F32x4 thresh)
+{
+    for (int i = 0; i < F32x4::SIZE; i++) if (not (a.v[i] > thresh.v[i])) a.v[i] = 0;
+    return a;
+}
+
+#endif
+
+//a single float lane with the interface of F32x4, for the loop tails of the templated kernels
+struct F32x1
+{
+    static const int SIZE = 1;
+    float v;
+
+    static F32x1 load(const float * src) { return {*src}; }
+    static F32x1 load(const uint8_t * src) { return {float(*src)}; }
+    static F32x1 broadcast(float val) { return {val}; }
+    void store(float * dst) const { *dst = v; }
+};
+
+inline F32x1 operator + (F32x1 a, F32x1 b) { return {a.v + b.v}; }
+inline F32x1 operator - (F32x1 a, F32x1 b) { return {a.v - b.v}; }
+inline F32x1 operator * (F32x1 a, F32x1 b) { return {a.v * b.v}; }
+inline F32x1 sqrtLanes(F32x1 a) { return {std::sqrt(a.v)}; }
+inline F32x1 greaterOrZero(F32x1 a, F32x1 thresh) { return {a.v > thresh.v ? a.v : 0.f}; }
+
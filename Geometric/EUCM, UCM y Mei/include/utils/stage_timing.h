@@ -0,0 +1,48 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Duration statistics of a processing stage
+*/
+
+#pragma once
+
+#include "std.h"
+
+struct StageTiming
+{
+    int count = 0;
+    double total = 0;
+    double maxTime = 0;
+
+    void add(double t)
+    {
+        count++;
+        total += t;
+        maxTime = max(maxTime, t);
+    }
+
+    void add(const StageTiming & other)
+    {
+        count += other.count;
+        total += other.total;
+        maxTime = max(maxTime, other.maxTime);
+    }
+
+    double mean() const { return count ? total / count : 0; }
+};
+
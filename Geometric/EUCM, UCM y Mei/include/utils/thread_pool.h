@@ -0,0 +1,160 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+A fixed set of worker threads for data-parallel loops
+*/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#include "std.h"
+
+class ThreadPool
+{
+public:
+    //threadCount <= 0 means one thread per core
+    //the calling thread takes part in the work, so threadCount - 1 workers are created
+    ThreadPool(int threadCount = 0)
+    {
+        if (threadCount <= 0) threadCount = max(int(std::thread::hardware_concurrency()), 1);
+        for (int i = 1; i < threadCount; i++)
+        {
+            _workerVec.emplace_back([this]{ workerLoop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeUp.notify_all();
+        for (auto & worker : _workerVec) worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator = (const ThreadPool &) = delete;
+
+    int size() const { return _workerVec.size() + 1; }
+
+    /*
+    Calls func(begin, end) on disjoint blocks which cover [0, count)
+    and returns when all of them are processed.
+    Blocks are at least grain long; the order of the calls is not specified.
+    A nested call (from inside func) runs serially in the calling thread.
+    */
+    template<typename Func>
+    void parallelFor(int count, Func && func, int grain = 1)
+    {
+        if (count <= 0) return;
+        grain = max(grain, 1);
+        const int blockCount = min((count + grain - 1) / grain, 4 * size());
+        if (blockCount <= 1 or _workerVec.empty() or insideJob())
+        {
+            func(0, count);
+            return;
+        }
+
+        //one job at a time
+        std::lock_guard<std::mutex> jobLock(_jobMutex);
+        const int blockSize = (count + blockCount - 1) / blockCount;
+        std::function<void(int)> block = [&](int blockIdx)
+        {
+            const int begin = blockIdx * blockSize;
+            func(begin, min(begin + blockSize, count));
+        };
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _block = &block;
+            _blockCount = (count + blockSize - 1) / blockSize;
+            _nextBlock = 0;
+            _pendingBlocks = _blockCount;
+            _generation++;
+        }
+        _wakeUp.notify_all();
+        runBlocks();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]{ return _pendingBlocks == 0 and _activeWorkers == 0; });
+        _block = NULL;
+    }
+
+private:
+    static bool & insideJob()
+    {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    //takes blocks until there are none left
+    void runBlocks()
+    {
+        insideJob() = true;
+        int blockIdx;
+        while ((blockIdx = _nextBlock++) < _blockCount)
+        {
+            (*_block)(blockIdx);
+            if (--_pendingBlocks == 0)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _done.notify_all();
+            }
+        }
+        insideJob() = false;
+    }
+
+    void workerLoop()
+    {
+        int seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wakeUp.wait(lock, [&]{ return _stop or seenGeneration != _generation; });
+                if (_stop) return;
+                seenGeneration = _generation;
+                if (_block == NULL) continue;
+                _activeWorkers++;
+            }
+            runBlocks();
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_activeWorkers == 0) _done.notify_all();
+        }
+    }
+
+    vector<std::thread> _workerVec;
+    std::mutex _jobMutex;
+    std::mutex _mutex;
+    std::condition_variable _wakeUp, _done;
+    bool _stop = false;
+    int _generation = 0;
+    int _activeWorkers = 0;
+
+    //the current job
+    std::function<void(int)> * _block = NULL;
+    int _blockCount = 0;
+    std::atomic<int> _nextBlock{0};
+    std::atomic<int> _pendingBlocks{0};
+};
+
@@ -17,102 +17,135 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
     
 #include "calibration/calib_cost_functions.h"
 
+#include <memory>
+#include <typeinfo>
+
 #include "eigen.h"
 #include "io.h"
 
 #include "geometry/geometry.h"
 #include "projection/jacobian.h"
 #include "projection/generic_camera.h"
+#include "projection/static_camera.h"
 
 
+namespace
+{
+    // per-thread storage of GenericProjectionJac::Evaluate,
+    // so that the evaluation allocates nothing once warmed up and can run concurrently
+    struct ProjectionScratch
+    {
+        Vector3dVec pointCamVec;
+        vector<Transf> xi13Vec; // the chain before every transformation, for the Jacobian
+        vector<std::unique_ptr<ICamera>> cameraVec; // one per camera model
+    };
+    
+    ProjectionScratch & projectionScratch()
+    {
+        static thread_local ProjectionScratch scratch;
+        return scratch;
+    }
+    
+    // a thread-local camera of the same model as camera with the given intrinsics
+    const ICamera & cameraView(ProjectionScratch & scratch, const ICamera & camera,
+            const double * intrinsics)
+    {
+        ICamera * view = NULL;
+        for (auto & cam : scratch.cameraVec)
+        {
+            if (typeid(*cam) == typeid(camera)) view = cam.get();
+        }
+        if (view == NULL)
+        {
+            scratch.cameraVec.emplace_back(camera.clone());
+            view = scratch.cameraVec.back().get();
+        }
+        view->width = camera.width;
+        view->height = camera.height;
+        view->setParameters(intrinsics);
+        return *view;
+    }
+}
+
 bool GenericProjectionJac::Evaluate(double const * const * params,
         double * residual, double ** jacobian) const
 {
+    ProjectionScratch & scratch = projectionScratch();
+    
     //compute the transformation chain
+    const int transformCount = _transformStatusVec.size();
+    scratch.xi13Vec.resize(transformCount);
     Transformation<double> xiAcc;
-    for (int paramIdx = 1; paramIdx <= _transformStatusVec.size(); paramIdx++)
+    for (int paramIdx = 1; paramIdx <= transformCount; paramIdx++)
     {
         auto const status = _transformStatusVec[paramIdx - 1];
+        Transformation<double> xi(params[paramIdx]);
         if (status == TRANSFORM_DIRECT)
         {
-            Transformation<double> xi(params[paramIdx]);
             xiAcc = xiAcc.compose(xi);
+            scratch.xi13Vec[paramIdx - 1] = xiAcc;
         }
         else if (status == TRANSFORM_INVERSE)
         {
-            Transformation<double> xi(params[paramIdx]);
+            scratch.xi13Vec[paramIdx - 1] = xiAcc;
             xiAcc = xiAcc.composeInverse(xi);
         }
     }
     
     //compute the points in the camera frame
-    Vector3dVec pointCamVec;
+    Vector3dVec & pointCamVec = scratch.pointCamVec;
     xiAcc.transform(_grid, pointCamVec);
     
-    //get the intrinsic parameters
+    //get the intrinsic parameters, _camera itself is never modified
     const int cameraIntrinsicIdx = 0;
-    _camera->setParameters(params[cameraIntrinsicIdx]);
-    
-    //compute the reprojection error
-    for (int i = 0; i < pointCamVec.size(); i++)
-    {
-        Vector2d modProj;
-        if (_camera->projectPoint(pointCamVec[i], modProj)) 
-        {
-            Vector2d diff = modProj - _proj[i];
-            residual[2*i] = diff[0];
-            residual[2*i + 1] = diff[1];
-        }
-        else
-        {
-            residual[2*i] = DOUBLE_BIG;
-            residual[2*i + 1] = DOUBLE_BIG;
-        }
-    }
+    const ICamera & camera = cameraView(scratch, *_camera, params[cameraIntrinsicIdx]);
     
-    if (jacobian != NULL)
+    dispatchCamera(camera, [&](const auto & cam)
     {
-        //compute the transformation chain
-        Transformation<double> xiAcc;
-//        for (int paramIdx = 0; paramIdx < _transformStatusVec.size(); paramIdx++) //FIXME
-        for (int paramIdx = 1; paramIdx <= _transformStatusVec.size(); paramIdx++)
+        //compute the reprojection error
+        for (int i = 0; i < pointCamVec.size(); i++)
         {
-            auto const status = _transformStatusVec[paramIdx - 1];
-            Transformation<double> xi23(params[paramIdx]);
-            Transformation<double> xi13;
-            if (status == TRANSFORM_DIRECT)
+            Vector2d modProj;
+            if (cam.projectPoint(pointCamVec[i], modProj)) 
             {
-                xiAcc = xiAcc.compose(xi23);
-                xi13 = xiAcc;
+                Vector2d diff = modProj - _proj[i];
+                residual[2*i] = diff[0];
+                residual[2*i + 1] = diff[1];
             }
-            else if (status == TRANSFORM_INVERSE)
+            else
             {
-                xi13 = xiAcc;
-                xiAcc = xiAcc.composeInverse(xi23);
+                residual[2*i] = DOUBLE_BIG;
+                residual[2*i + 1] = DOUBLE_BIG;
             }
-            if (jacobian[paramIdx] != NULL)
+        }
+        
+        if (jacobian == NULL) return;
+        
+        for (int paramIdx = 1; paramIdx <= transformCount; paramIdx++)
+        {
+            if (jacobian[paramIdx] == NULL) continue;
+            auto const status = _transformStatusVec[paramIdx - 1];
+            Transformation<double> xi23(params[paramIdx]);
+            InterJacobian jacobianCalculator(scratch.xi13Vec[paramIdx - 1], xi23,
+                    status == TRANSFORM_INVERSE);
+            for (int i = 0; i < pointCamVec.size(); i++)
             {
-                InterJacobian jacobianCalculator(_camera, xi13, xi23, status == TRANSFORM_INVERSE);
-                
-                for (int i = 0; i < pointCamVec.size(); i++)
-                {
-                    jacobianCalculator.dpdxi(pointCamVec[i], jacobian[paramIdx] + i*12,
-                                                            jacobian[paramIdx] + i*12 + 6);
-                }
+                jacobianCalculator.dpdxi(cam, pointCamVec[i], jacobian[paramIdx] + i*12,
+                                                        jacobian[paramIdx] + i*12 + 6);
             }
         }
         
         if (jacobian[cameraIntrinsicIdx] != NULL)
         {
-            
+            const int intrinsicCount = camera.numParams();
             for (int i = 0; i < pointCamVec.size(); i++)
             {
-                _camera->intrinsicJacobian(pointCamVec[i],
-                            jacobian[cameraIntrinsicIdx] + i * 2 * _camera->numParams(),
-                            jacobian[cameraIntrinsicIdx] + (i * 2 + 1) * _camera->numParams());
+                cam.intrinsicJacobian(pointCamVec[i],
+                            jacobian[cameraIntrinsicIdx] + i * 2 * intrinsicCount,
+                            jacobian[cameraIntrinsicIdx] + (i * 2 + 1) * intrinsicCount);
             }
         }
-    }
+    });
     return true;
 }
 
@@ -0,0 +1,135 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "calibration/corner_cache.h"
+
+#include <cstdio>
+
+#include "utils/hash.h"
+
+namespace
+{
+    const char CORNER_CACHE_MAGIC[4] = {'C', 'R', 'N', 'R'};
+
+    struct CornerCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t entryCount;
+    };
+}
+
+uint64_t cornerCacheKey(const vector<uint8_t> & fileData, int Nx, int Ny,
+        int initRadius, bool improveDetection, int pyramidLevels)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashValue(hash, CORNER_CACHE_VERSION);
+    hashVector(hash, fileData);
+    hashValue(hash, Nx);
+    hashValue(hash, Ny);
+    hashValue(hash, initRadius);
+    const uint8_t improveFlag = improveDetection;
+    hashValue(hash, improveFlag);
+    if (pyramidLevels > 0) hashValue(hash, pyramidLevels);
+    return hash;
+}
+
+CornerCache::CornerCache(const string & fileName) :
+        _fileName(fileName)
+{
+    if (enabled() and not load()) _entryMap.clear();
+}
+
+bool CornerCache::find(uint64_t key, Vector2dVec & cornerVec) const
+{
+    auto entryIter = _entryMap.find(key);
+    if (entryIter == _entryMap.end()) return false;
+    cornerVec = entryIter->second;
+    return true;
+}
+
+void CornerCache::insert(uint64_t key, const Vector2dVec & cornerVec)
+{
+    _entryMap[key] = cornerVec;
+    _modified = true;
+}
+
+//file layout : header, then entryCount times {key, pointCount, pointCount x (u, v)}
+bool CornerCache::load()
+{
+    ifstream cacheFile(_fileName, std::ios::binary);
+    if (not cacheFile) return false;
+
+    CornerCacheHeader header;
+    cacheFile.read((char *)&header, sizeof(header));
+    if (not cacheFile
+        or not std::equal(header.magic, header.magic + 4, CORNER_CACHE_MAGIC)
+        or header.version != CORNER_CACHE_VERSION)
+    {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < header.entryCount; i++)
+    {
+        uint64_t key;
+        uint32_t pointCount;
+        cacheFile.read((char *)&key, sizeof(key));
+        cacheFile.read((char *)&pointCount, sizeof(pointCount));
+        if (not cacheFile) return false;
+        Vector2dVec & cornerVec = _entryMap[key];
+        cornerVec.resize(pointCount);
+        for (auto & pt : cornerVec)
+        {
+            cacheFile.read((char *)pt.data(), 2 * sizeof(double));
+        }
+        if (not cacheFile) return false;
+    }
+    return true;
+}
+
+bool CornerCache::save()
+{
+    if (not enabled() or not _modified) return true;
+
+    //write to a temporary file first so that an interrupted run never leaves a partial cache
+    const string tmpName = _fileName + ".tmp";
+    {
+        ofstream cacheFile(tmpName, std::ios::binary | std::ios::trunc);
+        if (not cacheFile) return false;
+
+        CornerCacheHeader header;
+        copy(CORNER_CACHE_MAGIC, CORNER_CACHE_MAGIC + 4, header.magic);
+        header.version = CORNER_CACHE_VERSION;
+        header.entryCount = _entryMap.size();
+        cacheFile.write((const char *)&header, sizeof(header));
+        for (auto & entry : _entryMap)
+        {
+            const uint32_t pointCount = entry.second.size();
+            cacheFile.write((const char *)&entry.first, sizeof(entry.first));
+            cacheFile.write((const char *)&pointCount, sizeof(pointCount));
+            for (auto & pt : entry.second)
+            {
+                cacheFile.write((const char *)pt.data(), 2 * sizeof(double));
+            }
+        }
+        if (not cacheFile) return false;
+    }
+    if (std::rename(tmpName.c_str(), _fileName.c_str()) != 0) return false;
+    _modified = false;
+    return true;
+}
+
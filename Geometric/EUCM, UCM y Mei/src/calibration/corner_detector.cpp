@@ -23,6 +23,8 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "io.h"
 
 #include "utils/curve_rasterizer.h"
+#include "utils/thread_pool.h"
+#include "utils/simd.h"
 
 
 
@@ -32,14 +34,20 @@ SubpixelCorner::SubpixelCorner(const Mat32f & gradu, const Mat32f & gradv, const
              const int steps, const double length) :    
             _graduGrid(gradu.cols, gradu.rows, (float*)gradu.data),
             _gradvGrid(gradv.cols, gradv.rows, (float*)gradv.data),
-            _stepLength(length / steps),
-            _prior(pt0)
+            stepVec(2*steps)
 {
-    stepVec.reserve(2*steps);
+    setCorner(pt0, length);
+}
+
+void SubpixelCorner::setCorner(const Vector2d pt0, const double length)
+{
+    const int steps = stepVec.size() / 2;
+    _stepLength = length / steps;
+    _prior = pt0;
     for (int i = 1; i <= steps; i++)
     {
-        stepVec.push_back(-i * _stepLength);
-        stepVec.push_back(i * _stepLength);
+        stepVec[2*i - 2] = -i * _stepLength;
+        stepVec[2*i - 1] = i * _stepLength;
     }
 }
 
@@ -161,6 +169,7 @@ void detected(Mat& img, const array<double, 5> & data, int size,
 
 void CornerDetector::improveCorners(Vector2dVec & pointVec)
 {
+    if (pointVec.empty()) return;
     vector<double> radVec;
     radVec.reserve(pointVec.size());
     for (int i = 0; i < pointVec.size(); i++)
@@ -173,12 +182,14 @@ void CornerDetector::improveCorners(Vector2dVec & pointVec)
         else radMax = min( radMax, (pointVec[i] - pointVec[i + 1]).norm()*0.7 );
         radVec.push_back(radMax);
     }
-    for (int i = 0; i < pointVec.size(); i++)
+    
+    //the gradient images are shared read-only,
+    //every block refines its corners with a single problem which is moved from corner to corner
+    auto refineBlock = [&](int begin, int end)
     {
-        Vector2d x = pointVec[i];
-        array<double, 5> dataArr;
-        initPoin(round(x), dataArr.data());
-        ceres::GradientProblem problem(new SubpixelCorner(_gradx, _grady, x, 7, radVec[i]));
+        SubpixelCorner * costFunction = new SubpixelCorner(_gradx, _grady, pointVec[begin],
+                                                            7, radVec[begin]);
+        ceres::GradientProblem problem(costFunction); // takes the ownership
         ceres::GradientProblemSolver::Options options;
 //        options.line_search_direction_type = ceres::NONLINEAR_CONJUGATE_GRADIENT;
 //        options.line_search_type = ceres::ARMIJO;
@@ -187,14 +198,23 @@ void CornerDetector::improveCorners(Vector2dVec & pointVec)
         options.logging_type = ceres::SILENT;
         options.minimizer_progress_to_stdout = true;
         ceres::GradientProblemSolver::Summary summary;
-        ceres::Solve(options, problem, dataArr.data(), &summary);
-        
-//        cout << summary.FullReport() << endl;
-        
-        pointVec[i][0] = dataArr[0];
-        pointVec[i][1] = dataArr[1];
-    }
+        for (int i = begin; i < end; i++)
+        {
+            Vector2d x = pointVec[i];
+            array<double, 5> dataArr;
+            initPoin(round(x), dataArr.data());
+            costFunction->setCorner(x, radVec[i]);
+            ceres::Solve(options, problem, dataArr.data(), &summary);
+            
+//            cout << summary.FullReport() << endl;
+            
+            pointVec[i][0] = dataArr[0];
+            pointVec[i][1] = dataArr[1];
+        }
+    };
     
+    if (_threadPool != NULL) _threadPool->parallelFor(pointVec.size(), refineBlock, 4);
+    else refineBlock(0, pointVec.size());
 }
 
 CornerDetector::CornerDetector(int Nx, int Ny, int initRadius, bool improveDetection, bool debug) :
@@ -203,33 +223,39 @@ CornerDetector::CornerDetector(int Nx, int Ny, int initRadius, bool improveDetec
     MAX_CANDIDATE_COUNT(10 * Nx * Ny),
     INIT_RADIUS(initRadius),
     IMPROVE_DETECTION(improveDetection),
-    DEBUG(debug)
+    DEBUG(debug),
+    _fusedResponse(false),
+    _pyramidLevels(0),
+    _scaleIdx(0),
+    _threadPool(NULL)
 { }
 
 void CornerDetector::setImage(const Mat8u & img)
 {
     img.copyTo(_img);
     
-    _resp.create(_img.size());
-    _imgrad.create(_img.size());
-    _gradx.create(_img.size());
-    _grady.create(_img.size());
     _src1.create(_img.size());
-    _src2.create(_img.size());
     _detected.create(_img.size());
     _idxMap.create(_img.size());
 }
 
+//the scales of the saddle response, in the order they are tried
+const vector<double> DETECTION_SIGMA_VEC = {1.4, 2, 1};
+//const vector<double> DETECTION_SIGMA_VEC = {3};
+
 bool CornerDetector::detectPattern(Vector2dVec & ptVec)
 {
-    const vector<double> sigmaVec = {1.4, 2, 1};
-//    const vector<double> sigmaVec = {3};
+    if (_pyramidLevels > 0) return detectPatternPyramid(ptVec);
+    
+    const vector<double> & sigmaVec = DETECTION_SIGMA_VEC;
     vector<int> idxVec;
     bool detected = false;
+    if (_fusedResponse) computeResponses(0.7, sigmaVec);
     for (int i = 0; i < sigmaVec.size() and not detected; i++)
     {
         INIT_RADIUS = round(1.5 * sigmaVec[i]);
-        computeResponse(0.7, sigmaVec[i]);
+        if (_fusedResponse) useResponse(i);
+        else computeResponse(0.7, sigmaVec[i]);
         
         selectCandidates();
         if (DEBUG) cout << "HEAP SIZE : " << _hypHeap.size()  << endl;
@@ -242,6 +268,7 @@ bool CornerDetector::detectPattern(Vector2dVec & ptVec)
         if (idxVec.size() != _Nx * _Ny) continue;
         
         detected = true;
+        _scaleIdx = i;
     }
     if (not detected) return false;
     ptVec.clear();
@@ -258,74 +285,272 @@ bool CornerDetector::detectPattern(Vector2dVec & ptVec)
     
     return true;
 }
+
+bool CornerDetector::detectPatternPyramid(Vector2dVec & ptVec)
+{
+    //the grid is assembled on the downscaled image
+    Mat8u coarse = _img;
+    for (int i = 0; i < _pyramidLevels; i++)
+    {
+        Mat8u halved;
+        cv::pyrDown(coarse, halved);
+        coarse = halved;
+    }
+    if (not _coarseDetector) _coarseDetector.reset(new CornerDetector(_Nx, _Ny, INIT_RADIUS, false, DEBUG));
+    _coarseDetector->setThreadPool(_threadPool);
+    _coarseDetector->setImage(coarse);
+    Vector2dVec coarseVec;
+    if (not _coarseDetector->detectPattern(coarseVec)) return false;
+    _scaleIdx = _coarseDetector->_scaleIdx;
+    const double sigma = DETECTION_SIGMA_VEC[_scaleIdx];
+    INIT_RADIUS = round(1.5 * sigma);
+    
+    //pyrDown keeps the even pixels, so the coarse pixel x is the full-resolution pixel 2x
+    //the response is computed around the predictions only,
+    //with a margin for the search and for the refinement
+    const int scale = 1 << _pyramidLevels;
+    const int searchRadius = scale;
+    const int margin = searchRadius + 16;
+    const Rect imageRect(0, 0, _img.cols, _img.rows);
+    Vector2iVec predictionVec;
+    vector<Rect> windowVec;
+    for (auto & pt : coarseVec)
+    {
+        predictionVec.push_back(normalizePoint(round(pt[0] * scale), round(pt[1] * scale)));
+        const Vector2i & pred = predictionVec.back();
+        windowVec.push_back(Rect(pred[0] - margin, pred[1] - margin, 2*margin + 1, 2*margin + 1) & imageRect);
+    }
+    computeWindowResponse(0.7, sigma, windowVec);
+    
+    //the corner is the strongest response around the prediction, as a candidate of selectCandidates
+    ptVec.clear();
+    for (auto & pred : predictionVec)
+    {
+        Vector2i best = pred;
+        double bestVal = -1;
+        for (int v = max(pred[1] - searchRadius, 1); v <= min(pred[1] + searchRadius, _img.rows - 2); v++)
+        {
+            for (int u = max(pred[0] - searchRadius, 1); u <= min(pred[0] + searchRadius, _img.cols - 2); u++)
+            {
+                if (_resp(v, u) > bestVal)
+                {
+                    bestVal = _resp(v, u);
+                    best << u, v;
+                }
+            }
+        }
+        ptVec.emplace_back(best[0], best[1]);
+    }
+    
+    if (IMPROVE_DETECTION)
+    {
+        improveCorners(ptVec);
+    }
+    
+    return true;
+}
     
+namespace
+{
+    //the rows v - 1, v and v + 1 of an image
+    struct RowWindow
+    {
+        RowWindow(const Mat8u & img, const int v) :
+                prev(img[v - 1]), cur(img[v]), next(img[v + 1]) {}
+        
+        const uint8_t * prev, * cur, * next;
+    };
+    
+    struct ResponseRow
+    {
+        float * gradx, * grady, * imgrad, * resp;
+    };
+    
+    //sharp gradient and saddle response of F::SIZE pixels starting from u
+    template<typename F>
+    inline void responsePixels(const RowWindow & src1, const RowWindow & src2, const int u,
+            const ResponseRow & dst)
+    {
+        const F center = F::load(src2.cur + u);
+        const F left = F::load(src2.cur + u - 1);
+        const F right = F::load(src2.cur + u + 1);
+        const F up = F::load(src2.prev + u);
+        const F down = F::load(src2.next + u);
+        
+        //compute sharp gradient
+        const F gx2 = right - left;
+        const F gy2 = down - up;
+        const F half = F::broadcast(0.5f), quarter = F::broadcast(0.25f), scale = F::broadcast(0.01f);
+        const F gxSharp = (F::load(src1.cur + u + 1) - F::load(src1.cur + u - 1)
+                - F::broadcast(0.3f) * gx2) * half;
+        const F gySharp = (F::load(src1.next + u) - F::load(src1.prev + u) 
+                - F::broadcast(0.3f) * gy2) * half;
+        (scale * gxSharp).store(dst.gradx + u);
+        (scale * gySharp).store(dst.grady + u);
+        (scale * sqrtLanes(gxSharp * gxSharp + gySharp * gySharp)).store(dst.imgrad + u);
+        
+        //We are looking for saddle points, that is negative hessian determinant
+        const F two = F::broadcast(2.f);
+        const F iuu = left + right - two * center;
+        const F ivv = up + down - two * center;
+        const F iuv = quarter * (F::load(src2.prev + u - 1) + F::load(src2.next + u + 1)
+                - F::load(src2.next + u - 1) - F::load(src2.prev + u + 1));
+        const F gsq = quarter * (gx2 * gx2 + gy2 * gy2);
+        const F respVal = iuv * iuv - iuu * ivv - F::broadcast(0.001f) * gsq * gsq;
+        greaterOrZero(respVal, F::broadcast(0.01f)).store(dst.resp + u);
+    }
+    
+    //pixels [uBegin, uEnd) of one row of the response maps
+    //returns the sum of the responses, count gets their number
+    double responseRow(const RowWindow & src1, const RowWindow & src2, const int uBegin, const int uEnd,
+            const ResponseRow & dst, int & count)
+    {
+        int u = uBegin;
+        for (; u + F32x4::SIZE <= uEnd; u += F32x4::SIZE)
+        {
+            responsePixels<F32x4>(src1, src2, u, dst);
+        }
+        for (; u < uEnd; u++)
+        {
+            responsePixels<F32x1>(src1, src2, u, dst);
+        }
+        
+        double acc = 0;
+        count = 0;
+        for (u = uBegin; u < uEnd; u++)
+        {
+            acc += dst.resp[u];
+            count += dst.resp[u] > 0;
+        }
+        return acc;
+    }
+}
+
 void CornerDetector::computeResponse(const double SIGMA_1, const double SIGMA_2)
 {
-//    const double SIGMA_1 = 0.7; //TODO make a parameter
+    computeResponses(SIGMA_1, {SIGMA_2});
+    useResponse(0);
+}
+
+void CornerDetector::computeResponses(const double SIGMA_1, const vector<double> & sigmaVec)
+{
     const int FILTER_SIZE_1 = 3;
     GaussianBlur(_img, _src1, Size(FILTER_SIZE_1, FILTER_SIZE_1), SIGMA_1, SIGMA_1);
     
-//    const double SIGMA_2 = 2.5; //TODO make a parameter
-    const int FILTER_SIZE_2 = 1 + 2 * ceil(SIGMA_2);
-    GaussianBlur(_img, _src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), SIGMA_2, SIGMA_2);
-    _imgrad.setTo(0);
-    _resp.setTo(0);
-    double acc = 0;
-    int count = 0;
-    const int SIZE = 1;
-    const int HSIZE = 1;
-    for (int v = SIZE; v < _img.rows - SIZE; v++)
+    const int levelCount = sigmaVec.size();
+    _levelVec.resize(levelCount);
+    for (int k = 0; k < levelCount; k++)
     {
-        for (int u = SIZE; u < _img.cols - SIZE; u++)
+        ResponseLevel & level = _levelVec[k];
+        const double SIGMA_2 = sigmaVec[k];
+        const int FILTER_SIZE_2 = 1 + 2 * ceil(SIGMA_2);
+        GaussianBlur(_img, level.src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), SIGMA_2, SIGMA_2);
+        for (Mat32f * map : {&level.resp, &level.imgrad, &level.gradx, &level.grady})
         {
-            //compute sharp gradient
-            double gxSharp = ( _src1(v, u + 1) - _src1(v, u - 1)  
-- 0.3*(_src2(v, u + 1) - _src2(v, u - 1)) ) / 2.;
-            double gySharp = ( _src1(v + 1, u) - _src1(v - 1, u) 
-- 0.3*(_src2(v + 1, u) - _src2(v - 1, u)) ) / 2.;
-//            double gxSharp = ( _src1(v, u + 1) - _src1(v, u - 1) ) / 2.;
-//            double gySharp = ( _src1(v + 1, u) - _src1(v - 1, u) ) / 2.;
-            _gradx(v, u) = gxSharp * 0.01;
-            _grady(v, u) = gySharp * 0.01;
-            _imgrad(v, u) = sqrt(gxSharp*gxSharp + gySharp*gySharp) * 0.01;
-            
-            
-            
-            
-            //We are looking for saddle points, that is negative hessian determinant
-            double iuu = _src2(v, u - SIZE) + _src2(v, u + SIZE) - 2* _src2(v, u);
-            iuu /= SIZE*SIZE;
-            double ivv = _src2(v - SIZE, u) + _src2(v + SIZE, u) - 2* _src2(v, u);
-            ivv /= SIZE*SIZE;
-            double iuv = _src2(v - HSIZE, u - HSIZE) + _src2(v + HSIZE, u + HSIZE) 
-                            - _src2(v  + HSIZE, u - HSIZE) - _src2(v - HSIZE, u + HSIZE);
-            iuv /= 4*HSIZE*HSIZE;
-            
-            double gx = (_src2(v, u + HSIZE) - _src2(v, u - HSIZE) ) / (2 * HSIZE);
-            double gy = (_src2(v + HSIZE, u) - _src2(v - HSIZE, u) ) / (2 * HSIZE);
-            double gsq = gx * gx + gy * gy;
-            double _respVal = -iuu * ivv + iuv * iuv - 0.001*pow(gsq, 2);
-            if (_respVal > 0.01) 
+            map->create(_img.size());
+            map->row(0).setTo(0);
+            map->row(_img.rows - 1).setTo(0);
+        }
+    }
+    
+    //the rows are split between the threads,
+    //a row of _src1 serves all the levels while it is in the cache
+    const int rowCount = _img.rows - 2;
+    vector<double> accVec(max(rowCount, 0) * levelCount);
+    vector<int> countVec(accVec.size());
+    auto computeRows = [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            const int v = i + 1;
+            const RowWindow src1(_src1, v);
+            for (int k = 0; k < levelCount; k++)
             {
-                _resp(v, u) = _respVal;
-                acc += _respVal;
-                count++;
+                ResponseLevel & level = _levelVec[k];
+                const ResponseRow dst{level.gradx[v], level.grady[v], level.imgrad[v], level.resp[v]};
+                for (float * row : {dst.gradx, dst.grady, dst.imgrad, dst.resp})
+                {
+                    row[0] = 0;
+                    row[_img.cols - 1] = 0;
+                }
+                accVec[i * levelCount + k] = responseRow(src1, RowWindow(level.src2, v),
+                        1, _img.cols - 1, dst, countVec[i * levelCount + k]);
             }
         }
+    };
+    if (_threadPool != NULL) _threadPool->parallelFor(rowCount, computeRows, 16);
+    else computeRows(0, rowCount);
+    
+    //summed up in the row order, the result does not depend on the threads
+    for (int k = 0; k < levelCount; k++)
+    {
+        double acc = 0;
+        int count = 0;
+        for (int i = 0; i < rowCount; i++)
+        {
+            acc += accVec[i * levelCount + k];
+            count += countVec[i * levelCount + k];
+        }
+        _levelVec[k].avgVal = acc / count;
     }
-    _avgVal = acc / count;
-    if (DEBUG)
+}
+
+void CornerDetector::computeWindowResponse(const double SIGMA_1, const double SIGMA_2,
+        const vector<Rect> & windowVec)
+{
+    _levelVec.resize(1);
+    ResponseLevel & level = _levelVec[0];
+    level.src2.create(_img.size());
+    for (Mat32f * map : {&level.resp, &level.imgrad, &level.gradx, &level.grady})
+    {
+        map->create(_img.size());
+    }
+    
+    const int FILTER_SIZE_1 = 3;
+    const int FILTER_SIZE_2 = 1 + 2 * ceil(SIGMA_2);
+    for (auto & window : windowVec)
     {
-        imshow("img", _img );
-        imshow("imgrad", _imgrad);
-        imshow("resp", _resp / 100);
-        imwrite("img.png", _img );
+        if (window.width < 3 or window.height < 3) continue;
         
-        Mat32f resp2;
-        GaussianBlur(_resp, resp2, Size(11, 11), 1, 1);
-        imwrite("resp.png", 255 - 25*resp2);
-        waitKey();
+        //the blur reads the pixels around the window, so the result is the same as for the whole image
+        Mat8u src1 = _src1(window), src2 = level.src2(window);
+        GaussianBlur(_img(window), src1, Size(FILTER_SIZE_1, FILTER_SIZE_1), SIGMA_1, SIGMA_1);
+        GaussianBlur(_img(window), src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), SIGMA_2, SIGMA_2);
+        for (int v = window.y + 1; v < window.y + window.height - 1; v++)
+        {
+            const ResponseRow dst{level.gradx[v], level.grady[v], level.imgrad[v], level.resp[v]};
+            int count;
+            responseRow(RowWindow(_src1, v), RowWindow(level.src2, v),
+                    window.x + 1, window.x + window.width - 1, dst, count);
+        }
     }
+    level.avgVal = 0;
+    useResponse(0);
+}
+
+void CornerDetector::useResponse(const int level)
+{
+    const ResponseLevel & current = _levelVec[level];
+    _src2 = current.src2;
+    _resp = current.resp;
+    _imgrad = current.imgrad;
+    _gradx = current.gradx;
+    _grady = current.grady;
+    _avgVal = current.avgVal;
+    if (DEBUG) showResponse();
+}
+
+void CornerDetector::showResponse()
+{
+    imshow("img", _img );
+    imshow("imgrad", _imgrad);
+    imshow("resp", _resp / 100);
+    imwrite("img.png", _img );
+    
+    Mat32f resp2;
+    GaussianBlur(_resp, resp2, Size(11, 11), 1, 1);
+    imwrite("resp.png", 255 - 25*resp2);
+    waitKey();
 }
 
 bool CornerDetector::checkCorner(const Vector2i & pt, const int checkRadius)
@@ -0,0 +1,349 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "calibration/rectification.h"
+
+#include <memory>
+#include <sstream>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "timer.h"
+#include "utils/bounded_queue.h"
+#include "utils/hash.h"
+
+#include "projection/pinhole.h"
+#include "projection/eucm.h"
+#include "projection/ucm.h"
+#include "projection/mei.h"
+
+namespace
+{
+    const char RECTIFICATION_MAP_MAGIC[4] = {'R', 'M', 'A', 'P'};
+
+    struct RectificationMapHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;
+        int32_t rows, cols;
+        int32_t type1, type2; //type2 is -1 if map2 is empty
+    };
+}
+
+ICamera * createCamera(const vector<double> & params)
+{
+    switch (params.size())
+    {
+    case 6:     return new EnhancedCamera(params.data());
+    case 5:     return new UnifiedCamera(params.data());
+    case 10:    return new MeiCamera(params.data());
+    default:    return NULL;
+    }
+}
+
+void initRemap(const vector<double> & cameraParams, const vector<double> & pinholeParams,
+        const Transf & xi, Mat32f & mapX, Mat32f & mapY, bool maskInvalid)
+{
+    assert(pinholeParams.size() == 5);
+    std::unique_ptr<ICamera> camera(createCamera(cameraParams));
+    if (not camera)
+    {
+        throw runtime_error("unsupported camera model: "
+            + to_string(cameraParams.size()) + " parameters are given");
+    }
+    Pinhole pinhole(pinholeParams[2], pinholeParams[3], pinholeParams[4]);
+
+    mapX.create(pinholeParams[1], pinholeParams[0]);
+    mapY.create(pinholeParams[1], pinholeParams[0]);
+
+    ImagePointsSoA imagePoints;
+    imagePoints.resize(mapX.rows * mapX.cols);
+    for (int i = 0, idx = 0; i < mapX.rows; i++)
+    {
+        for (int j = 0; j < mapX.cols; j++, idx++)
+        {
+            imagePoints.u[idx] = j;
+            imagePoints.v[idx] = i;
+        }
+    }
+
+    PointCloudSoA pointCloud;
+    vector<uint8_t> maskVec;
+    pinhole.reconstructPointCloud(imagePoints, pointCloud, maskVec);
+    transformPointCloud(xi, pointCloud);
+    camera->projectPointCloud(pointCloud, imagePoints, maskVec);
+
+    //points which are not projected are marked by -1 in any case
+    const double uMax = pinholeParams[0];
+    const double vMax = pinholeParams[1];
+    for (int i = 0, idx = 0; i < mapX.rows; i++)
+    {
+        for (int j = 0; j < mapX.cols; j++, idx++)
+        {
+            const double u = imagePoints.u[idx];
+            const double v = imagePoints.v[idx];
+            if (not maskVec[idx] or
+                (maskInvalid and not (u >= 0 and u < uMax and v >= 0 and v < vMax)))
+            {
+                mapX(i, j) = -1;
+                mapY(i, j) = -1;
+            }
+            else
+            {
+                mapX(i, j) = u;
+                mapY(i, j) = v;
+            }
+        }
+    }
+}
+
+uint64_t rectificationHash(const vector<double> & cameraParams,
+        const vector<double> & pinholeParams, const Transf & xi, bool maskInvalid,
+        bool nnInterpolation)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashBytes(hash, &RECTIFICATION_MAP_VERSION, sizeof(RECTIFICATION_MAP_VERSION));
+    hashVector(hash, cameraParams);
+    hashVector(hash, pinholeParams);
+    const Array6d xiArr = xi.toArray();
+    hashBytes(hash, xiArr.data(), xiArr.size() * sizeof(double));
+    const uint8_t flagArr[2] = {maskInvalid, nnInterpolation};
+    hashBytes(hash, flagArr, sizeof(flagArr));
+    return hash;
+}
+
+bool loadRectificationMap(const string & fileName, uint64_t hash, RectificationMap & rectMap)
+{
+    ifstream mapFile(fileName, std::ios::binary);
+    if (not mapFile) return false;
+
+    RectificationMapHeader header;
+    mapFile.read((char *)&header, sizeof(header));
+    if (not mapFile
+        or not std::equal(header.magic, header.magic + 4, RECTIFICATION_MAP_MAGIC)
+        or header.version != RECTIFICATION_MAP_VERSION
+        or header.hash != hash
+        or header.type1 != CV_16SC2 or (header.type2 != CV_16UC1 and header.type2 != -1)
+        or header.rows <= 0 or header.cols <= 0)
+    {
+        return false;
+    }
+
+    rectMap.map1.create(header.rows, header.cols, CV_16SC2);
+    if (header.type2 == -1) rectMap.map2.release();
+    else rectMap.map2.create(header.rows, header.cols, CV_16UC1);
+    mapFile.read((char *)rectMap.map1.data, rectMap.map1.total() * rectMap.map1.elemSize());
+    mapFile.read((char *)rectMap.map2.data, rectMap.map2.total() * rectMap.map2.elemSize());
+    if (not mapFile)
+    {
+        rectMap = RectificationMap();
+        return false;
+    }
+    return true;
+}
+
+bool saveRectificationMap(const string & fileName, uint64_t hash, const RectificationMap & rectMap)
+{
+    assert(rectMap.map1.type() == CV_16SC2 and (rectMap.map2.empty() or rectMap.map2.type() == CV_16UC1));
+    assert(rectMap.map1.isContinuous() and (rectMap.map2.empty() or rectMap.map2.isContinuous()));
+
+    //write to a temporary file first so that concurrent runs never read a partial map
+    const string tmpName = fileName + ".tmp";
+    {
+        ofstream mapFile(tmpName, std::ios::binary | std::ios::trunc);
+        if (not mapFile) return false;
+
+        RectificationMapHeader header;
+        copy(RECTIFICATION_MAP_MAGIC, RECTIFICATION_MAP_MAGIC + 4, header.magic);
+        header.version = RECTIFICATION_MAP_VERSION;
+        header.hash = hash;
+        header.rows = rectMap.map1.rows;
+        header.cols = rectMap.map1.cols;
+        header.type1 = rectMap.map1.type();
+        header.type2 = rectMap.map2.empty() ? -1 : rectMap.map2.type();
+        mapFile.write((const char *)&header, sizeof(header));
+        mapFile.write((const char *)rectMap.map1.data, rectMap.map1.total() * rectMap.map1.elemSize());
+        mapFile.write((const char *)rectMap.map2.data, rectMap.map2.total() * rectMap.map2.elemSize());
+        if (not mapFile) return false;
+    }
+    return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
+
+string rectificationMapFileName(const string & cacheDir, uint64_t hash)
+{
+    std::ostringstream name;
+    name << "rectification_" << std::hex << std::setfill('0') << setw(16) << hash << ".map";
+    if (cacheDir.empty() or cacheDir.back() == '/') return cacheDir + name.str();
+    return cacheDir + "/" + name.str();
+}
+
+void getRectificationMap(const vector<double> & cameraParams, const vector<double> & pinholeParams,
+        const Transf & xi, const string & cacheDir, RectificationMap & rectMap,
+        bool maskInvalid, bool nnInterpolation)
+{
+    const uint64_t hash = rectificationHash(cameraParams, pinholeParams, xi, maskInvalid, nnInterpolation);
+    const string fileName = rectificationMapFileName(cacheDir, hash);
+    if (not cacheDir.empty() and loadRectificationMap(fileName, hash, rectMap)) return;
+
+    Mat32f mapX, mapY;
+    initRemap(cameraParams, pinholeParams, xi, mapX, mapY, maskInvalid);
+    cv::convertMaps(mapX, mapY, rectMap.map1, rectMap.map2, CV_16SC2, nnInterpolation);
+    if (nnInterpolation) rectMap.map2.release();
+
+    if (not cacheDir.empty() and not saveRectificationMap(fileName, hash, rectMap))
+    {
+        std::cerr << "WARNING: failed to cache the rectification map in " << fileName << endl;
+    }
+}
+
+BatchSettings readBatchSettings(const ptree & root)
+{
+    BatchSettings settings;
+    auto node = root.get_child_optional("batch");
+    if (not node) return settings;
+    settings.decoderCount = max(1, node->get<int>("decoders", settings.decoderCount));
+    settings.workerCount = max(1, node->get<int>("workers", settings.workerCount));
+    settings.encoderCount = max(1, node->get<int>("encoders", settings.encoderCount));
+    settings.queueSize = max(1, node->get<int>("queue_size", settings.queueSize));
+    return settings;
+}
+
+void BatchReport::print() const
+{
+    cout << "frames processed : " << frameCount - failedCount << " / " << frameCount << endl;
+    cout << "wall time        : " << wallTime << " s" << endl;
+    cout << "throughput       : " << (frameCount - failedCount) / wallTime << " frames/s" << endl;
+    cout << "stage latency, ms (mean / max)" << endl;
+    for (auto & x : {make_pair("  decode", &decode), make_pair("  remap ", &remap),
+                     make_pair("  encode", &encode), make_pair("  total ", &latency)})
+    {
+        cout << x.first << " : " << 1e3 * x.second->mean() << " / " << 1e3 * x.second->maxTime << endl;
+    }
+}
+
+namespace
+{
+    struct BatchFrame
+    {
+        int idx;
+        Mat img;
+        Timer timer; //started when the decoding begins
+    };
+
+    //runs threadCount instances of job and closes the output queue after the last one
+    template<typename Job>
+    void launchStage(vector<std::thread> & threadVec, int threadCount,
+            BoundedQueue<BatchFrame> * output, std::atomic<int> & activeCount, Job job)
+    {
+        activeCount = threadCount;
+        for (int i = 0; i < threadCount; i++)
+        {
+            threadVec.emplace_back([&activeCount, output, job]() mutable
+            {
+                job();
+                if (--activeCount == 0 and output != NULL) output->close();
+            });
+        }
+    }
+}
+
+BatchReport rectifyBatch(const vector<string> & inputVec, const vector<string> & outputVec,
+        const ImageDecoder & decode, const ImageProcessor & process, const BatchSettings & settings)
+{
+    assert(inputVec.size() == outputVec.size());
+    assert(settings.decoderCount > 0 and settings.workerCount > 0 and settings.encoderCount > 0);
+    BatchReport report;
+    report.frameCount = inputVec.size();
+    Timer wallTimer;
+
+    BoundedQueue<BatchFrame> decodedQueue(settings.queueSize);
+    BoundedQueue<BatchFrame> remappedQueue(settings.queueSize);
+    std::mutex reportMutex;
+    std::atomic<int> nextIdx(0), failedCount(0);
+    std::atomic<int> decoderActive(0), workerActive(0), encoderActive(0);
+    vector<std::thread> threadVec;
+
+    auto mergeTiming = [&](StageTiming & dst, const StageTiming & src)
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        dst.add(src);
+    };
+
+    launchStage(threadVec, settings.decoderCount, &decodedQueue, decoderActive, [&]()
+    {
+        StageTiming timing;
+        for (int idx = nextIdx++; idx < int(inputVec.size()); idx = nextIdx++)
+        {
+            BatchFrame frame;
+            frame.idx = idx;
+            frame.timer.reset();
+            frame.img = decode(inputVec[idx]);
+            timing.add(frame.timer.elapsed());
+            if (frame.img.empty())
+            {
+                std::cerr << "ERROR: cannot read " << inputVec[idx] << endl;
+                failedCount++;
+                continue;
+            }
+            decodedQueue.push(std::move(frame));
+        }
+        mergeTiming(report.decode, timing);
+    });
+
+    launchStage(threadVec, settings.workerCount, &remappedQueue, workerActive, [&]()
+    {
+        StageTiming timing;
+        BatchFrame frame;
+        while (decodedQueue.pop(frame))
+        {
+            Timer timer;
+            Mat dst;
+            process(frame.img, dst);
+            frame.img = dst;
+            timing.add(timer.elapsed());
+            remappedQueue.push(std::move(frame));
+        }
+        mergeTiming(report.remap, timing);
+    });
+
+    launchStage(threadVec, settings.encoderCount, NULL, encoderActive, [&]()
+    {
+        StageTiming timing, latency;
+        BatchFrame frame;
+        while (remappedQueue.pop(frame))
+        {
+            Timer timer;
+            if (not imwrite(outputVec[frame.idx], frame.img))
+            {
+                std::cerr << "ERROR: cannot write " << outputVec[frame.idx] << endl;
+                failedCount++;
+            }
+            timing.add(timer.elapsed());
+            latency.add(frame.timer.elapsed());
+        }
+        mergeTiming(report.encode, timing);
+        mergeTiming(report.latency, latency);
+    });
+
+    for (auto & th : threadVec) th.join();
+    report.failedCount = failedCount;
+    report.wallTime = wallTimer.elapsed();
+    return report;
+}
@@ -31,11 +31,299 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "calibration/calib_cost_functions.h"
 #include "calibration/odometry_cost_function.h"
 #include "calibration/corner_detector.h"
+#include "calibration/corner_cache.h"
+#include "utils/thread_pool.h"
 #include "projection/generic_camera.h"
 #include "projection/eucm.h"
 #include "projection/ucm.h"
 #include "projection/mei.h"
 
+namespace
+{
+    //the projection parameters fu, fv, u0, v0 are the last four in all the models
+    //the distortion parameters take typical fisheye values
+    vector<double> initialIntrinsics(const string & model, const vector<double> & valVec,
+            const vector<double> & initValue)
+    {
+        if (not initValue.empty()) return initValue;
+        vector<double> res;
+        if (model == "eucm") res = {0.6, 1.1};
+        else if (model == "ucm") res = {0.9};
+        else if (model == "mei") res = {0.9, 0, 0, 0, 0, 0};
+        else throw runtime_error("invalid camera model name");
+        if (valVec.size() < 4) throw runtime_error("invalid number of intrinsic parameters");
+        res.insert(res.end(), valVec.end() - 4, valVec.end());
+        return res;
+    }
+    
+    //the prefix goes before the file name, not before the directory
+    string prefixFileName(const string & prefix, const string & path)
+    {
+        const size_t pos = path.find_last_of('/') + 1;
+        return path.substr(0, pos) + prefix + path.substr(pos);
+    }
+}
+
+CalibrationSolverSettings readSolverSettings(const ptree & root)
+{
+    CalibrationSolverSettings settings;
+    auto node = root.get_child_optional("solver");
+    if (not node) return settings;
+    settings.threadCount = node->get<int>("threads", settings.threadCount);
+    settings.linearSolver = node->get<string>("linear_solver", settings.linearSolver);
+    settings.preconditioner = node->get<string>("preconditioner", settings.preconditioner);
+    settings.maxIterations = node->get<int>("max_iterations", settings.maxIterations);
+    settings.functionTolerance = node->get<double>("function_tolerance", settings.functionTolerance);
+    settings.gradientTolerance = node->get<double>("gradient_tolerance", settings.gradientTolerance);
+    settings.parameterTolerance = node->get<double>("parameter_tolerance", settings.parameterTolerance);
+    return settings;
+}
+
+void applySolverSettings(const CalibrationSolverSettings & settings, Solver::Options & options)
+{
+    if (not ceres::StringToLinearSolverType(settings.linearSolver, &options.linear_solver_type))
+    {
+        throw runtime_error("unknown linear solver " + settings.linearSolver);
+    }
+    if (not ceres::StringToPreconditionerType(settings.preconditioner, &options.preconditioner_type))
+    {
+        throw runtime_error("unknown preconditioner " + settings.preconditioner);
+    }
+    options.num_threads = (settings.threadCount > 0) ? settings.threadCount 
+                            : max(int(std::thread::hardware_concurrency()), 1);
+    options.max_num_iterations = settings.maxIterations;
+    options.function_tolerance = settings.functionTolerance;
+    options.gradient_tolerance = settings.gradientTolerance;
+    options.parameter_tolerance = settings.parameterTolerance;
+}
+
+CalibrationSolution readCalibrationSolution(const string & fileName)
+{
+    ptree node;
+    try
+    {
+        read_json(fileName, node);
+    }
+    catch (const boost::property_tree::json_parser_error & e)
+    {
+        throw runtime_error("cannot read the calibration solution " + fileName + " : " + e.what());
+    }
+    CalibrationSolution solution;
+    for (auto & x : node.get_child("cameras"))
+    {
+        const string name = x.second.get<string>("name");
+        solution.cameraTypeMap[name] = x.second.get<string>("type");
+        solution.intrinsicMap[name] = readVector<double>(x.second.get_child("value"));
+    }
+    for (auto & x : node.get_child("global_transformations"))
+    {
+        const string name = x.second.get<string>("name");
+        solution.globalTransformMap[name] = readTransform(x.second.get_child("value")).toArray();
+    }
+    for (auto & x : node.get_child("sequences"))
+    {
+        auto & poseMap = solution.sequencePoseMap[x.second.get<string>("name")];
+        for (auto & pose : x.second.get_child("poses"))
+        {
+            poseMap[pose.second.get<string>("image")] = readTransform(pose.second.get_child("value")).toArray();
+        }
+    }
+    return solution;
+}
+
+void GenericCameraCalibration::saveSolution(const string & fileName) const
+{
+    ptree cameras;
+    for (auto & x : intrinsicMap)
+    {
+        //the odometry parameters are in intrinsicMap as well
+        auto typeIter = cameraTypeMap.find(x.first);
+        if (typeIter == cameraTypeMap.end()) continue;
+        ptree camera;
+        camera.put("name", x.first);
+        camera.put("type", typeIter->second);
+        camera.add_child("value", writeVector(x.second));
+        cameras.push_back(make_pair("", camera));
+    }
+    
+    ptree globals;
+    for (auto & x : globalTransformMap)
+    {
+        if (not transformInfoMap.find(x.first)->second.initialized) continue;
+        ptree transform;
+        transform.put("name", x.first);
+        transform.add_child("value", writeVector(x.second));
+        globals.push_back(make_pair("", transform));
+    }
+    
+    //the poses are stored by image name, so that a later run can add or remove images
+    ptree sequences;
+    for (auto & data : dataVec)
+    {
+        for (auto & name : data.transNameVec)
+        {
+            const auto & info = transformInfoMap.find(name)->second;
+            if (info.global or not info.initialized) continue;
+            const auto & poseVec = sequenceTransformMap.find(name)->second;
+            const auto & initVec = sequenceInitMap.find(name)->second;
+            ptree poses;
+            for (int i = 0; i < data.detectedCornersVec.size() and i < initVec.size(); i++)
+            {
+                if (data.detectedCornersVec[i].empty() or not initVec[i]) continue;
+                ptree pose;
+                pose.put("image", data.imageName(i));
+                pose.add_child("value", writeVector(poseVec[i]));
+                poses.push_back(make_pair("", pose));
+            }
+            ptree sequence;
+            sequence.put("name", name);
+            sequence.add_child("poses", poses);
+            sequences.push_back(make_pair("", sequence));
+        }
+    }
+    
+    ptree solution;
+    solution.add_child("cameras", cameras);
+    solution.add_child("global_transformations", globals);
+    solution.add_child("sequences", sequences);
+    write_json(fileName, solution);
+}
+
+void GenericCameraCalibration::computeCovariance()
+{
+    covarianceMap.clear();
+    vector<pair<const double*, const double*>> blockVec;
+    for (auto & x : intrinsicMap)
+    {
+        const double * block = x.second.data();
+        if (not globalProblem.HasParameterBlock(block) 
+                or globalProblem.IsParameterBlockConstant(const_cast<double*>(block))) continue;
+        blockVec.emplace_back(block, block);
+    }
+    if (blockVec.empty()) return;
+    
+    Covariance::Options options;
+    options.num_threads = solverSettings.threadCount;
+    if (options.num_threads <= 0) options.num_threads = max(int(std::thread::hardware_concurrency()), 1);
+    Covariance covariance(options);
+    if (not covariance.Compute(blockVec, &globalProblem))
+    {
+        if (not quiet) cout << "WARNING : the covariance of the intrinsics is not available" << endl;
+        return;
+    }
+    for (auto & block : blockVec)
+    {
+        for (auto & x : intrinsicMap)
+        {
+            if (x.second.data() != block.first) continue;
+            auto & covVec = covarianceMap[x.first];
+            covVec.resize(x.second.size() * x.second.size());
+            covariance.GetCovarianceBlock(block.first, block.first, covVec.data());
+        }
+    }
+}
+
+void GenericCameraCalibration::writeReport(const string & fileName, bool binaryResiduals) const
+{
+    ptree report;
+    report.put("converged", solverSummary.IsSolutionUsable());
+    
+    ptree cameras;
+    for (auto & x : intrinsicMap)
+    {
+        ptree camera;
+        camera.put("name", x.first);
+        auto typeIter = cameraTypeMap.find(x.first);
+        camera.put("type", typeIter != cameraTypeMap.end() ? typeIter->second : "odometry");
+        camera.put("constant", cameraConstantMap.count(x.first) and cameraConstantMap.find(x.first)->second);
+        camera.add_child("value", writeVector(x.second));
+        auto covIter = covarianceMap.find(x.first);
+        if (covIter != covarianceMap.end())
+        {
+            const int n = x.second.size();
+            vector<double> sigmaVec;
+            for (int i = 0; i < n; i++) sigmaVec.push_back(sqrt(covIter->second[i * n + i]));
+            camera.add_child("sigma", writeVector(sigmaVec));
+            camera.add_child("covariance", writeVector(covIter->second));
+        }
+        cameras.push_back(make_pair("", camera));
+    }
+    report.add_child("cameras", cameras);
+    
+    ptree globals;
+    for (auto & x : globalTransformMap)
+    {
+        ptree transform;
+        transform.put("name", x.first);
+        transform.add_child("value", writeVector(x.second));
+        globals.push_back(make_pair("", transform));
+    }
+    report.add_child("global_transformations", globals);
+    
+    //the residuals of every grid
+    vector<vector<double>> rmsVec, maxVec, residualVec;
+    const double rms = computeReprojectionError(rmsVec, &maxVec, binaryResiduals ? &residualVec : NULL);
+    ptree datasets;
+    for (int dataIdx = 0; dataIdx < dataVec.size(); dataIdx++)
+    {
+        const ImageData & data = dataVec[dataIdx];
+        ptree images;
+        double dataAcc = 0;
+        int dataCount = 0;
+        for (int imageIdx = 0; imageIdx < data.detectedCornersVec.size(); imageIdx++)
+        {
+            if (data.detectedCornersVec[imageIdx].empty()) continue;
+            const int points = data.board.size();
+            ptree image;
+            image.put("name", data.imageName(imageIdx));
+            image.put("points", points);
+            image.put("rms", rmsVec[dataIdx][imageIdx]);
+            image.put("max", maxVec[dataIdx][imageIdx]);
+            if (binaryResiduals) image.put("offset", dataCount);
+            images.push_back(make_pair("", image));
+            dataAcc += pow(rmsVec[dataIdx][imageIdx], 2) * points;
+            dataCount += points;
+        }
+        
+        ptree dataset;
+        dataset.put("camera", data.cameraName);
+        dataset.put("rms", dataCount ? sqrt(dataAcc / dataCount) : 0.);
+        if (binaryResiduals)
+        {
+            const string residualFile = outputPrefix + "residuals_" + to_string(dataIdx) + ".bin";
+            ofstream file(residualFile, std::ios::binary);
+            file.write((const char*)residualVec[dataIdx].data(), residualVec[dataIdx].size() * sizeof(double));
+            dataset.put("residual_file", residualFile);
+        }
+        dataset.add_child("images", images);
+        datasets.push_back(make_pair("", dataset));
+    }
+    report.put("rms", rms);
+    report.add_child("data", datasets);
+    
+    ptree solver;
+    solver.put("termination", ceres::TerminationTypeToString(solverSummary.termination_type));
+    solver.put("message", solverSummary.message);
+    solver.put("iterations", solverSummary.iterations.size());
+    solver.put("initial_cost", solverSummary.initial_cost);
+    solver.put("final_cost", solverSummary.final_cost);
+    solver.put("linear_solver", ceres::LinearSolverTypeToString(solverSummary.linear_solver_type_used));
+    solver.put("threads", solverSummary.num_threads_used);
+    solver.put("residuals", solverSummary.num_residuals);
+    solver.put("parameters", solverSummary.num_parameters);
+    report.add_child("solver", solver);
+    
+    ptree phases;
+    phases.put("load", timing.load);
+    phases.put("detect", timing.detect);
+    phases.put("init", timing.init);
+    phases.put("solve", timing.solve);
+    phases.put("covariance", timing.covariance);
+    report.add_child("timing", phases);
+    
+    write_json(fileName, report);
+}
+
 bool GenericCameraCalibration::compute()
 {
     //run the solver
@@ -43,49 +331,64 @@ bool GenericCameraCalibration::compute()
 //    options.check_gradients = true;
 //    options.gradient_check_relative_precision = 0.01;
 //    options.line_search_direction_type = ceres::NONLINEAR_CONJUGATE_GRADIENT;
-    options.max_num_iterations = 1000;
-    options.function_tolerance = 1e-15;
-    options.gradient_tolerance = 1e-15;
-    options.parameter_tolerance = 1e-15;
+    applySolverSettings(solverSettings, options);
 //    options.logging_type = ceres::SILENT;
-    options.minimizer_progress_to_stdout = true;
-    Solver::Summary summary;
+    options.minimizer_progress_to_stdout = not quiet;
+    Solver::Summary & summary = solverSummary;
+    Timer timer;
     Solve(options, &globalProblem, &summary);
-    cout << summary.FullReport() << endl;
-    
-    cout << "Intrinsic parameters :" << endl;
-    for (auto & x : intrinsicMap)
+    timing.solve = timer.elapsed();
+    if (not quiet)
     {
-        cout << x.first << " : ";
-        for (int i = 0; i < cameraMap[x.first]->numParams(); i++)
+        cout << summary.FullReport() << endl;
+        
+        cout << "Intrinsic parameters :" << endl;
+        for (auto & x : intrinsicMap)
         {
-            cout << x.second[i] << "  ";
+            cout << x.first << " : ";
+            for (int i = 0; i < cameraMap[x.first]->numParams(); i++)
+            {
+                cout << x.second[i] << "  ";
+            }
+            cout << endl;
+            
         }
-        cout << endl;
         
-    }
-    
-    cout << "Local extrinsic parameters :" << endl;
-    for (auto & sequenceMap : sequenceTransformMap)
-    {
-        cout << "Sequence : " << sequenceMap.first << endl;
-        int i = 0;
-        for (auto & x : sequenceMap.second)
+        cout << "Local extrinsic parameters :" << endl;
+        for (auto & sequenceMap : sequenceTransformMap)
         {
-            cout << i++ << " : " << Transf(x.data()) << endl;
+            cout << "Sequence : " << sequenceMap.first << endl;
+            int i = 0;
+            for (auto & x : sequenceMap.second)
+            {
+                cout << i++ << " : " << Transf(x.data()) << endl;
+            }
+        }
+        
+        cout << "Global extrinsic parameters :" << endl;
+        for (auto & x : globalTransformMap)
+        {
+            cout << x.first << " : " << Transf(x.second.data()) << endl;
         }
     }
     
-    cout << "Global extrinsic parameters :" << endl;
-    for (auto & x : globalTransformMap)
+    for (int i = 0; i < dataVec.size(); i++)
     {
-        cout << x.first << " : " << Transf(x.second.data()) << endl;
+        writeImageResidual(dataVec[i], outputPrefix + "image_error_" + to_string(i) + ".txt");
     }
-    
-    for (int i = 0; i < dataVec.size(); i++)
+    if (not solutionFile.empty() and summary.IsSolutionUsable())
+    {
+        saveSolution(solutionFile);
+        if (not quiet) cout << "Solution saved to " << solutionFile << endl;
+    }
+    if (not reportFile.empty())
     {
-        writeImageResidual(dataVec[i], "image_error_" + to_string(i) + ".txt");
+        timer.reset();
+        computeCovariance();
+        timing.covariance = timer.elapsed();
+        writeReport(prefixFileName(outputPrefix, reportFile), reportResiduals);
     }
+    return summary.IsSolutionUsable();
 }
 
 void GenericCameraCalibration::parseTransforms()
@@ -139,11 +442,26 @@ void GenericCameraCalibration::parseCameras()
         cameraConstantMap[name] = cameraInfo.second.get<bool>("constant");
         intrinsicMap[name] = vector<double>();
         auto & intrinsicVec = intrinsicMap[name];
-        const string cameraType = cameraInfo.second.get<string>("type");
+        string cameraType = cameraInfo.second.get<string>("type");
         for (auto & x : cameraInfo.second.get_child("value"))
         {
             intrinsicVec.push_back(x.second.get_value<double>());
         }
+        if (not sweepModel.empty() and not cameraConstantMap[name])
+        {
+            cameraType = sweepModel;
+            intrinsicVec = initialIntrinsics(sweepModel, intrinsicVec, sweepInitValue);
+        }
+        //the previous solution replaces the initial values if the model is the same
+        auto warmIter = warmStart.intrinsicMap.find(name);
+        if (warmIter != warmStart.intrinsicMap.end() and not cameraConstantMap[name]
+                and warmStart.cameraTypeMap[name] == cameraType
+                and warmIter->second.size() == intrinsicVec.size())
+        {
+            intrinsicVec = warmIter->second;
+            cout << "Warm start : " << name << endl;
+        }
+        cameraTypeMap[name] = cameraType;
         //TODO add other projection models in the future
         if (cameraType == "eucm")
         {
@@ -182,6 +500,8 @@ void GenericCameraCalibration::parseCameras()
 void GenericCameraCalibration::initTransformChainInfo(ImageData & data, const ptree & node)
 {
     data.cameraName = node.get<string>("camera");
+    data.threadCount = node.get<int>("thread_count", 0);
+    data.pyramidLevels = node.get<int>("pyramid_levels", 0);
     for (auto & flag : node.get_child("parameters"))
     {
         string flagName = flag.second.get_value<string>();
@@ -298,13 +618,16 @@ void GenericCameraCalibration::initGrid(ImageData & data, const ptree & node)
     //fill up detectedCornersVec which stores all the extracted grids
     data.useImages = true;
     const string prefix = node.get<string>("images.prefix");
+    data.cornerCacheFile = node.get<string>("images.corner_cache", prefix + "corner_cache.bin");
     data.detectedCornersVec.clear();
     for (auto & x : node.get_child("images.names"))
     {
         const string filename = x.second.get_value<string>();
         data.imageNameVec.emplace_back(prefix + filename);
     }
+    Timer timer;
     extractGridProjections(data);
+    timing.detect += timer.elapsed();
 
 }
 
@@ -349,10 +672,23 @@ Transf GenericCameraCalibration::getInitTransform(Transf xi,
 
 bool GenericCameraCalibration::addResiduals(const string & infoFileName)
 {
+    Timer timer;
+    const double nestedTime = timing.detect + timing.init;
     read_json(infoFileName, root);
+    if (root.count("solver")) solverSettings = readSolverSettings(root);
+    if (root.count("report"))
+    {
+        reportFile = root.get<string>("report.file");
+        reportResiduals = root.get<bool>("report.binary_residuals", false);
+    }
+    if (root.count("warm_start")) warmStart = readCalibrationSolution(root.get<string>("warm_start"));
+    solutionFile = root.get<string>("save_solution", solutionFile);
     parseTransforms();
     parseCameras();
     parseData();
+    //detect and init are timed inside parseData
+    timing.load += timer.elapsed() - (timing.detect + timing.init - nestedTime);
+    return true;
 }
 
 void GenericCameraCalibration::initGlobalTransform(const ImageData & data, const string & name)
@@ -478,12 +814,26 @@ void GenericCameraCalibration::initTransforms(const ImageData & data, const stri
             sequenceTransformMap[initName].reserve(data.detectedCornersVec.size());
         }
         
+        //the poses of the images known to the previous solution are not estimated again
+        const auto warmIter = warmStart.sequencePoseMap.find(initName);
+        int warmCount = 0;
         for (int transfIdx = 0; transfIdx < data.detectedCornersVec.size(); transfIdx++)
         {
             if (not IS_ALLOCATED)
             {
                 sequenceTransformMap[initName].push_back(Array6d{0, 0, 1, 0, 0, 0});  
                 sequenceInitMap[initName].push_back(false);
+                if (warmIter != warmStart.sequencePoseMap.end()
+                        and not data.detectedCornersVec[transfIdx].empty())
+                {
+                    auto poseIter = warmIter->second.find(data.imageName(transfIdx));
+                    if (poseIter != warmIter->second.end())
+                    {
+                        sequenceTransformMap[initName].back() = poseIter->second;
+                        sequenceInitMap[initName].back() = true;
+                        warmCount++;
+                    }
+                }
             }
             
             if (not data.detectedCornersVec[transfIdx].empty() and not sequenceInitMap[initName][transfIdx])
@@ -496,6 +846,16 @@ void GenericCameraCalibration::initTransforms(const ImageData & data, const stri
                 sequenceInitMap[initName][transfIdx] = true;
             }
         }
+        if (warmIter != warmStart.sequencePoseMap.end())
+        {
+            cout << "Warm start : " << warmCount << " poses of " << initName
+                 << " taken from the previous solution" << endl;
+        }
+    }
+    else if (warmStart.globalTransformMap.count(initName))
+    {
+        globalTransformMap[initName] = warmStart.globalTransformMap[initName];
+        cout << "Warm start : " << initName << endl;
     }
     else
     {
@@ -642,7 +1002,9 @@ void GenericCameraCalibration::parseData()
             initGrid(dataVec.back(), dataInfo.second);
             
             //init variables and add residuals to the problem
+            Timer timer;
             initTransforms(dataVec.back(), dataInfo.second.get<string>("init"));
+            timing.init += timer.elapsed();
             addGridResidualBlocks(dataVec.back());
         }
         if (dataType == "ir_data")
@@ -655,7 +1017,9 @@ void GenericCameraCalibration::parseData()
             
             readCorners(dataVec.back(), dataInfo.second);
             //init variables and add residuals to the problem
+            Timer timer;
             initTransforms(dataVec.back(), dataInfo.second.get<string>("init"));
+            timing.init += timer.elapsed();
             addGridResidualBlocks(dataVec.back());
         }
         if (dataType == "odometry_intrinsic")
@@ -830,6 +1194,20 @@ void GenericCameraCalibration::parseData()
     }
 }
 
+namespace
+{
+    //false if the file cannot be read
+    bool readFileData(const string & fileName, vector<uint8_t> & fileData)
+    {
+        ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (not file) return false;
+        fileData.resize(file.tellg());
+        file.seekg(0);
+        file.read((char *)fileData.data(), fileData.size());
+        return bool(file);
+    }
+}
+
 //FIXME
 vector<int> xVec;
 vector<int> yVec;
@@ -991,8 +1369,19 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
 
 void GenericCameraCalibration::extractGridProjections(ImageData & data)
 {
+    if (sharedDetections)
+    {
+        const int dataIdx = &data - dataVec.data();
+        if (dataIdx >= sharedDetections->size() 
+            or (*sharedDetections)[dataIdx].size() != data.imageNameVec.size())
+        {
+            throw runtime_error("the shared detections do not match the data");
+        }
+        data.detectedCornersVec = (*sharedDetections)[dataIdx];
+        return;
+    }
+    
     Timer timer;
-    CornerDetector detector(data.Nx, data.Ny, 3, data.improveDetection);
     
     string sequenceName;
     for (auto & name : data.transNameVec)
@@ -1005,60 +1394,141 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
     }
     bool initialized = transformInfoMap[sequenceName].initialized;
     const vector<bool> & initVec = sequenceInitMap[sequenceName];
-    int countSuccess = 0;
-    for (int i = 0; i < data.imageNameVec.size(); i++)
+    
+    //every image has its own slot, so that the detections can run in any order
+    const int imageCount = data.imageNameVec.size();
+    data.detectedCornersVec.assign(imageCount, Vector2dVec());
+    
+    //the cache stores the raw output of the detector, the failures too so that they are not retried,
+    //but not the images rejected by the user; the parallel detection only reads it
+    const int INIT_RADIUS = 3;
+    CornerCache cornerCache(data.cornerCacheFile);
+    vector<uint64_t> keyVec(imageCount);
+    vector<uint8_t> cachedVec(imageCount, false), detectedVec(imageCount, false);
+    
+    //fills up detectedCornersVec[i], returns the error message or an empty string
+    //frame is decoded only if the grid is not in the cache or if needFrame is set
+    auto detectGrid = [&](CornerDetector & detector, int i, Mat8u & frame, bool needFrame) -> string
     {
-        cout <<data.imageNameVec[i] << endl;
-//        cout << "." << flush;
-        data.detectedCornersVec.emplace_back();
-        
         //grid has not been found on the corresponding image in the ini sequence
-        
         const string & fileName = data.imageNameVec[i];
-        
         if (initialized and not initVec[i])
         {
-            cout << fileName << " : ERROR, the pattern has not been found on the corresponding image" << endl;
-            continue;
+            return fileName + " : ERROR, the pattern has not been found on the corresponding image";
         }
         
-        Mat8u frame = imread(fileName, 0);
-        if (frame.empty())
+        vector<uint8_t> fileData;
+        if (not readFileData(fileName, fileData))
         {
-            cout << fileName << " : ERROR, file not found" << endl;
-            continue;
+            return fileName + " : ERROR, file not found";
         }
-        detector.setImage(frame);
-        Vector2dVec patternVec;
-        bool patternIsFound = detector.detectPattern(patternVec);
-        if (not patternIsFound)
+        Vector2dVec & patternVec = data.detectedCornersVec[i];
+        if (cornerCache.enabled())
         {
-            cout << fileName << " : ERROR, pattern not found" << endl;
-            continue;
+            keyVec[i] = cornerCacheKey(fileData, data.Nx, data.Ny, INIT_RADIUS, data.improveDetection,
+                    data.pyramidLevels);
+            cachedVec[i] = cornerCache.find(keyVec[i], patternVec);
         }
-        
-        if (data.checkExtraction)
+        if (not cachedVec[i] or needFrame)
         {
-            Mat8u cornerImg;
-            frame.copyTo(cornerImg);
-            
-            drawPoints(cornerImg, patternVec);
-            imshow("corners", cornerImg);
-            char key = waitKey();
-            if (key == 'n' or key == 'N')
+            frame = cv::imdecode(fileData, cv::IMREAD_GRAYSCALE);
+            if (frame.empty())
             {
-                cout << fileName << " : ERROR, pattern not accepted" << endl;
+                patternVec.clear();
+                return fileName + " : ERROR, cannot decode the image";
+            }
+        }
+        if (not cachedVec[i])
+        {
+            detector.setImage(frame);
+            if (not detector.detectPattern(patternVec)) patternVec.clear();
+            detectedVec[i] = true;
+        }
+        if (patternVec.empty())
+        {
+            return fileName + " : ERROR, pattern not found";
+        }
+        return "";
+    };
+    
+    int countSuccess = 0;
+    if (data.checkExtraction or data.userGuided)
+    {
+        //interactive, one image at a time, the corners of an image are refined in parallel
+        ThreadPool threadPool(data.threadCount);
+        CornerDetector detector(data.Nx, data.Ny, INIT_RADIUS, data.improveDetection);
+        detector.setThreadPool(&threadPool);
+        detector.setPyramidLevels(data.pyramidLevels);
+        Mat8u frame;
+        for (int i = 0; i < imageCount; i++)
+        {
+            cout << data.imageNameVec[i] << endl;
+            const string message = detectGrid(detector, i, frame, data.checkExtraction);
+            if (detectedVec[i]) cornerCache.insert(keyVec[i], data.detectedCornersVec[i]);
+            if (not message.empty())
+            {
+                cout << message << endl;
                 continue;
             }
+            
+            if (data.checkExtraction)
+            {
+                Mat8u cornerImg;
+                frame.copyTo(cornerImg);
+                
+                drawPoints(cornerImg, data.detectedCornersVec[i]);
+                imshow("corners", cornerImg);
+                char key = waitKey();
+                if (key == 'n' or key == 'N')
+                {
+                    cout << data.imageNameVec[i] << " : ERROR, pattern not accepted" << endl;
+                    data.detectedCornersVec[i].clear();
+                    continue;
+                }
+            }
+            countSuccess++;
         }
-        
-        countSuccess++;
-        data.detectedCornersVec.back() = patternVec;
     }
+    else
+    {
+        //the messages are collected and printed in the order of the images
+        //the images are distributed between the threads, so every detector refines serially
+        vector<string> messageVec(imageCount);
+        ThreadPool threadPool(data.threadCount);
+        threadPool.parallelFor(imageCount, [&](int begin, int end)
+        {
+            CornerDetector detector(data.Nx, data.Ny, INIT_RADIUS, data.improveDetection);
+            detector.setPyramidLevels(data.pyramidLevels);
+            Mat8u frame;
+            for (int i = begin; i < end; i++)
+            {
+                messageVec[i] = detectGrid(detector, i, frame, false);
+            }
+        });
+        for (int i = 0; i < imageCount; i++)
+        {
+            cout << data.imageNameVec[i] << endl;
+            if (messageVec[i].empty()) countSuccess++;
+            else cout << messageVec[i] << endl;
+            if (detectedVec[i]) cornerCache.insert(keyVec[i], data.detectedCornersVec[i]);
+        }
+    }
+    
+    const int countCached = std::count(cachedVec.begin(), cachedVec.end(), true);
+    if (not cornerCache.save())
+    {
+        cout << "WARNING : failed to write the corner cache " << data.cornerCacheFile << endl;
+    }
+    
     double telapsed = timer.elapsed();
     cout << endl;
     cout << "DETECTION RATE : " << countSuccess << " of " 
             << data.imageNameVec.size() << " detected" << endl;
+    if (cornerCache.enabled())
+    {
+        cout << "CORNER CACHE : " << countCached << " of " 
+                << data.imageNameVec.size() << " taken from " << data.cornerCacheFile << endl;
+    }
     cout << "ELAPSED : " << telapsed << "      or per image : " << telapsed / data.imageNameVec.size() << endl;
 }
 
@@ -1213,6 +1683,9 @@ void GenericCameraCalibration::writeImageResidual(const ImageData & data, const
         }
 
         double sigma = sqrt(stdAcc / (projectedVec.size() - 2));
+        
+        //concurrent solves write only the files
+        if (quiet) continue;
 
         cout << "Sample #" << transfIdx << endl;
         if (data.useImages)
@@ -1257,3 +1730,154 @@ void GenericCameraCalibration::writeImageResidual(const ImageData & data, const
     delete cam;
     residualFile.close();
 }
+
+double GenericCameraCalibration::computeReprojectionError(vector<vector<double>> & rmsVec,
+        vector<vector<double>> * maxVec, vector<vector<double>> * residualVec) const
+{
+    rmsVec.clear();
+    if (maxVec != NULL) maxVec->clear();
+    if (residualVec != NULL) residualVec->clear();
+    double sqAcc = 0;
+    int pointCount = 0;
+    for (auto & data : dataVec)
+    {
+        rmsVec.emplace_back(data.detectedCornersVec.size(), 0);
+        if (maxVec != NULL) maxVec->emplace_back(data.detectedCornersVec.size(), 0);
+        if (residualVec != NULL) residualVec->emplace_back();
+        if (data.detectedCornersVec.empty()) continue;
+        
+        vector<Transf> transfVec;
+        computeTransforms(data, transfVec);
+        ICamera * cam = cameraMap.find(data.cameraName)->second->clone();
+        cam->setParameters(intrinsicMap.find(data.cameraName)->second.data());
+        for (int transfIdx = 0; transfIdx < transfVec.size(); transfIdx++)
+        {
+            const Vector2dVec & cornerVec = data.detectedCornersVec[transfIdx];
+            if (cornerVec.empty()) continue;
+            
+            Vector3dVec boardCam;
+            transfVec[transfIdx].transform(data.board, boardCam);
+            Vector2dVec projectedVec;
+            cam->projectPointCloud(boardCam, projectedVec);
+            double imageAcc = 0, imageMax = 0;
+            for (int i = 0; i < projectedVec.size(); i++)
+            {
+                const Vector2d err = cornerVec[i] - projectedVec[i];
+                imageAcc += err.squaredNorm();
+                if (maxVec != NULL) imageMax = max(imageMax, err.norm());
+                if (residualVec != NULL)
+                {
+                    residualVec->back().insert(residualVec->back().end(), 
+                            {err[0], err[1], projectedVec[i][0], projectedVec[i][1]});
+                }
+            }
+            rmsVec.back()[transfIdx] = sqrt(imageAcc / projectedVec.size());
+            if (maxVec != NULL) maxVec->back()[transfIdx] = imageMax;
+            sqAcc += imageAcc;
+            pointCount += projectedVec.size();
+        }
+        delete cam;
+    }
+    return pointCount ? sqrt(sqAcc / pointCount) : 0;
+}
+
+void CalibrationSweepReport::print() const
+{
+    cout << "MODEL SWEEP" << endl;
+    cout << setw(8) << "model" << setw(12) << "RPE, px" << setw(12) << "solve, s" 
+         << setw(12) << "converged" << endl;
+    for (auto & result : resultVec)
+    {
+        cout << setw(8) << result.model << setw(12) << result.rpe << setw(12) << result.solveTime
+             << setw(12) << (result.converged ? "yes" : "no") << endl;
+    }
+    
+    cout << "Intrinsic parameters :" << endl;
+    for (auto & result : resultVec)
+    {
+        for (auto & x : result.intrinsicMap)
+        {
+            cout << setw(8) << result.model << "  " << x.first << " : ";
+            for (auto & val : x.second) cout << val << "  ";
+            cout << endl;
+        }
+    }
+    
+    cout << "RMS reprojection error per image, px :" << endl;
+    for (int dataIdx = 0; dataIdx < imageNameVec.size(); dataIdx++)
+    {
+        for (int imgIdx = 0; imgIdx < imageNameVec[dataIdx].size(); imgIdx++)
+        {
+            cout << imageNameVec[dataIdx][imgIdx];
+            for (auto & result : resultVec)
+            {
+                cout << "   " << result.model << " : " << result.imageRmsVec[dataIdx][imgIdx];
+            }
+            cout << endl;
+        }
+    }
+    cout << "detection time : " << detectionTime << " s" << endl;
+    cout << "wall time      : " << wallTime << " s" << endl;
+}
+
+CalibrationSweepReport calibrationSweep(const vector<string> & infoFileVec,
+        const vector<string> & modelVec, int threadCount)
+{
+    CalibrationSweepReport report;
+    Timer wallTimer;
+    
+    //the problems are built one by one, the first calibration detects the grids
+    vector<std::unique_ptr<GenericCameraCalibration>> calibrationVec;
+    std::shared_ptr<const vector<vector<Vector2dVec>>> detections;
+    for (auto & model : modelVec)
+    {
+        calibrationVec.emplace_back(new GenericCameraCalibration);
+        auto & calibration = *calibrationVec.back();
+        calibration.setCameraModel(model);
+        calibration.setOutputPrefix(model + "_");
+        if (detections) calibration.setSharedDetections(detections);
+        for (auto & fileName : infoFileVec)
+        {
+            calibration.addResiduals(fileName);
+        }
+        if (not detections)
+        {
+            detections = std::make_shared<const vector<vector<Vector2dVec>>>(calibration.getDetections());
+            report.imageNameVec = calibration.getImageNames();
+            report.detectionTime = wallTimer.elapsed();
+        }
+        //the models would overwrite each other's solution
+        calibration.setSolutionFile("");
+        calibration.setQuiet(true);
+    }
+    
+    //the problems share nothing, every one is solved by its own thread
+    //the cores are split between the solves unless the file sets the solver threads
+    report.resultVec.resize(modelVec.size());
+    ThreadPool threadPool(threadCount);
+    for (auto & calibration : calibrationVec)
+    {
+        CalibrationSolverSettings settings = calibration->getSolverSettings();
+        if (settings.threadCount <= 0)
+        {
+            const int coreCount = max(int(std::thread::hardware_concurrency()), 1);
+            settings.threadCount = max(coreCount / min(threadPool.size(), int(modelVec.size())), 1);
+        }
+        calibration->setSolverSettings(settings);
+    }
+    threadPool.parallelFor(modelVec.size(), [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            auto & result = report.resultVec[i];
+            result.model = modelVec[i];
+            Timer timer;
+            result.converged = calibrationVec[i]->compute();
+            result.solveTime = timer.elapsed();
+            result.rpe = calibrationVec[i]->computeReprojectionError(result.imageRmsVec);
+            result.intrinsicMap = calibrationVec[i]->getIntrinsicMap();
+        }
+    });
+    report.wallTime = wallTimer.elapsed();
+    return report;
+}
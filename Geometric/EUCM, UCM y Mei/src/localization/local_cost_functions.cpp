@@ -30,6 +30,7 @@ Cost functions for localization based on photometric data and mutual information
 #include "geometry/geometry.h"
 #include "projection/generic_camera.h"
 #include "projection/jacobian.h"
+#include "projection/static_camera.h"
 #include "reconstruction/triangulator.h"
 
 PhotometricCostFunction::PhotometricCostFunction(const ICamera * camera, const Transf & xiBaseCam,
@@ -93,6 +94,17 @@ double PhotometricCostFunction::getVMapgin(const double & v) const
 
 bool PhotometricCostFunction::Evaluate(double const * const * parameters,
         double * residual, double ** jacobian) const
+{
+    // one dispatch per evaluation, the per-point projections are inlined
+    return dispatchCamera(*_camera, [&](const auto & camera)
+    {
+        return this->evaluate(camera, parameters, residual, jacobian);
+    });
+}
+
+template<typename Camera>
+bool PhotometricCostFunction::evaluate(const Camera & camera, double const * const * parameters,
+        double * residual, double ** jacobian) const
 {
     const int POINT_NUMBER = _dataPack.cloud.size();
     
@@ -115,7 +127,7 @@ bool PhotometricCostFunction::Evaluate(double const * const * parameters,
         {
             Vector2d pt;
 //            bool projRes = 
-            if (not _camera->projectPoint(transformedPoints[i], pt)) 
+            if (not camera.projectPoint(transformedPoints[i], pt)) 
             {
                 residual[i] = 0;
                 fill(jacobian[0] + i*6, jacobian[0] + i*6 + 6, 0.);
@@ -146,7 +158,7 @@ bool PhotometricCostFunction::Evaluate(double const * const * parameters,
             if (uMarg == 0 and vMarg == 0)
             {
                 Covector6d dfdxi;
-                jacobianCalculator.dfdxi(transformedPoints[i], grad, dfdxi.data());
+                jacobianCalculator.dfdxi(camera, transformedPoints[i], grad, dfdxi.data());
                 dfdxi *= drhoderr;
                 copy(dfdxi.data(), dfdxi.data() + 6, jacobian[0] + i*6);
 //                for (int k = 0; k < 6; k++)
@@ -165,7 +177,7 @@ bool PhotometricCostFunction::Evaluate(double const * const * parameters,
             else
             {
                 Covector6d dudxi, dvdxi;
-                jacobianCalculator.dpdxi(transformedPoints[i], dudxi.data(), dvdxi.data());
+                jacobianCalculator.dpdxi(camera, transformedPoints[i], dudxi.data(), dvdxi.data());
                 Covector6d drhodxi = (drhoderr * grad[0]) * dudxi + (drhoderr * grad[1]) * dvdxi; 
             
                 //fade-away margins
@@ -185,7 +197,7 @@ bool PhotometricCostFunction::Evaluate(double const * const * parameters,
         for (int i = 0; i < POINT_NUMBER; i++)
         {
             Vector2d pt;
-            if (not _camera->projectPoint(transformedPoints[i], pt)) 
+            if (not camera.projectPoint(transformedPoints[i], pt)) 
             {
                 residual[i] = 0.;
                 continue;
@@ -36,10 +36,12 @@ PhotometricMapping::PhotometricMapping(const ptree & params):
     _xiLocal(0, 0, 0, 0, 0, 0),
     _zetaOdom(0, 0, 0, 0, 0, 0),
     _state(MAP_BEGIN),
-    _warningState(WARNING_NONE)
+    _warningState(WARNING_NONE),
+    _threadPool(_sgmParams.threadCount)
 {
     _localizer.setVerbosity(0);
     _localizer.setXiBaseCam(_xiBaseCam);
+    _localizer.setThreadPool(&_threadPool);
 }
     
 bool PhotometricMapping::constructMap(const Transf & xiOdom, const Mat8u & img)
@@ -184,7 +186,7 @@ void PhotometricMapping::improveStereo(const Mat8u & img)
     if (base.trans().norm() < _params.minStereoBase) return;
     
     _depth = _motionStereo.compute(base, img, _depth);
-    _depth.filterNoise();
+    _depth.filterNoise(&_threadPool);
 }
 
 void PhotometricMapping::pushInterFrame(const Mat8u & img)
@@ -207,7 +209,7 @@ void PhotometricMapping::pushInterFrame(const Mat8u & img)
 //        imshow("img1", img);
 //        imshow("img2", _interFrame.img);
         cout << base.inverse() << endl;
-        newDepth.filterNoise();
+        newDepth.filterNoise(&_threadPool);
         if (_state == MAP_INIT)
         {
             _depth = newDepth;
@@ -215,14 +217,14 @@ void PhotometricMapping::pushInterFrame(const Mat8u & img)
         else
         {
             //project forward the prior depth
-            _depth = _depth.wrapDepth(base);
+            _depth = _depth.wrapDepth(base, &_threadPool);
             _depth.merge(newDepth);
         }
         
         /*
         if (_state != MAP_INIT)
         {
-            newDepth.merge(_depth.wrapDepth(base));
+            newDepth.merge(_depth.wrapDepth(base, &_threadPool));
         }
         _depth = newDepth;
         */
@@ -236,7 +238,7 @@ void PhotometricMapping::pushInterFrame(const Mat8u & img)
 //        odom._depth.toMat(depthMat);
 //        imshow("depth", depthMat / 10);
     
-        _depth = _depth.wrapDepth(base);
+        _depth = _depth.wrapDepth(base, &_threadPool);
     }
     else
     {
@@ -336,6 +338,7 @@ Transf PhotometricMapping::localizeMI()
     ScalePhotometric localizer(5, _camera); //TODO figure out why not _localizer
     localizer.setVerbosity(0);
     localizer.setXiBaseCam(_xiBaseCam);
+    localizer.setThreadPool(&_threadPool);
     localizer.setTargetImage(_frameVec[_mapIdx].img);
     localizer.setBaseImage(_interFrame.img);
     localizer.setDepth(_depth);
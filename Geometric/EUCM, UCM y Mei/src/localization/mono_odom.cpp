@@ -39,11 +39,13 @@ MonoOdometry::MonoOdometry(const ptree & params):
     sparseOdom(_camera, _xiBaseCam),
     motionStereo(_camera, _camera, params.get_child("stereo_parameters")),
     localizer(5, _camera),
-    state(STATE_BEGIN)
+    state(STATE_BEGIN),
+    threadPool(_sgmParams.threadCount)
 {
     cout << "verbosity " << _sgmParams.verbosity << endl; 
     localizer.setVerbosity(0);
     localizer.setXiBaseCam(_xiBaseCam);
+    localizer.setThreadPool(&threadPool);
 }
     
 MonoOdometry::~MonoOdometry() 
@@ -162,7 +164,7 @@ void MonoOdometry::feedImage(const Mat8u & imageNew)
         else
         {
             depth = motionStereo.compute(getCameraMotion(), imageNew, depth);
-            depth.filterNoise();
+            depth.filterNoise(&threadPool);
         }
         
         break;
@@ -193,7 +195,7 @@ void MonoOdometry::pushKeyFrame(const Mat8u & imageNew)
     if (state == STATE_READY)
     {
         // project the prior depth estimation       
-        depth = depth.wrapDepth(_xiLocal);
+        depth = depth.wrapDepth(_xiLocal, &threadPool);
         depth.merge(depthNew);
 //        depth = depthNew;
     }
@@ -55,7 +55,7 @@ PhotometricPack ScalePhotometric::initPhotometricData(int scaleIdx)
     double scale = scaleSpace1.getActiveScale();
     vector<double> valVec;
     vector<int> packIdxVec;
-    vector<Vector2d> imagePointVec;
+    reconstPack.imagePointVec.clear();
     if (verbosity > 3) cout << "    scaled image size : " << img1.size() << endl;
     for (int vs = 0; vs < img1.rows; vs++)
     {
@@ -76,19 +76,25 @@ PhotometricPack ScalePhotometric::initPhotometricData(int scaleIdx)
             
             if (verbosity > 4) cout << "    " << vs << " " << us << endl;
             valVec.push_back(img1(vs, us));
-            imagePointVec.emplace_back(ub, vb);
+            reconstPack.imagePointVec.emplace_back(ub, vb);
             packIdxVec.push_back(vs*img1.cols + us);
         }
     }
-    vector<int> reconstIdxVec;
-    depthMap.reconstruct(imagePointVec, reconstIdxVec, dataPack.cloud);
-    _xiBaseCam.transform(dataPack.cloud, dataPack.cloud);
-    for (auto & idx : reconstIdxVec)
+    depthMap.reconstruct(reconstPack, QUERY_POINTS | INDEX_MAPPING, threadPool);
+    dataPack.cloud.reserve(reconstPack.cloud.size());
+    dataPack.idxVec.reserve(reconstPack.cloud.size());
+    dataPack.valVec.reserve(reconstPack.cloud.size());
+    for (int i = 0; i < reconstPack.cloud.size(); i++)
     {
+        const Vector3d & X = reconstPack.cloud[i];
+        if (X == Vector3d::Zero()) continue; // not reconstructed by the camera
+        const int idx = reconstPack.idxMapVec[i];
+        dataPack.cloud.push_back(X);
         dataPack.idxVec.push_back(packIdxVec[idx]);
         dataPack.valVec.push_back(valVec[idx]);
     }
-    if (verbosity > 3) cout << "    datapack size : " << reconstIdxVec.size() << endl;
+    _xiBaseCam.transform(dataPack.cloud, dataPack.cloud);
+    if (verbosity > 3) cout << "    datapack size : " << dataPack.cloud.size() << endl;
     return dataPack;
 }
 
@@ -0,0 +1,182 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Unit rays of the pixels of a scaled grid, shared by all the users of the same camera and grid
+*/
+
+#include "reconstruction/bearing_table.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <mutex>
+#include <map>
+#include <typeinfo>
+
+#include "io.h"
+#include "utils/hash.h"
+
+namespace
+{
+    const char BEARING_TABLE_MAGIC[4] = {'B', 'R', 'N', 'G'};
+
+    struct BearingTableHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;
+        int32_t xMax, yMax;
+    };
+
+    // the rays are 8-byte aligned after the mask
+    size_t alignedSize(size_t size) { return (size + 7) & ~size_t(7); }
+
+    // the tables in use, a table is released with its last user
+    // and its entry is erased at the next request
+    std::mutex registryMutex;
+    std::map<uint64_t, std::weak_ptr<const BearingTable>> registry;
+}
+
+BearingTable::BearingTable(const ICamera * camera, const ScaleParameters & params) :
+        _params(params),
+        _hash(computeHash(camera, params)),
+        _rayVec(params.xMax * params.yMax),
+        _maskVec(params.xMax * params.yMax)
+{
+    const int xMax = params.xMax;
+    vector<double> uVec(xMax), vVec(xMax), xVec(xMax), yVec(xMax), zVec(xMax);
+    for (int x = 0; x < xMax; x++) uVec[x] = params.uConv(x);
+    for (int y = 0; y < params.yMax; y++)
+    {
+        std::fill(vVec.begin(), vVec.end(), params.vConv(y));
+        uint8_t * maskPtr = _maskVec.data() + y*xMax;
+        camera->reconstructBatch(uVec.data(), vVec.data(), xMax,
+                xVec.data(), yVec.data(), zVec.data(), maskPtr);
+        for (int x = 0; x < xMax; x++)
+        {
+            Vector3d & ray = _rayVec[x + y*xMax];
+            if (maskPtr[x]) ray = Vector3d(xVec[x], yVec[x], zVec[x]).normalized();
+            else ray.setZero();
+        }
+    }
+}
+
+std::shared_ptr<const BearingTable> BearingTable::get(const ICamera * camera,
+        const ScaleParameters & params, const string & cacheDir)
+{
+    const uint64_t hash = computeHash(camera, params);
+    //a table is built under the lock, so that it is never built twice
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto iter = registry.begin(); iter != registry.end(); )
+    {
+        if (iter->second.expired()) iter = registry.erase(iter);
+        else ++iter;
+    }
+    auto & entry = registry[hash];
+    std::shared_ptr<const BearingTable> table = entry.lock();
+    if (table) return table;
+
+    const string tableFile = cacheDir.empty() ? string() : fileName(cacheDir, hash);
+    std::shared_ptr<BearingTable> newTable(new BearingTable(params, hash));
+    if (cacheDir.empty() or not newTable->load(tableFile))
+    {
+        newTable.reset(new BearingTable(camera, params));
+        if (not cacheDir.empty() and not newTable->save(tableFile))
+        {
+            std::cerr << "WARNING: failed to cache the bearing table in " << tableFile << endl;
+        }
+    }
+    entry = newTable;
+    return newTable;
+}
+
+uint64_t BearingTable::computeHash(const ICamera * camera, const ScaleParameters & params)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashValue(hash, BEARING_TABLE_VERSION);
+    const char * modelName = typeid(*camera).name();
+    hashBytes(hash, modelName, strlen(modelName));
+    hashBytes(hash, camera->getParams(), camera->numParams() * sizeof(double));
+    const int paramArr[] = {params.scale, params.u0, params.v0, params.uMax, params.vMax,
+            params.xMax, params.yMax};
+    hashBytes(hash, paramArr, sizeof(paramArr));
+    return hash;
+}
+
+string BearingTable::fileName(const string & cacheDir, uint64_t hash)
+{
+    std::ostringstream name;
+    name << "bearing_" << std::hex << std::setfill('0') << setw(16) << hash << ".bin";
+    if (cacheDir.empty() or cacheDir.back() == '/') return cacheDir + name.str();
+    return cacheDir + "/" + name.str();
+}
+
+bool BearingTable::load(const string & fileName)
+{
+    ifstream tableFile(fileName, std::ios::binary);
+    if (not tableFile) return false;
+
+    BearingTableHeader header;
+    tableFile.read((char *)&header, sizeof(header));
+    if (not tableFile
+        or not std::equal(header.magic, header.magic + 4, BEARING_TABLE_MAGIC)
+        or header.version != BEARING_TABLE_VERSION
+        or header.hash != _hash
+        or header.xMax != _params.xMax or header.yMax != _params.yMax)
+    {
+        return false;
+    }
+
+    const int pointCount = _params.xMax * _params.yMax;
+    vector<uint8_t> maskBytes(alignedSize(pointCount));
+    _rayVec.resize(pointCount);
+    tableFile.read((char *)maskBytes.data(), maskBytes.size());
+    tableFile.read((char *)_rayVec.data(), pointCount * sizeof(Vector3d));
+    if (not tableFile)
+    {
+        _rayVec.clear();
+        return false;
+    }
+    _maskVec.assign(maskBytes.begin(), maskBytes.begin() + pointCount);
+    return true;
+}
+
+bool BearingTable::save(const string & fileName) const
+{
+    //write to a temporary file first so that concurrent runs never read a partial table
+    const string tmpName = fileName + ".tmp";
+    {
+        ofstream tableFile(tmpName, std::ios::binary | std::ios::trunc);
+        if (not tableFile) return false;
+
+        BearingTableHeader header;
+        copy(BEARING_TABLE_MAGIC, BEARING_TABLE_MAGIC + 4, header.magic);
+        header.version = BEARING_TABLE_VERSION;
+        header.hash = _hash;
+        header.xMax = _params.xMax;
+        header.yMax = _params.yMax;
+
+        vector<uint8_t> maskBytes(alignedSize(_maskVec.size()), 0);
+        copy(_maskVec.begin(), _maskVec.end(), maskBytes.begin());
+        tableFile.write((const char *)&header, sizeof(header));
+        tableFile.write((const char *)maskBytes.data(), maskBytes.size());
+        tableFile.write((const char *)_rayVec.data(), _rayVec.size() * sizeof(Vector3d));
+        if (not tableFile) return false;
+    }
+    return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
@@ -28,27 +28,47 @@ NOTE:
 #include "std.h"
 #include "eigen.h"
 
+#include <atomic>
+#include <memory>
 
-void filter(double & v1, double & s1, const double v2, const double s2)
+#include "utils/thread_pool.h"
+
+namespace
 {
-    double K = 1. / (s1 + s2);
-    v1 = (v1 * s2 + v2 * s1) * K;
-    s1 = max(s1 * s2 * K, 0.05 * v1);
-//    s1 = max(0.05 * v1, min(s1, s2));
-   /* double sHat1 = s1 / (v1 * (v1 - s1));
-    double sHat2 = s2 / (v2 * (v2 - s2));
-    double vHat1 = 1./ v1;
-    double vHat2 = 1./ v2;
+    //the smallest block of rows given to a thread
+    const int ROW_GRAIN = 8;
+    
+    //the smallest block of points given to a thread
+    const int POINT_GRAIN = 1024;
     
-    double K = 1. / (sHat1 + sHat2);
-    vHat1 = (vHat1 * sHat2 + vHat2 * sHat1) * K;
-    sHat1 = max(sHat1 * sHat2 * K, 0.1);
+    //the query points are reconstructed by chunks of this size
+    const int POINT_CHUNK = 64;
     
-    v1 = 1. / vHat1;
-    s1 = sHat1 * v1 / (sHat1  + vHat1); */
+    //calls func(begin, end) on blocks of at least grain elements which cover [i0, i1)
+    template<typename Func>
+    void forEachBlock(int i0, int i1, int grain, ThreadPool * threadPool, Func && func)
+    {
+        if (threadPool == NULL)
+        {
+            func(i0, i1);
+            return;
+        }
+        threadPool->parallelFor(i1 - i0, [&](int begin, int end)
+        {
+            func(i0 + begin, i0 + end);
+        }, grain);
+    }
+    
+    //calls func(yBegin, yEnd) on blocks of rows which cover [y0, y1)
+    template<typename Func>
+    void forEachRowBlock(int y0, int y1, ThreadPool * threadPool, Func && func)
+    {
+        forEachBlock(y0, y1, ROW_GRAIN, threadPool, std::forward<Func>(func));
+    }
 }
 
-void DepthMap::applyMask(const Mat8u & mask)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::applyMask(const Mat8u & mask)
 {
     for (int y = 0; y < yMax; y++)
     {
@@ -65,18 +85,8 @@ void DepthMap::applyMask(const Mat8u & mask)
     }
 }
 
-//check the limits
-bool DepthMap::isValid(const int x, const int y, const int h) const
-{
-    return ( (x >= 0) and (x < xMax) and (y >= 0) and (y < yMax) and (h >= 0) and (h < hMax) );
-}
-
-bool DepthMap::isValid(const Vector2d pt, const int h) const
-{
-    return isValid(pt[0], pt[1], h);
-}
-
-void DepthMap::swapHypotheses(const int x, const int y, const int h1, const int h2)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::swapHypotheses(const int x, const int y, const int h1, const int h2)
 {
     const double temp_d = at(x, y, h1);
     const double temp_sigma = sigma(x, y, h1);
@@ -89,7 +99,8 @@ void DepthMap::swapHypotheses(const int x, const int y, const int h1, const int
     cost(x, y, h2) = temp_cost;
 }
 
-void DepthMap::sortHypStack(const int x, const int y)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::sortHypStack(const int x, const int y)
 {
     for (int h1 = 0; h1 < hMax - 1; ++h1)
     {
@@ -109,7 +120,8 @@ void DepthMap::sortHypStack(const int x, const int y)
     }
 }
 
-bool DepthMap::pushHypothesis(const Vector3d & X, const double sigmaVal)
+template<typename T, DepthLayout L>
+bool BasicDepthMap<T, L>::pushHypothesis(const Vector3d & X, const double sigmaVal)
 {
     Vector2d pt;
     if (not cameraPtr->projectPoint(X, pt)) return false;
@@ -121,7 +133,8 @@ bool DepthMap::pushHypothesis(const Vector3d & X, const double sigmaVal)
     return pushHypothesis(x, y, d, sigmaVal);
 }
 
-bool DepthMap::pushHypothesis(const int x, const int y, const double d, const double sigmaVal)
+template<typename T, DepthLayout L>
+bool BasicDepthMap<T, L>::pushHypothesis(const int x, const int y, const double d, const double sigmaVal)
 {
     if (not isValid(x, y)) return false;
     int h = 0;
@@ -161,12 +174,14 @@ bool DepthMap::pushHypothesis(const int x, const int y, const double d, const do
     return true;
 }
 
-bool DepthMap::pushImageHypothesis(const int u, const int v, const double d, const double sigmaVal)
+template<typename T, DepthLayout L>
+bool BasicDepthMap<T, L>::pushImageHypothesis(const int u, const int v, const double d, const double sigmaVal)
 {
     return pushHypothesis(xConv(u), yConv(v), d, sigmaVal);
 }
 
-bool DepthMap::match(const double v1, const double s1, const double v2, const double s2)
+template<typename T, DepthLayout L>
+bool BasicDepthMap<T, L>::match(const double v1, const double s1, const double v2, const double s2)
 {
     const double delta = abs(v1 - v2);
     const bool output = delta < 1 * s1 or delta < 1 * s2;
@@ -177,7 +192,8 @@ bool DepthMap::match(const double v1, const double s1, const double v2, const do
     return output;
 }
 
-bool DepthMap::filterPushHypothesis(const Vector3d & X, const double sigmaVal)
+template<typename T, DepthLayout L>
+bool BasicDepthMap<T, L>::filterPushHypothesis(const Vector3d & X, const double sigmaVal)
 {
     Vector2d pt;
     if (not cameraPtr->projectPoint(X,pt)) return false;
@@ -189,16 +205,17 @@ bool DepthMap::filterPushHypothesis(const Vector3d & X, const double sigmaVal)
     return filterPushHypothesis(x, y, d, sigmaVal);
 }
 
-bool DepthMap::filterPushHypothesis(const int x, const int y, const double d, const double sigmaVal)
+template<typename T, DepthLayout L>
+bool BasicDepthMap<T, L>::filterPushHypothesis(const int x, const int y, const double d, const double sigmaVal)
 {
     if (not isValid(x, y)) return false;
     bool matchFound = false;
     bool hypExist = false;
     for(int h = 0; h < hMax; ++h)
     {
-        double & d1 = at(x, y, h);
-        double & sigma1 = sigma(x, y, h);
-        double & cost1 = cost(x, y, h);
+        T & d1 = at(x, y, h);
+        T & sigma1 = sigma(x, y, h);
+        T & cost1 = cost(x, y, h);
         if( d1 == OUT_OF_RANGE )
         {
             if ( h == 0 )
@@ -218,7 +235,7 @@ bool DepthMap::filterPushHypothesis(const int x, const int y, const double d, co
             // }
             // cost1 = max(cost1 - 1.0, 0.0);
             cost1 -= 2*COST_CHANGE;
-            cost1 = std::max(cost1, 0.0);
+            cost1 = std::max(cost1, T(0));
             matchFound = true;
             // std::cout << "Merged " << x << " " << y << " " << h << " " << cost1 << endl;
         }
@@ -242,147 +259,32 @@ bool DepthMap::filterPushHypothesis(const int x, const int y, const double d, co
     // }
 }
 
-void DepthMap::costRejection(const double rejectionThreshold)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::costRejection(const double rejectionThreshold, ThreadPool * threadPool)
 {
-    // int count = 0;
-    for (int h = 0; h < hMax; ++h)
+    forEachRowBlock(0, yMax, threadPool, [&](int yBegin, int yEnd)
     {
-        for (int y = 0; y < yMax; ++y)
+        for (int h = 0; h < hMax; ++h)
         {
-            for (int x = 0; x < xMax; ++x)
+            for (int y = yBegin; y < yEnd; ++y)
             {
-                double & c = cost(x, y, h);
-                // c += costChange;
-                if( c > rejectionThreshold )
+                for (int x = 0; x < xMax; ++x)
                 {
-                    at(x, y, h) = DEFAULT_DEPTH;
-                    sigma(x, y, h) = DEFAULT_SIGMA_DEPTH;
-                    c = DEFAULT_COST_DEPTH;
-                    // count++;
+                    T & c = cost(x, y, h);
+                    if( c > rejectionThreshold )
+                    {
+                        at(x, y, h) = DEFAULT_DEPTH;
+                        sigma(x, y, h) = DEFAULT_SIGMA_DEPTH;
+                        c = DEFAULT_COST_DEPTH;
+                    }
                 }
             }
         }
-    }
-    // cout << "discarded " << count << " hyps" << endl;
-}
-
-// nearest neighbor interpolation
-double DepthMap::nearest(const int u, const int v, const int h) const
-{
-    int xd = xConv(u);
-    int yd = yConv(v);
-    if (isValid(xd, yd, h)) return at(xd, yd, h);
-    else return OUT_OF_RANGE;
+    });
 }
 
-// nearest neighbor interpolation
-double DepthMap::nearest(const Vector2d pt, const int h) const
-{
-    int xd = xConv(pt[0]);
-    int yd = yConv(pt[1]);
-    if (isValid(xd, yd, h)) return at(xd, yd, h);
-    else return OUT_OF_RANGE;
-}
-
-
-// nearest neighbor interpolation
-double DepthMap::nearestSigma(const int u, const int v, const int h) const
-{
-    int xd = xConv(u);
-    int yd = yConv(v);
-    if (isValid(xd, yd, h)) return sigma(xd, yd, h);
-    else return OUT_OF_RANGE;
-}
-
-// nearest neighbor interpolation
-double DepthMap::nearestSigma(const Vector2d pt, const int h) const
-{
-    int xd = xConv(pt[0]);
-    int yd = yConv(pt[1]);
-    if (isValid(xd, yd, h)) return sigma(xd, yd, h);
-    else return OUT_OF_RANGE;
-}
-
-// nearest neighbor interpolation
-double DepthMap::nearestCost(const int u, const int v, const int h) const
-{
-    int xd = xConv(u);
-    int yd = yConv(v);
-    if (isValid(xd, yd, h)) return cost(xd, yd, h);
-    else return OUT_OF_RANGE;
-}
-
-// nearest neighbor interpolation
-double DepthMap::nearestCost(const Vector2d pt, const int h) const
-{
-    int xd = xConv(pt[0]);
-    int yd = yConv(pt[1]);
-    if (isValid(xd, yd, h)) return cost(xd, yd, h);
-    else return OUT_OF_RANGE;
-}
-
-
-// to access the elements directly
-double & DepthMap::at(const int x, const int y, const int h)
-{
-    return valVec[x + y*xMax + h*hStep];
-}
-const double & DepthMap::at(const int x, const int y, const int h) const
-{
-    return valVec[x + y*xMax + h*hStep];
-}
-
-// to access the elements directly
-double & DepthMap::at(const int idx)
-{
-    return valVec[idx];
-}
-const double & DepthMap::at(const int idx) const
-{
-    return valVec[idx];
-}
-
-// to access the uncertainty directly
-double & DepthMap::sigma(const int x, const int y, const int h)
-{
-    return sigmaVec[x + y*xMax + h*hStep];
-}
-const double & DepthMap::sigma(const int x, const int y, const int h) const
-{
-    return sigmaVec[x + y*xMax + h*hStep];
-}
-
-// to access the uncertainty directly
-double & DepthMap::sigma(const int idx)
-{
-    return sigmaVec[idx];
-}
-const double & DepthMap::sigma(const int idx) const
-{
-    return sigmaVec[idx];
-}
-
-// to access the hypothesis cost directly
-double & DepthMap::cost(const int x, const int y, const int h)
-{
-    return costVec[x + y*xMax + h*hStep];
-}
-const double & DepthMap::cost(const int x, const int y, const int h) const
-{
-    return costVec[x + y*xMax + h*hStep];
-}
-
-// to access the hypothesis cost directly
-double & DepthMap::cost(const int idx)
-{
-    return costVec[idx];
-}
-const double & DepthMap::cost(const int idx) const
-{
-    return costVec[idx];
-}
-
-Vector2dVec DepthMap::getPointVec(const std::vector<int> & idxVec) const
+template<typename T, DepthLayout L>
+Vector2dVec BasicDepthMap<T, L>::getPointVec(const std::vector<int> & idxVec) const
 {
     Vector2dVec result;
     result.reserve(idxVec.size());
@@ -394,7 +296,8 @@ Vector2dVec DepthMap::getPointVec(const std::vector<int> & idxVec) const
     return result;
 }
 
-Vector2dVec DepthMap::getPointVec() const
+template<typename T, DepthLayout L>
+Vector2dVec BasicDepthMap<T, L>::getPointVec() const
 {
     Vector2dVec result;
     result.reserve(xMax * yMax);
@@ -409,7 +312,8 @@ Vector2dVec DepthMap::getPointVec() const
 }
 
 //TODO - Depecrated
-void DepthMap::reconstructUncertainty(vector<int> & idxVec, 
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::reconstructUncertainty(vector<int> & idxVec, 
             Vector3dVec & minDistVec, Vector3dVec & maxDistVec) const
 {
     minDistVec.clear();
@@ -418,12 +322,12 @@ void DepthMap::reconstructUncertainty(vector<int> & idxVec,
     vector<double> minVec;
     vector<double> maxVec;
     vector<int> idxBrutVec;
-    for (int i = 0; i < valVec.size(); i++)
+    for (int i = 0; i < hStep*hMax; i++)
     {
-        double d = valVec[i];
+        double d = at(i);
         if (d >= MIN_DEPTH)
         {
-            double s = sigmaVec[i];
+            double s = sigma(i);
             // take d +- 2*sigma
             minVec.push_back(max(MIN_DEPTH, d - 2*s));
             maxVec.push_back(d + 2*s);
@@ -450,15 +354,16 @@ void DepthMap::reconstructUncertainty(vector<int> & idxVec,
 }
 
 //TODO - Depecrated
-void DepthMap::reconstruct(vector<int> & idxVec, Vector3dVec & result) const
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::reconstruct(vector<int> & idxVec, Vector3dVec & result) const
 {
     result.clear();
     idxVec.clear();
     vector<double> depthVec;
     vector<int> idxBrutVec;
-    for (int i = 0; i < valVec.size(); i++)
+    for (int i = 0; i < hStep*hMax; i++)
     {
-        double d = valVec[i];
+        double d = at(i);
         if (d >= MIN_DEPTH)
         {
             depthVec.push_back(d);
@@ -483,7 +388,8 @@ void DepthMap::reconstruct(vector<int> & idxVec, Vector3dVec & result) const
 }
 
 //TODO - Depecrated
-void DepthMap::reconstruct(const Vector2dVec & queryPointVec,
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::reconstruct(const Vector2dVec & queryPointVec,
         vector<int> & idxVec, Vector3dVec & result) const
 {
     result.clear();
@@ -505,7 +411,8 @@ void DepthMap::reconstruct(const Vector2dVec & queryPointVec,
 }
 
 
-vector<int> DepthMap::getIdxVec(const Vector2dVec & queryPointVec) const
+template<typename T, DepthLayout L>
+vector<int> BasicDepthMap<T, L>::getIdxVec(const Vector2dVec & queryPointVec) const
 {
     vector<int> outIdxVec;
     if(queryPointVec.size()!=0)
@@ -522,155 +429,207 @@ vector<int> DepthMap::getIdxVec(const Vector2dVec & queryPointVec) const
     {
         for(int i=0; i < hStep; i++) // hStep === xMax * yMax
         {
-            if (valVec[i] >= MIN_DEPTH) outIdxVec.push_back(i);
+            if (at(i) >= MIN_DEPTH) outIdxVec.push_back(i);
         }
     }
     return outIdxVec;
 }
 
 
-void DepthMap::reconstruct(MHPack & result, const uint32_t reconstFlags) const
+template<typename T, DepthLayout L>
+const BearingTable & BasicDepthMap<T, L>::bearingTable() const
+{
+    if (not std::atomic_load(&bearingPtr))
+    {
+        //another thread may have stored the same table in the meantime, then it is kept
+        std::shared_ptr<const BearingTable> expected;
+        std::atomic_compare_exchange_strong(&bearingPtr, &expected,
+                BearingTable::get(cameraPtr, *this));
+    }
+    return *std::atomic_load(&bearingPtr);
+}
+
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::reconstruct(MHPack & result, const uint32_t reconstFlags,
+        ThreadPool * threadPool) const
 {
     assert(not (reconstFlags & IMAGE_VALUES)); //FIXME imageValues are not implemented
     const int numHyps = (reconstFlags & ALL_HYPOTHESES) ? hMax : 1;
-
-    // Convert query points to query indices
+    const bool queryIndices = reconstFlags & QUERY_INDICES;
+    const bool queryPoints = (reconstFlags & QUERY_POINTS) and not queryIndices;
+    const bool minmax = reconstFlags & MINMAX;
+    
+    // the depth and the sigma of a hypothesis, false if it is not reconstructed
+    auto getHypothesis = [&](const int idx, const int h, double & depth, double & sigma)
+    {
+        depth = at(idx + h*hStep);
+        sigma = this->sigma(idx + h*hStep); //TODO discard points with sigma > sigmaMax
+        if (depth >= MIN_DEPTH and depth != OUT_OF_RANGE) return true;
+        if (not (reconstFlags & DEFAULT_VALUES) or h != 0) return false;
+        depth = DEFAULT_DEPTH;
+        sigma = DEFAULT_SIGMA_DEPTH;
+        return true;
+    };
+    
+    // The queries are read from the vectors which receive the output.
+    // With a single hypothesis an entry never moves forward and they are compacted in place,
+    // otherwise they are copied first
+    int queryCount = hStep;
     vector<int> queryIdxVec;
     Vector2dVec queryPointVec;
-    if (reconstFlags & QUERY_INDICES)
+    if (queryIndices)
     {
-        swap(queryIdxVec, result.idxVec);
-        queryPointVec = getPointVec(queryIdxVec);
+        queryCount = result.idxVec.size();
+        if (numHyps > 1) queryIdxVec = result.idxVec;
     }
-    else if (reconstFlags & QUERY_POINTS)
+    else if (queryPoints)
     {
-        queryIdxVec = getIdxVec(result.imagePointVec);
-        swap(queryPointVec, result.imagePointVec);
+        queryCount = result.imagePointVec.size();
+        if (numHyps > 1) queryPointVec = result.imagePointVec;
     }
-    else
-    {
-        queryIdxVec = getIdxVec();
-        queryPointVec = getPointVec(queryIdxVec);
-    }
-
-    result.idxVec.clear();
-    result.idxMapVec.clear();
-    result.hypIdxVec.clear();
+    
+    const int maxCount = queryCount * numHyps;
+    result.idxVec.resize(maxCount);
+    result.hypIdxVec.resize(maxCount);
+    result.imagePointVec.resize(maxCount);
+    result.idxMapVec.resize((reconstFlags & INDEX_MAPPING) ? maxCount : 0);
+    result.sigmaVec.resize((reconstFlags & SIGMA_VALUE) ? maxCount : 0);
     result.costVec.clear();
-    result.sigmaVec.clear();
-    result.cloud.clear();
     result.valVec.clear();
-//result.datatype = (minmax_flag) ? MHPack::MINMAX_DISTANCE_VEC_WITH_SIGN : MHPack::RECONSTRUCTION_WITH_SIGMA;
-
-    vector<double> depthVec;
-    for (int i = 0; i < queryIdxVec.size(); i++)
+    
+    // the position of the query for INDEX_MAPPING,
+    // the whole map is queried by the list of the pixels with a depth, as getIdxVec() gives it
+    int count = 0, pixelCount = 0;
+    for (int i = 0; i < queryCount; i++)
     {
-        if (queryIdxVec[i] < 0 or queryIdxVec[i] > hStep) continue;
-        for (int h = 0; h < numHyps; h++)
+        int queryIdx, queryPos;
+        Vector2d queryPoint;
+        if (queryIndices)
         {
-            const int queryIdx = queryIdxVec[i];
-            double depth = valVec[queryIdx + h*hStep];
-            double sigma = sigmaVec[queryIdx + h*hStep]; //TODO discard points with sigma > sigmaMax
-            if (depth < MIN_DEPTH or depth == OUT_OF_RANGE)
-            {
-                if (reconstFlags & DEFAULT_VALUES and h == 0)
-                {
-                    depth = DEFAULT_DEPTH;
-                    sigma = DEFAULT_SIGMA_DEPTH;
-                }
-                else continue;
-            }
-            
-            if (reconstFlags & MINMAX) 
-            {
-                depthVec.push_back(max(depth - 3*sigma, MIN_DEPTH));
-                depthVec.push_back(depth + 3*sigma);
-            }
-            else
-            {
-                depthVec.push_back(depth);
-            }
-            
-            if (reconstFlags & SIGMA_VALUE) result.sigmaVec.push_back(sigma);
-            result.idxVec.push_back(queryIdx);
-            result.hypIdxVec.push_back(h);
-            result.imagePointVec.push_back(queryPointVec[i]);
-            if (reconstFlags & INDEX_MAPPING) result.idxMapVec.push_back(i);
+            queryIdx = (numHyps > 1) ? queryIdxVec[i] : result.idxVec[i];
+            if (queryIdx < 0 or queryIdx >= hStep) continue;
+            queryPoint = Vector2d(uConv(queryIdx % xMax), vConv(queryIdx / xMax));
+            queryPos = i;
         }
-    }
-
-    vector<bool> maskVec;
-    Vector3dVec cloud;
-    cameraPtr->reconstructPointCloud( result.imagePointVec, cloud, maskVec );
-    result.cloud.reserve((reconstFlags & MINMAX) ? 2 * cloud.size() : cloud.size());
-    for (int i = 0; i < cloud.size(); i++)
-    {
-        if (maskVec[i])
+        else if (queryPoints)
         {
-            if (reconstFlags & MINMAX)
-            {
-                result.cloud.push_back(cloud[i].normalized() * depthVec[2*i]);
-                result.cloud.push_back(cloud[i].normalized() * depthVec[2*i + 1]);
-            }
-            else
-            {
-                result.cloud.push_back(cloud[i].normalized() * depthVec[i]);
-            }
+            queryPoint = (numHyps > 1) ? queryPointVec[i] : result.imagePointVec[i];
+            const int xd = xConv(queryPoint[0]), yd = yConv(queryPoint[1]);
+            if (not isValid(xd, yd)) continue;
+            queryIdx = xd + yd*xMax;
+            queryPos = i;
         }
         else
         {
-            //FIXME make all data in MHPack valid
-            //that is discard all non-reconstructed points and other data associated to them
-            if (reconstFlags & MINMAX)
+            if (at(i) < MIN_DEPTH) continue;
+            queryIdx = i;
+            queryPoint = Vector2d(uConv(i % xMax), vConv(i / xMax));
+            queryPos = pixelCount++;
+        }
+        
+        for (int h = 0; h < numHyps; h++)
+        {
+            double depth, sigma;
+            if (not getHypothesis(queryIdx, h, depth, sigma)) continue;
+            result.idxVec[count] = queryIdx;
+            result.hypIdxVec[count] = h;
+            result.imagePointVec[count] = queryPoint;
+            if (reconstFlags & INDEX_MAPPING) result.idxMapVec[count] = queryPos;
+            if (reconstFlags & SIGMA_VALUE) result.sigmaVec[count] = sigma;
+            count++;
+        }
+    }
+    result.idxVec.resize(count);
+    result.hypIdxVec.resize(count);
+    result.imagePointVec.resize(count);
+    if (reconstFlags & INDEX_MAPPING) result.idxMapVec.resize(count);
+    if (reconstFlags & SIGMA_VALUE) result.sigmaVec.resize(count);
+    result.cloud.resize(minmax ? 2*count : count);
+    
+    // scale the rays: the pixel rays come from the table, the query points are reconstructed
+    const BearingTable * bearingVec = queryPoints ? NULL : &bearingTable();
+    forEachBlock(0, count, POINT_GRAIN, threadPool, [&](int begin, int end)
+    {
+        double u[POINT_CHUNK], v[POINT_CHUNK], x[POINT_CHUNK], y[POINT_CHUNK], z[POINT_CHUNK];
+        uint8_t mask[POINT_CHUNK];
+        for (int chunkBegin = begin; chunkBegin < end; chunkBegin += POINT_CHUNK)
+        {
+            const int chunkSize = min(POINT_CHUNK, end - chunkBegin);
+            if (queryPoints)
             {
-                result.cloud.emplace_back(0, 0, 0);
-                result.cloud.emplace_back(0, 0, 0);
+                for (int k = 0; k < chunkSize; k++)
+                {
+                    u[k] = result.imagePointVec[chunkBegin + k][0];
+                    v[k] = result.imagePointVec[chunkBegin + k][1];
+                }
+                cameraPtr->reconstructBatch(u, v, chunkSize, x, y, z, mask);
             }
-            else
+            for (int k = 0; k < chunkSize; k++)
             {
-                result.cloud.emplace_back(0, 0, 0);
+                const int i = chunkBegin + k;
+                Vector3d ray;
+                if (not queryPoints) ray = (*bearingVec)[result.idxVec[i]];
+                else if (mask[k]) ray = Vector3d(x[k], y[k], z[k]).normalized();
+                else ray.setZero();
+                
+                double depth, sigma;
+                getHypothesis(result.idxVec[i], result.hypIdxVec[i], depth, sigma);
+                if (minmax)
+                {
+                    result.cloud[2*i] = ray * max(depth - 3*sigma, MIN_DEPTH);
+                    result.cloud[2*i + 1] = ray * (depth + 3*sigma);
+                }
+                else
+                {
+                    result.cloud[i] = ray * depth;
+                }
             }
         }
-    }
+    });
 }
 
 
-void DepthMap::project(const Vector3dVec & pointVec, Vector2dVec & result) const
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::project(const Vector3dVec & pointVec, Vector2dVec & result) const
 {
     cameraPtr->projectPointCloud(pointVec, result);
 }
 
-void DepthMap::toMat(Mat32f & out) const
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::toMat(Mat32f & out) const
 {
     out.create(yMax, xMax);
-    copy(valVec.begin(), valVec.begin() + hStep, (float*)out.data);
+    float* pOutData = (float*)out.data;
+    for (int i = 0; i < hStep; ++i) pOutData[i] = at(i);
 }
 
-void DepthMap::toInverseMat(Mat32f & out, const int layer) const
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::toInverseMat(Mat32f & out, const int layer) const
 {
     out.create(yMax, xMax);
-    const double* pInData = &valVec[0 + layer*hStep];
     float* pOutData = (float*)out.data;
     for (int i = 0; i < hStep; ++i)
     {
-        if ( *pInData < 1e-3 ) *pOutData = 0;
-        else *pOutData = 1 / (*pInData);
-        ++pOutData;
-        ++pInData;
+        const double d = at(i + layer*hStep);
+        if ( d < 1e-3 ) pOutData[i] = 0;
+        else pOutData[i] = 1 / d;
     }
 }
 
-void DepthMap::sigmaToMat(Mat32f & out) const
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::sigmaToMat(Mat32f & out) const
 {
     out.create(yMax, xMax);
-    copy(sigmaVec.begin(), sigmaVec.begin() + hStep, (float*)out.data);
+    float* pOutData = (float*)out.data;
+    for (int i = 0; i < hStep; ++i) pOutData[i] = sigma(i);
 }
 
 //TODO do not reconstruct all the points but a selected subset
 // to avoid reconstruction of points with bad disparity
 //TODO - Add support to insert multiple hypotheses into output depthmap
-void DepthMap::wrapDepth(const DepthMap& dMap1, const DepthMap& dMap2,
-        const Transformation<double> T12, DepthMap& output) const
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::wrapDepth(const BasicDepthMap& dMap1, const BasicDepthMap& dMap2,
+        const Transformation<double> T12, BasicDepthMap& output) const
 {
 	//Step 1 : Get point-cloud of first camera in first frame
 	// vector<int> idx0Vec;
@@ -720,49 +679,97 @@ void DepthMap::wrapDepth(const DepthMap& dMap1, const DepthMap& dMap2,
 }
 
 //TODO - Add support to insert multiple hypotheses into output depthmap
-DepthMap DepthMap::wrapDepth(const Transformation<double> T12) const
+template<typename T, DepthLayout L>
+BasicDepthMap<T, L> BasicDepthMap<T, L>::wrapDepth(const Transformation<double> T12,
+        ThreadPool * threadPool) const
 {
-    DepthMap dMap2(cameraPtr, *this);
-
-    // Get point-cloud of current frame
-    MHPack cloud11MH;
-    reconstruct(cloud11MH, 0);
-
-    // Transform cloud into keyframe
-    Vector3dVec cloud12;
-    T12.inverseTransform(cloud11MH.cloud, cloud12);
-
-    // Project point cloud on keyframe
-    Vector2dVec point12Vec;
-    cameraPtr->projectPointCloud(cloud12, point12Vec);
-
-    // Fill in data for depthmap
-    vector<int> idx12Vec = getIdxVec(point12Vec);
-    for (int i = 0; i < idx12Vec.size(); i++)
+    BasicDepthMap dMap2(cameraPtr, *this);
+    dMap2.bearingPtr = std::atomic_load(&bearingPtr); // same camera and grid
+    
+    // distVec[idx1] is the distance of the pixel idx1 in the new frame
+    // winnerArr[idx2] is the pixel which lands on idx2: the closest one,
+    // the first in the row-major order for equal distances, whatever the order of the splats
+    vector<double> distVec(hStep);
+    std::unique_ptr<std::atomic<int>[]> winnerArr(new std::atomic<int>[hStep]);
+    for (int i = 0; i < hStep; i++) winnerArr[i].store(-1, std::memory_order_relaxed);
+    auto closer = [&](int idx1, int current)
     {
-        const int idx2 = idx12Vec[i];
-        const int idx1 = cloud11MH.idxVec[i];
-        if(idx2 != -1) //TODO figure out why not equivalent to isValid(...)
+        return current < 0 or distVec[idx1] < distVec[current]
+                or (distVec[idx1] == distVec[current] and idx1 < current);
+    };
+    
+    const BearingTable & bearingVec = bearingTable();
+    const Matrix3d Rinv = T12.rotMatInv();
+    const Vector3d & t = T12.trans();
+    forEachRowBlock(0, yMax, threadPool, [&](int yBegin, int yEnd)
+    {
+        ImagePointsSoA pointVec;
+        PointCloudSoA cloud;
+        vector<uint8_t> projMaskVec;
+        vector<int> idxVec;
+        for (int y = yBegin; y < yEnd; y++)
         {
-            const double depthNew = cloud12[i].norm();
-            double & depthOld = dMap2.at(idx2);
-            if (depthOld == OUT_OF_RANGE or depthNew < depthOld)
+            // the valid depths of the row, moved into the new frame
+            idxVec.clear();
+            cloud.x.clear();
+            cloud.y.clear();
+            cloud.z.clear();
+            for (int x = 0; x < xMax; x++)
+            {
+                const int idx = x + y*xMax;
+                if (at(idx) < MIN_DEPTH or not bearingVec.valid(idx)) continue;
+                const Vector3d X = Rinv * (bearingVec[idx] * double(at(idx)) - t);
+                idxVec.push_back(idx);
+                cloud.x.push_back(X[0]);
+                cloud.y.push_back(X[1]);
+                cloud.z.push_back(X[2]);
+            }
+            const int count = idxVec.size();
+            if (count == 0) continue;
+            
+            pointVec.resize(count);
+            projMaskVec.resize(count);
+            cameraPtr->projectBatch(cloud.x.data(), cloud.y.data(), cloud.z.data(), count,
+                    pointVec.u.data(), pointVec.v.data(), projMaskVec.data());
+            
+            // z-buffered splat
+            for (int i = 0; i < count; i++)
             {
-                const double dist = cloud12[i].norm();
-                dMap2.at(idx2) = dist;
-                dMap2.sigma(idx2) = sigma(idx1) + 0.005*dist;
-                dMap2.cost(idx2) = cost(idx1);
+                if (not projMaskVec[i]) continue;
+                const int x2 = xConv(pointVec.u[i]);
+                const int y2 = yConv(pointVec.v[i]);
+                if (not isValid(x2, y2)) continue;
+                const int idx1 = idxVec[i];
+                distVec[idx1] = Vector3d(cloud.x[i], cloud.y[i], cloud.z[i]).norm();
+                std::atomic<int> & winner = winnerArr[x2 + y2*xMax];
+                int current = winner.load();
+                while (closer(idx1, current) and not winner.compare_exchange_weak(current, idx1)) {}
             }
         }
-    }
+    });
+    
+    // fill in data for depthmap
+    forEachRowBlock(0, yMax, threadPool, [&](int yBegin, int yEnd)
+    {
+        for (int idx2 = yBegin*xMax; idx2 < yEnd*xMax; idx2++)
+        {
+            const int idx1 = winnerArr[idx2].load(std::memory_order_relaxed);
+            if (idx1 < 0) continue;
+            const double dist = distVec[idx1];
+            dMap2.at(idx2) = dist;
+            dMap2.sigma(idx2) = sigma(idx1) + 0.005*dist;
+            dMap2.cost(idx2) = cost(idx1);
+        }
+    });
 
     return dMap2;
 }
 
-DepthMap DepthMap::generatePlane(const ICamera * camera, const ScaleParameters & params, 
+template<typename T, DepthLayout L>
+BasicDepthMap<T, L> BasicDepthMap<T, L>::generatePlane(const ICamera * camera, const ScaleParameters & params, 
         Transformation<double> TcameraPlane, const Vector3dVec & polygonVec)
 {
-    DepthMap depth(camera, params);
+    BasicDepthMap depth(camera, params);
     Vector3d t = TcameraPlane.trans();
     Vector3d z = TcameraPlane.rotMat().col(2);
     Vector3dVec polygonCamVec;
@@ -802,7 +809,8 @@ DepthMap DepthMap::generatePlane(const ICamera * camera, const ScaleParameters &
     return depth;
 }
 
-void DepthMap::pixelMedianFilter(const int x, const int y, const int h, DepthMap & dst)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::pixelMedianFilter(const int x, const int y, const int h, BasicDepthMap & dst)
 {
     vector<double> depths;
     vector<double> sigmas;
@@ -844,7 +852,8 @@ void DepthMap::pixelMedianFilter(const int x, const int y, const int h, DepthMap
     dst.sigma(x, y, h) = depths[median];
 }
 
-void DepthMap::pixelAverageFilter(const Vector3iVec & matches, DepthMap & dst)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::pixelAverageFilter(const Vector3iVec & matches, BasicDepthMap & dst)
 {
     if (matches.size() == 0)
     {
@@ -865,56 +874,63 @@ void DepthMap::pixelAverageFilter(const Vector3iVec & matches, DepthMap & dst)
 
 //works only for the first hypothesis so far
 //TODO implement for multi-hyp case
-void DepthMap::filterNoise()
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::filterNoise(ThreadPool * threadPool)
 {
     const int minMatches = 2;
 
-    // Create copy of current depthmap, to avoid flow
-    DepthMap myCopy = *this;
+    // Copy of the first hypothesis, to avoid flow
+    // the rows are filtered independently, so the blocks can run in any order
+    vector<T> depthCopy(hStep), sigmaCopy(hStep);
+    for (int i = 0; i < hStep; i++)
+    {
+        depthCopy[i] = at(i);
+        sigmaCopy[i] = sigma(i);
+    }
 
     const array<int, 8> dxArr =  {-1,  0,  1,  1,  1,  0, -1, -1};
     const array<int, 8> dyArr  = { 1,  1,  1,  0, -1, -1, -1,  0};
     
     const int CENTRAL_WEIGHT = 5;
-    // Three loops to loop through every hypothesis
-    for (int y = 1; y < yMax - 1; ++y)
+    forEachRowBlock(1, yMax - 1, threadPool, [&](int yBegin, int yEnd)
     {
-        for (int x = 1; x < xMax - 1; ++x)
+        for (int y = yBegin; y < yEnd; ++y)
         {
-            double depthVal = myCopy.at(x, y);
-            if (depthVal == OUT_OF_RANGE) continue;
-            double sigmaVal = myCopy.sigma(x, y);
-            int countFilled = 0, countMatches = 0;
-            double acc = depthVal * CENTRAL_WEIGHT;
-            for (int i = 0; i < 8; i++)
-            {
-                int x2 = x + dxArr[i];
-                int y2 = y + dyArr[i];
-                double neighDepthVal = myCopy.at(x2, y2);
-//                double neighSigmaVal = myCopy.sigma(x + dxArr[i], y + dyArr[i]);
-                if (neighDepthVal == OUT_OF_RANGE) continue;
-                countFilled++;
-                double err = abs(depthVal - neighDepthVal);
-                if (err > sigmaVal or err > 3*myCopy.sigma(x2, y2)) continue;
-                countMatches++;
-                acc += neighDepthVal;
-            }
-            if (countMatches < minMatches and countMatches < countFilled or countFilled < 2)
+            for (int x = 1; x < xMax - 1; ++x)
             {
-                at(x, y) = OUT_OF_RANGE;
-                sigma(x, y) = OUT_OF_RANGE;
-            }
-            else
-            {
-                at(x, y) = acc / (countMatches + CENTRAL_WEIGHT);
+                double depthVal = depthCopy[x + y*xMax];
+                if (depthVal == OUT_OF_RANGE) continue;
+                double sigmaVal = sigmaCopy[x + y*xMax];
+                int countFilled = 0, countMatches = 0;
+                double acc = depthVal * CENTRAL_WEIGHT;
+                for (int i = 0; i < 8; i++)
+                {
+                    const int idx2 = x + dxArr[i] + (y + dyArr[i])*xMax;
+                    double neighDepthVal = depthCopy[idx2];
+                    if (neighDepthVal == OUT_OF_RANGE) continue;
+                    countFilled++;
+                    double err = abs(depthVal - neighDepthVal);
+                    if (err > sigmaVal or err > 3*sigmaCopy[idx2]) continue;
+                    countMatches++;
+                    acc += neighDepthVal;
+                }
+                if (countMatches < minMatches and countMatches < countFilled or countFilled < 2)
+                {
+                    at(x, y) = OUT_OF_RANGE;
+                    sigma(x, y) = OUT_OF_RANGE;
+                }
+                else
+                {
+                    at(x, y) = acc / (countMatches + CENTRAL_WEIGHT);
+                }
             }
         }
-    }
-
+    });
 }
 
 //TODO remove multihyp thing
-void DepthMap::merge(const DepthMap & depth2)
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::merge(const BasicDepthMap & depth2)
 {
     assert((ScaleParameters)(*this) == (ScaleParameters)depth2);
 
@@ -927,8 +943,8 @@ void DepthMap::merge(const DepthMap & depth2)
             if (d2 < MIN_DEPTH or d2 == OUT_OF_RANGE) continue;
             const double s2 = depth2.sigma(x, y);
             
-            double & d = at(x, y);
-            double & s = sigma(x, y);
+            T & d = at(x, y);
+            T & s = sigma(x, y);
             if (d == OUT_OF_RANGE)
             {
                 d = d2;
@@ -957,27 +973,35 @@ void DepthMap::merge(const DepthMap & depth2)
 //    costRejection();
 }
 
-void DepthMap::regularize()
+template<typename T, DepthLayout L>
+void BasicDepthMap<T, L>::regularize(ThreadPool * threadPool)
 {
-    const int minMatches = 2;
-    // Three loops to loop through every hypothesis
-    for (int h = 0; h < hMax - 1; ++h)
+    // every pixel stack is compacted on its own
+    forEachRowBlock(0, yMax, threadPool, [&](int yBegin, int yEnd)
     {
-        for (int y = 0; y < yMax; ++y)
+        for (int y = yBegin; y < yEnd; ++y)
         {
             for (int x = 0; x < xMax; ++x)
             {
-                if (at(x, y, h) < MIN_DEPTH)
+                for (int h = 0; h < hMax - 1; ++h)
                 {
-                    int h2 = h + 1;
-                    while (h2 < hMax and at(x, y, h2) < MIN_DEPTH) h2++;
-                    if (h2 == hMax) continue;
-                    at(x, y, h) = at(x, y, h2);
-                    sigma(x, y, h) = sigma(x, y, h2);
-                    cost(x, y, h) = cost(x, y, h2);
-                    at(x, y, h2) = OUT_OF_RANGE;
-                }             
+                    if (at(x, y, h) < MIN_DEPTH)
+                    {
+                        int h2 = h + 1;
+                        while (h2 < hMax and at(x, y, h2) < MIN_DEPTH) h2++;
+                        if (h2 == hMax) break;
+                        at(x, y, h) = at(x, y, h2);
+                        sigma(x, y, h) = sigma(x, y, h2);
+                        cost(x, y, h) = cost(x, y, h2);
+                        at(x, y, h2) = OUT_OF_RANGE;
+                    }
+                }
             }
         }
-    }
+    });
 }
+
+template class BasicDepthMap<double, DepthLayout::PLANAR>;
+template class BasicDepthMap<float, DepthLayout::PLANAR>;
+template class BasicDepthMap<double, DepthLayout::INTERLEAVED>;
+template class BasicDepthMap<float, DepthLayout::INTERLEAVED>;
@@ -171,7 +171,10 @@ void MotionStereo::reconstruct(double & dist, double & sigma, double & cost)
     uint32_t neededFlag = GLB_SAMPLE_VEC | GLB_UV | GLB_UV_VEC | GLB_DESCRIPTOR;
     assert(flags & neededFlag == neededFlag);
     
-    vector<int> costVec = compareDescriptor(gdescriptor, gsampleVec, _params.flawCost);
+    vector<int> & costVec = gcostVec;
+    costVec.resize(gsampleVec.size());
+    compareDescriptor(gdescriptor.data(), gdescriptor.size(), gsampleVec.data(), gsampleVec.size(),
+            _params.flawCost, gscratch, costVec.data());
     auto bestCostIter = min_element(costVec.begin() + HALF_LENGTH, costVec.end() - HALF_LENGTH);
     
     
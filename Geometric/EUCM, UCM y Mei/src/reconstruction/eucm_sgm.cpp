@@ -19,11 +19,18 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 /*
 Semi-global block matching algorithm for non-rectified images
 */
+#include <sstream>
+#include <cstdio>
+#include <future>
+
 #include "std.h"
 #include "io.h"
 #include "ocv.h"
 #include "eigen.h"
+#include "timer.h"
 #include "utils/filter.h"
+#include "utils/simd.h"
+#include "utils/hash.h"
 #include "geometry/geometry.h"
 #include "projection/eucm.h"
 #include "utils/curve_rasterizer.h"
@@ -39,15 +46,14 @@ CurveRasterizer<int, Polynomial2> EnhancedSgm::getCurveRasteriser(CameraIdx camI
     uint32_t useInverted = epipoles().chooseEpipole(camIdx, pti, _params.epipoleMargin);
     Vector2i goal = epipoles().getPx(camIdx, useInverted);
     CurveRasterizer<int, Polynomial2> raster(pti, goal,
-                            _epipolarCurves.get(camIdx, _reconstVec[idx]));
+                            _epipolarCurves.get(camIdx, (*_bearingTable)[idx]));
     if (useInverted & EPIPOLE_INVERTED) raster.setStep(-1);
     if (flags != NULL) *flags = useInverted;
     return raster;
 }
 
 
-//TODO reconstruct the depth points, not everything
-void EnhancedSgm::computeReconstructed()
+void EnhancedSgm::computePointGrid()
 {
     _pointVec1.resize(_params.yMax*_params.xMax);
     _pointPxVec1.resize(_params.yMax*_params.xMax);
@@ -60,87 +66,247 @@ void EnhancedSgm::computeReconstructed()
             _pointPxVec1[idx] = Vector2i(_params.uConv(x), _params.vConv(y));
         }
     }
-    _camera1->reconstructPointCloud(_pointVec1, _reconstVec, _maskVec);
+}
+
+//the table is shared with the depth maps of the same camera and scale
+void EnhancedSgm::computeReconstructed()
+{
+    _bearingTable = BearingTable::get(_camera1, _params, _params.geometryCache);
 }
 
 void EnhancedSgm::computeRotated()
 {
-    transf().inverseRotate(_reconstVec, _reconstRotVec);
+    transf().inverseRotate(_bearingTable->rays(), _reconstRotVec);
 }
 
-//FIXME _maskVec must be recomputed to discard not projected pInf
+//FIXME the mask must be recomputed to discard not projected pInf
 void EnhancedSgm::computePinf()
 {
     _camera2->projectPointCloud(_reconstRotVec, _pinfVec);
-    _pinfPxVec.resize(_pinfVec.size());
+    // invalid pixels are zeroed, the vector is written to the geometry cache as it is
+    _pinfPxVec.assign(_pinfVec.size(), Vector2i(0, 0));
     for (int i = 0; i < _pinfVec.size(); i++)
     {
-        if (not _maskVec[i]) continue;
+        if (not _bearingTable->valid(i)) continue;
         _pinfPxVec[i] = round(_pinfVec[i]);
     }
 }
 
 void EnhancedSgm::computeUVCache()
 {
+    // a loaded cache lives in the read-only mapping, it is dropped before writing a new one
+    _uvCache.release();
+    _geometryFile.reset();
+    _uvCache.create(_params.yMax, 2 * _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
+    _uvCache.setTo(UV_CACHE_INVALID);
     for (int y = 0; y < _params.yMax; y++)
     {
         for (int x = 0; x < _params.xMax; x++)
         {
             int idx = getLinearIndex(x, y);
-            if (not _maskVec[idx]) continue;
+            if (not _bearingTable->valid(idx)) continue;
             CurveRasterizer<int, Polynomial2> raster = getCurveRasteriser(CAMERA_2, idx);
             raster.steps(-DISPARITY_MARGIN);
             const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
-            int32_t * uPtr = (int32_t *)_uCache.row(y).data + x*u_vCacheStep;
-            int32_t * vPtr = (int32_t *)_vCache.row(y).data + x*u_vCacheStep;
-            for (int i = 0; i  < u_vCacheStep; i++, raster.step(), uPtr++, vPtr++)
+            const Vector2i & pinf = _pinfPxVec[idx];
+            int16_t * uvPtr = (int16_t *)_uvCache.row(y).data + 2*x*u_vCacheStep;
+            for (int i = 0; i  < u_vCacheStep; i++, raster.step(), uvPtr += 2)
             {
                 if (raster.v < 0 or raster.v >= _params.vMax 
                     or raster.u < 0 or raster.u >= _params.uMax)
                 {
                     // coordinate is out of the image
-                    *uPtr = -1;
-                    *vPtr = -1;
+                    uvPtr[0] = UV_CACHE_INVALID;
+                    uvPtr[1] = UV_CACHE_INVALID;
                 }
                 else
                 {
                     // coordinate is within the image
-                    *uPtr = raster.u;
-                    *vPtr = raster.v;
+                    uvPtr[0] = raster.u - pinf[0];
+                    uvPtr[1] = raster.v - pinf[1];
                 }
             }
         }
     }
 }
 
+namespace
+{
+    const char SGM_GEOMETRY_MAGIC[4] = {'S', 'G', 'M', 'G'};
+    
+    //bump it whenever the cached geometry or the file layout changes
+    const uint32_t SGM_GEOMETRY_VERSION = 2;
+    
+    struct SgmGeometryHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;
+        int32_t pointCount;
+        int32_t uvCacheRows, uvCacheCols;
+        int32_t reserved;
+    };
+    
+    // the sections are 8-byte aligned to be used in place
+    size_t alignedSize(size_t size) { return (size + 7) & ~size_t(7); }
+    
+    struct SgmGeometryLayout
+    {
+        SgmGeometryLayout(int pointCount, int uvCacheRows, int uvCacheCols)
+        {
+            pinfOffset = sizeof(SgmGeometryHeader);
+            uvCacheOffset = pinfOffset + alignedSize(pointCount * sizeof(Vector2i));
+            fileSize = uvCacheOffset + size_t(uvCacheRows) * uvCacheCols * sizeof(int16_t);
+        }
+        size_t pinfOffset, uvCacheOffset, fileSize;
+    };
+}
+
+uint64_t EnhancedSgm::geometryHash() const
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashValue(hash, SGM_GEOMETRY_VERSION);
+    hashValue(hash, DISPARITY_MARGIN);
+    hashBytes(hash, _camera1->getParams(), 6 * sizeof(double));
+    hashBytes(hash, _camera2->getParams(), 6 * sizeof(double));
+    const Array6d xiArr = transf().toArray();
+    hashBytes(hash, xiArr.data(), xiArr.size() * sizeof(double));
+    const int paramArr[] = {_params.scale, _params.u0, _params.v0, _params.uMax, _params.vMax,
+            _params.xMax, _params.yMax, _params.dispMax, _params.numEpipolarPlanes,
+            _params.epipoleMargin, _params.useUVCache};
+    hashBytes(hash, paramArr, sizeof(paramArr));
+    return hash;
+}
+
+string EnhancedSgm::geometryFileName(uint64_t hash) const
+{
+    std::ostringstream name;
+    name << "sgm_geometry_" << std::hex << std::setfill('0') << setw(16) << hash << ".bin";
+    const string & cacheDir = _params.geometryCache;
+    if (cacheDir.back() == '/') return cacheDir + name.str();
+    return cacheDir + "/" + name.str();
+}
+
+bool EnhancedSgm::loadGeometry()
+{
+    if (_params.geometryCache.empty()) return false;
+    const uint64_t hash = geometryHash();
+    const string fileName = geometryFileName(hash);
+    std::unique_ptr<MappedFile> file(new MappedFile(fileName));
+    if (not file->valid() or file->size() < sizeof(SgmGeometryHeader)) return false;
+    
+    const int pointCount = _params.xMax * _params.yMax;
+    const int uvCacheRows = _params.useUVCache ? _params.yMax : 0;
+    const int uvCacheCols = _params.useUVCache ? 
+            2 * _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN) : 0;
+    const SgmGeometryLayout layout(pointCount, uvCacheRows, uvCacheCols);
+    const SgmGeometryHeader & header = *(const SgmGeometryHeader *)file->data();
+    if (not std::equal(header.magic, header.magic + 4, SGM_GEOMETRY_MAGIC)
+        or header.version != SGM_GEOMETRY_VERSION
+        or header.hash != hash
+        or header.pointCount != pointCount
+        or header.uvCacheRows != uvCacheRows
+        or header.uvCacheCols != uvCacheCols
+        or file->size() != layout.fileSize)
+    {
+        return false;
+    }
+    
+    const uint8_t * data = file->data();
+    const Vector2i * pinfPtr = (const Vector2i *)(data + layout.pinfOffset);
+    _pinfPxVec.assign(pinfPtr, pinfPtr + pointCount);
+    if (_params.useUVCache)
+    {
+        // used in place, the mapping is read-only so computeUVCache releases it first
+        _uvCache = Mat16s(uvCacheRows, uvCacheCols, (int16_t *)(data + layout.uvCacheOffset));
+    }
+    _geometryFile = std::move(file);
+    if (_params.verbosity > 0) cout << "EnhancedSgm: geometry loaded from " << fileName << endl;
+    return true;
+}
+
+bool EnhancedSgm::saveGeometry() const
+{
+    if (_params.geometryCache.empty()) return false;
+    const uint64_t hash = geometryHash();
+    const string fileName = geometryFileName(hash);
+    
+    const int pointCount = _params.xMax * _params.yMax;
+    const int uvCacheRows = _params.useUVCache ? _uvCache.rows : 0;
+    const int uvCacheCols = _params.useUVCache ? _uvCache.cols : 0;
+    assert(_pinfPxVec.size() == pointCount);
+    assert(not _params.useUVCache or _uvCache.isContinuous());
+    const SgmGeometryLayout layout(pointCount, uvCacheRows, uvCacheCols);
+    
+    //write to a temporary file first so that concurrent runs never map a partial file
+    const string tmpName = fileName + ".tmp";
+    bool success = false;
+    {
+        ofstream geometryFile(tmpName, std::ios::binary | std::ios::trunc);
+        if (geometryFile)
+        {
+            SgmGeometryHeader header;
+            copy(SGM_GEOMETRY_MAGIC, SGM_GEOMETRY_MAGIC + 4, header.magic);
+            header.version = SGM_GEOMETRY_VERSION;
+            header.hash = hash;
+            header.pointCount = pointCount;
+            header.uvCacheRows = uvCacheRows;
+            header.uvCacheCols = uvCacheCols;
+            header.reserved = 0;
+            
+            const vector<char> padding(8, 0);
+            
+            geometryFile.write((const char *)&header, sizeof(header));
+            geometryFile.write((const char *)_pinfPxVec.data(), pointCount * sizeof(Vector2i));
+            geometryFile.write(padding.data(), layout.uvCacheOffset - layout.pinfOffset
+                    - pointCount * sizeof(Vector2i));
+            if (_params.useUVCache)
+            {
+                geometryFile.write((const char *)_uvCache.data, _uvCache.total() * sizeof(int16_t));
+            }
+            success = bool(geometryFile);
+        }
+    }
+    success = success and std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+    if (not success)
+    {
+        std::cerr << "WARNING: failed to cache the SGM geometry in " << fileName << endl;
+    }
+    return success;
+}
+
 void EnhancedSgm::createBuffer()
 {
     if (_params.verbosity > 1) cout << "EnhancedSgm::createBuffer" << endl;
     assert(_params.hypMax > 0);
     int bufferWidth = _params.xMax*_params.dispMax;
-    _stepBuffer.create(_params.yMax, _params.xMax);
-    _errorBuffer.create(_params.yMax, bufferWidth);
-    _tableauLeft.create(_params.yMax, bufferWidth);
-    _tableauRight.create(_params.yMax, bufferWidth);
-    _tableauTop.create(_params.yMax, bufferWidth);
-    _tableauBottom.create(_params.yMax, bufferWidth);
+    createCostVolume(_costVolume);
+    _costSum.create(_params.yMax, bufferWidth);
     _smallDisparity.create(_params.yMax, _params.xMax * _params.hypMax);
     _finalErrorMat.create(_params.yMax, _params.xMax * _params.hypMax);
-    _skipBuffer.create(_params.yMax, _params.xMax);
-    if (_params.imageBasedCost) _costBuffer.create(_params.yMax, _params.xMax);
-    if (_params.salientPoints) _salientBuffer.create(_params.yMax, _params.xMax);
-    _uCache.create(_params.yMax, _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
-    _vCache.create(_params.yMax, _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
     if (_params.verbosity > 2) 
     {
         cout << "    small disparity size: " << _smallDisparity.size() << endl;
+        const size_t uvCacheSize = _params.useUVCache ? 
+                _params.yMax * _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN) : 0;
+        const size_t bufferBytes = _costVolume.error.total() + _costSum.total() * sizeof(uint16_t)
+                + 2 * uvCacheSize * sizeof(int16_t);
+        cout << "    cost and cache buffers: " << bufferBytes / (1 << 20) << " MB" << endl;
     }
 }
 
+void EnhancedSgm::createCostVolume(SgmCostVolume & volume) const
+{
+    volume.error.create(_params.yMax, _params.xMax*_params.dispMax);
+    volume.step.create(_params.yMax, _params.xMax);
+    volume.skip.create(_params.yMax, _params.xMax);
+    if (_params.imageBasedCost) volume.jumpCost.create(_params.yMax, _params.xMax);
+    if (_params.salientPoints) volume.salient.create(_params.yMax, _params.xMax);
+}
+
 void EnhancedSgm::computeStereo(const Mat8u & img1, const Mat8u & img2, DepthMap & depth)
 {
-    _skipBuffer.setTo(0);
-    computeCurveCost(img1, img2);
+    computeCurveCost(img1, img2, _costVolume, _threadPool);
     
     computeDynamicProgramming();
     
@@ -151,30 +317,98 @@ void EnhancedSgm::computeStereo(const Mat8u & img1, const Mat8u & img2, DepthMap
 
 }
 
+void StereoStreamReport::print() const
+{
+    cout << "frames processed : " << frameCount << endl;
+    cout << "wall time        : " << wallTime << " s" << endl;
+    cout << "throughput       : " << frameCount / wallTime << " frames/s" << endl;
+    cout << "stage time, ms (mean / max)" << endl;
+    for (auto & x : {make_pair("  cost       ", &cost), make_pair("  aggregation", &aggregation),
+                     make_pair("  disparity  ", &disparity), make_pair("  depth      ", &depth),
+                     make_pair("  sink       ", &sink)})
+    {
+        cout << x.first << " : " << 1e3 * x.second->mean() << " / " << 1e3 * x.second->maxTime << endl;
+    }
+}
+
+StereoStreamReport EnhancedSgm::computeStereoStream(const StereoFrameSource & source,
+        DepthMap & depth, const DepthSink & sink)
+{
+    if (_params.verbosity > 0) cout << "EnhancedSgm::computeStereoStream" << endl;
+    StereoStreamReport report;
+    Timer wallTimer;
+    
+    // the cost of the next frame goes to the second volume on its own pool,
+    // so that it does not wait for the aggregation jobs on _threadPool
+    if (_nextCostVolume.error.empty()) createCostVolume(_nextCostVolume);
+    if (not _costThreadPool) _costThreadPool.reset(new ThreadPool(_params.threadCount));
+    
+    Mat8u img1, img2;
+    if (not source(img1, img2)) return report;
+    Timer timer;
+    computeCurveCost(img1, img2, _costVolume, _threadPool);
+    report.cost.add(timer.elapsed());
+    
+    while (true)
+    {
+        auto nextFrame = std::async(std::launch::async, [&]
+        {
+            if (not source(img1, img2)) return false;
+            Timer costTimer;
+            computeCurveCost(img1, img2, _nextCostVolume, *_costThreadPool);
+            report.cost.add(costTimer.elapsed());
+            return true;
+        });
+        
+        timer.reset();
+        computeDynamicProgramming();
+        report.aggregation.add(timer.elapsed());
+        
+        timer.reset();
+        if (_params.hypMax == 1) reconstructDisparity();
+        else reconstructDisparityMH();
+        report.disparity.add(timer.elapsed());
+        
+        timer.reset();
+        reconstructDepth(depth);
+        report.depth.add(timer.elapsed());
+        
+        timer.reset();
+        sink(report.frameCount, depth);
+        report.sink.add(timer.elapsed());
+        report.frameCount++;
+        
+        if (not nextFrame.get()) break;
+        std::swap(_costVolume, _nextCostVolume);
+    }
+    report.wallTime = wallTimer.elapsed();
+    return report;
+}
+
 void EnhancedSgm::reconstructDepth(DepthMap & depth) const
 {
     if (_params.verbosity > 2) 
     {
         cout << "EnhancedSgm::reconstructDepth(DepthMap & depth)" << endl;
     }
-    depth = DepthMap(_camera1, _params, _params.hypMax);
+    depth.reset(_camera1, _params, _params.hypMax);
     for (int h = 0; h < _params.hypMax; h++)
     {
         for (int y = 0; y < _params.yMax; y++)
         {
             for (int x = 0; x < _params.xMax; x++)
             {
-                if (_params.salientPoints and not _salientBuffer(y, x) or _skipBuffer(y, x)) 
+                if (_params.salientPoints and not _costVolume.salient(y, x) or _costVolume.skip(y, x)) 
                 {
                     depth.at(x, y, h) = OUT_OF_RANGE;
                     depth.sigma(x, y, h) = OUT_OF_RANGE;
                     depth.cost(x, y, h) = OUT_OF_RANGE;
                     continue;
                 }
-                depth.cost(x, y, h) = _errorBuffer(y, x*_params.dispMax + h);
+                depth.cost(x, y, h) = _costVolume.error(y, x*_params.dispMax + h);
                 
                 int idx = getLinearIndex(x, y);
-                if (not _maskVec[idx])
+                if (not _bearingTable->valid(idx))
                 { 
                     depth.at(x, y, h) = OUT_OF_RANGE;
                     depth.sigma(x, y, h) = OUT_OF_RANGE;
@@ -189,14 +423,11 @@ void EnhancedSgm::reconstructDepth(DepthMap & depth) const
                 // to compute point on the second image
                 // TODO make virtual rasterizer using the cache
                 int u21, v21, u22, v22;
-                int step = _stepBuffer(y, x);
+                int step = _costVolume.step(y, x);
                 if (_params.useUVCache)
                 {
-                    const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
-                    u21 = _uCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity);
-                    u22 = _uCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity + step);
-                    v21 = _vCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity);
-                    v22 = _vCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity + step);
+                    getCachedPoint(x, y, DISPARITY_MARGIN + disparity, u21, v21);
+                    getCachedPoint(x, y, DISPARITY_MARGIN + disparity + step, u22, v22);
                 }
                 else
                 {       
@@ -217,191 +448,211 @@ void EnhancedSgm::reconstructDepth(DepthMap & depth) const
     }
 }
 
-void EnhancedSgm::skipPixel(int x, int y)
+void EnhancedSgm::skipPixel(int x, int y, SgmCostVolume & volume)
 {
-    uint8_t * outPtr = _errorBuffer.row(y).data + x*_params.dispMax;            
+    uint8_t * outPtr = volume.error.row(y).data + x*_params.dispMax;            
     *outPtr = 0;
-    _skipBuffer(y, x) = 1;
+    volume.skip(y, x) = 1;
+    // the aggregation passes through skipped pixels too,
+    // their jump cost must not depend on the previous frames
+    if (_params.imageBasedCost) volume.jumpCost(y, x) = _params.lambdaJump;
     fill(outPtr + 1, outPtr + _params.dispMax, 255);
 }
 
-void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
+void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2,
+        SgmCostVolume & volume, ThreadPool & threadPool)
 {
     if (_params.verbosity > 0) cout << "EnhancedSgm::computeCurveCost" << endl;
     
     // compute the weights for matching cost
     
-    if (_params.salientPoints) _salientBuffer.setTo(0);
+    volume.skip.setTo(0);
+    if (_params.salientPoints) volume.salient.setTo(0);
     
-    for (int y = 0; y < _params.yMax; y++)
+    // the rows are independent, every block of rows has its own scratch buffers
+    // the verbose output is kept in order by a single block
+    const int grain = (_params.verbosity > 4) ? _params.yMax : 1;
+    threadPool.parallelFor(_params.yMax, [&](int begin, int end)
     {
-        for (int x = 0; x < _params.xMax; x++)
+        CurveCostScratch scratch(_epipolarDescriptor);
+        for (int y = begin; y < end; y++)
         {
-            int idx = getLinearIndex(x, y);
-            if (_params.verbosity > 5) 
-            {
-                cout << "    x: " << x << " y: " << y << "  idx: " << idx; 
-                cout << "  mask: " << _maskVec[idx] <<  endl;
-            }
-            if (not _maskVec[idx])
-            {
-                skipPixel(x, y);
-                continue;
-            }
-            // compute the local image descriptor,
-            // a piece of the epipolar curve on the first image
-            vector<uint8_t> descriptor;
-            uint32_t flags;
-            CurveRasterizer<int, Polynomial2> descRaster = getCurveRasteriser(CAMERA_1, idx, &flags);
-            if (flags & EPIPOLE_TOO_CLOSE) 
-            {
-                skipPixel(x, y);
-                continue;
-            }
-            const int step = _epipolarDescriptor.compute(img1, descRaster, descriptor);
-            _stepBuffer(y, x) = step;
-            if (step < 1) 
+            computeCurveCostRow(img1, img2, y, volume, scratch);
+        }
+    }, grain);
+//    cout << "Epipoles : " << endl;
+//    cout << epipoles().useInvertedEpipoleSecond(Vector2i(250, 250)) << endl;
+//    cout << epipoles().getSecond(true).transpose() << "   
+//  "  << epipoles().getSecond(false).transpose() << endl;
+//    cout << epipoles().getSecondPx(true).transpose() << "    
+// "  << epipoles().getSecondPx(false).transpose() << endl;
+//    
+//    
+//    cout << epipoles().epipole1projected<< epipoles().epipole2projected
+//        << epipoles().antiEpipole1projected<< epipoles().antiEpipole2projected << endl;
+}
+
+void EnhancedSgm::computeCurveCostRow(const Mat8u & img1, const Mat8u & img2, int y,
+        SgmCostVolume & volume, CurveCostScratch & scratch)
+{
+    vector<uint8_t> & descriptor = scratch.descriptor;
+    vector<uint8_t> & sampleVec = scratch.sampleVec;
+    vector<int> & costVec = scratch.costVec;
+    for (int x = 0; x < _params.xMax; x++)
+    {
+        int idx = getLinearIndex(x, y);
+        if (_params.verbosity > 5) 
+        {
+            cout << "    x: " << x << " y: " << y << "  idx: " << idx; 
+            cout << "  mask: " << _bearingTable->valid(idx) <<  endl;
+        }
+        if (not _bearingTable->valid(idx))
+        {
+            skipPixel(x, y, volume);
+            continue;
+        }
+        // compute the local image descriptor,
+        // a piece of the epipolar curve on the first image
+        uint32_t flags;
+        CurveRasterizer<int, Polynomial2> descRaster = getCurveRasteriser(CAMERA_1, idx, &flags);
+        if (flags & EPIPOLE_TOO_CLOSE) 
+        {
+            skipPixel(x, y, volume);
+            continue;
+        }
+        const int step = scratch.epipolarDescriptor.compute(img1, descRaster, descriptor);
+        volume.step(y, x) = step;
+        if (step < 1) 
+        {
+            skipPixel(x, y, volume);
+            continue;
+        }
+        if (_params.imageBasedCost) 
+        {
+            switch (step)
             {
-                skipPixel(x, y);
-                continue;
+            case 1:
+                volume.jumpCost(y, x) = _params.lambdaJump;
+                break;
+            case 2:
+                volume.jumpCost(y, x) = _params.lambdaJump * 3;
+                break;
+            default:
+                volume.jumpCost(y, x) = _params.lambdaJump * 6;
+                break;
             }
-            if (_params.imageBasedCost) 
+        }
+        
+        //TODO revise the criterion (step == 1)
+        if (_params.salientPoints and step < 2 and scratch.epipolarDescriptor.goodResp())
+        {
+            volume.salient(y, x) = 1;
+        }
+        const int nSteps = ( _params.dispMax  + step - 1 ) / step; 
+           
+        //sample the curve 
+        sampleVec.assign(nSteps + MARGIN, 0);
+        bool crossedImageBoundary = false;
+        if (_params.useUVCache)
+        {
+            int curveIdx = DISPARITY_MARGIN - HALF_LENGTH * step;
+            for (int i = 0; i  < nSteps + MARGIN; i++, curveIdx += step)
             {
-                switch (step)
+                int u, v;
+                getCachedPoint(x, y, curveIdx, u, v);
+                if (u < 0 or v < 0) 
                 {
-                case 1:
-                    _costBuffer(y, x) = _params.lambdaJump;
-                    break;
-                case 2:
-                    _costBuffer(y, x) = _params.lambdaJump * 3;
-                    break;
-                default:
-                    _costBuffer(y, x) = _params.lambdaJump * 6;
+                    crossedImageBoundary = true;
                     break;
                 }
+                else sampleVec[i] = img2(v, u);
             }
+        }
+        else
+        {
+            CurveRasterizer<int, Polynomial2> raster = getCurveRasteriser(CAMERA_2, idx);
+            raster.setStep(step); 
+            raster.steps(-HALF_LENGTH);           
             
-            //TODO revise the criterion (step == 1)
-            if (_params.salientPoints and step < 2 and _epipolarDescriptor.goodResp())
+            if (_params.verbosity > 6)
             {
-                _salientBuffer(y, x) = 1;
+                cout << "CURVE RASTERIZER" << endl;
+                cout << "delta : " << raster.delta << endl;
+                cout << "fu fv : " << raster.fu << " " << raster.fv << endl;
+                cout << " u  v : " << raster.u << " " << raster.v << endl;
+                
+                const auto & surf = raster.surf;
+                cout << " SURF : " << endl;
+                cout << surf.kuu << " " << surf.kuv << " " << surf.kvv << " " << surf.ku
+                     << " " << surf.kv << " " << surf.k1 << endl;
             }
-            const int nSteps = ( _params.dispMax  + step - 1 ) / step; 
-               
-            //sample the curve 
-            vector<uint8_t> sampleVec(nSteps + MARGIN, 0);
-            bool crossedImageBoundary = false;
-            if (_params.useUVCache)
+            
+            for (int i = 0; i  < nSteps + MARGIN; i++, raster.step())
             {
-                const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
-                int32_t * uPtr = (int32_t *)_uCache.row(y).data + x*u_vCacheStep;
-                int32_t * vPtr = (int32_t *)_vCache.row(y).data + x*u_vCacheStep;
-                uPtr += DISPARITY_MARGIN - HALF_LENGTH * step;
-                vPtr += DISPARITY_MARGIN - HALF_LENGTH * step;
-                for (int i = 0; i  < nSteps + MARGIN; i++, uPtr += step, vPtr += step)
-                {
-                    if (*uPtr < 0 or *vPtr < 0) 
+                if (raster.v < 0 or raster.v >= img2.rows 
+                    or raster.u < 0 or raster.u >= img2.cols)
                     {
                         crossedImageBoundary = true;
                         break;
                     }
-                    else sampleVec[i] = img2(*vPtr, *uPtr);
+                if (_params.verbosity > 5)
+                {
+                    cout << raster.u << "  " << raster.v << endl;
                 }
+                sampleVec[i] = img2(raster.v, raster.u);
             }
-            else
+        }
+        if (crossedImageBoundary)
+        {
+            skipPixel(x, y, volume);
+            continue;
+        }
+        costVec.resize(sampleVec.size());
+        compareDescriptor(descriptor.data(), descriptor.size(), sampleVec.data(), sampleVec.size(),
+                _params.flawCost, scratch.descScratch, costVec.data());
+        
+        if (_params.verbosity > 4)
+        {
+            cout << "Point : " << x << " " << y << endl;
+            cout << "Step : " << step << endl;
+            cout << "samples :" << endl;
+            for (auto & x : sampleVec)
             {
-                CurveRasterizer<int, Polynomial2> raster = getCurveRasteriser(CAMERA_2, idx);
-                raster.setStep(step); 
-                raster.steps(-HALF_LENGTH);           
-                
-                if (_params.verbosity > 6)
-                {
-                    cout << "CURVE RASTERIZER" << endl;
-                    cout << "delta : " << raster.delta << endl;
-                    cout << "fu fv : " << raster.fu << " " << raster.fv << endl;
-                    cout << " u  v : " << raster.u << " " << raster.v << endl;
-                    
-                    const auto & surf = raster.surf;
-                    cout << " SURF : " << endl;
-                    cout << surf.kuu << " " << surf.kuv << " " << surf.kvv << " " << surf.ku
-                         << " " << surf.kv << " " << surf.k1 << endl;
-                }
-                
-                for (int i = 0; i  < nSteps + MARGIN; i++, raster.step())
-                {
-                    if (raster.v < 0 or raster.v >= img2.rows 
-                        or raster.u < 0 or raster.u >= img2.cols)
-                        {
-                            crossedImageBoundary = true;
-                            break;
-                        }
-                    if (_params.verbosity > 5)
-                    {
-                        cout << raster.u << "  " << raster.v << endl;
-                    }
-                    sampleVec[i] = img2(raster.v, raster.u);
-                }
+                cout << setw(6) << int(x);
             }
-            if (crossedImageBoundary)
+            cout << endl;
+            cout << "cost :" << endl;
+            for (auto & x : costVec)
             {
-                skipPixel(x, y);
-                continue;
+                cout << setw(6) << int(x);
             }
-            vector<int> costVec = compareDescriptor(descriptor, sampleVec, _params.flawCost);
-            
-            if (_params.verbosity > 4)
+            cout << endl;
+            cout << "descriptor :" << endl;
+            for (auto & x : descriptor)
             {
-                cout << "Point : " << x << " " << y << endl;
-                cout << "Step : " << step << endl;
-                cout << "samples :" << endl;
-                for (auto & x : sampleVec)
-                {
-                    cout << setw(6) << int(x);
-                }
-                cout << endl;
-                cout << "cost :" << endl;
-                for (auto & x : costVec)
-                {
-                    cout << setw(6) << int(x);
-                }
-                cout << endl;
-                cout << "descriptor :" << endl;
-                for (auto & x : descriptor)
-                {
-                    cout << setw(6) << int(x);
-                }
-                cout << endl;
+                cout << setw(6) << int(x);
             }
+            cout << endl;
+        }
 //            //compute the bias;
 //            int sum1 = filter(kernelVec.begin(), kernelVec.end(), descriptor.begin(), 0);
-            
-            // fill up the cost buffer
-            uint8_t * outPtr = _errorBuffer.row(y).data + x*_params.dispMax;
-            auto costIter = costVec.begin() + HALF_LENGTH;
-            for (int d = 0; d < nSteps; d++, outPtr += step)
-            {
+        
+        // fill up the cost buffer
+        uint8_t * outPtr = volume.error.row(y).data + x*_params.dispMax;
+        auto costIter = costVec.begin() + HALF_LENGTH;
+        for (int d = 0; d < nSteps; d++, outPtr += step)
+        {
 //                int sum2 = filter(kernelVec.begin(), kernelVec.end(), sampleVec.begin() + d, 0);
 //                int bias = min(_params.maxBias, max(-_params.maxBias, (sum2 - sum1) / LENGTH));
 //                int acc =  biasedAbsDiff(kernelVec.begin(), kernelVec.end(),
 //                                descriptor.begin(), sampleVec.begin() + d, bias);
 //                *outPtr = acc / NORMALIZER;
 
-                *outPtr = min(*costIter, 255);
-                ++costIter;
-            }
-            if (step > 1) fillGaps(_errorBuffer.row(y).data + x*_params.dispMax, step);
+            *outPtr = min(*costIter, 255);
+            ++costIter;
         }
+        if (step > 1) fillGaps(volume.error.row(y).data + x*_params.dispMax, step);
     }
-//    cout << "Epipoles : " << endl;
-//    cout << epipoles().useInvertedEpipoleSecond(Vector2i(250, 250)) << endl;
-//    cout << epipoles().getSecond(true).transpose() << "   
-//  "  << epipoles().getSecond(false).transpose() << endl;
-//    cout << epipoles().getSecondPx(true).transpose() << "    
-// "  << epipoles().getSecondPx(false).transpose() << endl;
-//    
-//    
-//    cout << epipoles().epipole1projected<< epipoles().epipole2projected
-//        << epipoles().antiEpipole1projected<< epipoles().antiEpipole2projected << endl;
 }
 
 void EnhancedSgm::fillGaps(uint8_t * const data, const int step)
@@ -447,152 +698,129 @@ void EnhancedSgm::fillGaps(uint8_t * const data, const int step)
     }
 }
 
-void EnhancedSgm::computeDynamicStep(const int32_t* inCost, const uint8_t * error, int32_t * outCost)
+void EnhancedSgm::computeDynamicStep(const uint16_t * inCost, const uint8_t * error,
+        uint16_t * outCost, uint16_t * costSum, int jumpCost) const
 {
-    int bestCost = inCost[0];
-    for (int i = 1; i < _params.dispMax; i++)
+    const int dispMax = _params.dispMax;
+    U16x8 bestVec = U16x8::broadcast(UINT16_MAX);
+    int i = 0;
+    for (; i + U16x8::SIZE <= dispMax; i += U16x8::SIZE)
     {
-        bestCost = min(bestCost, inCost[i]);
+        bestVec = minLanes(bestVec, U16x8::load(inCost + i));
     }
-    int & val0 = outCost[0];
-    val0 = inCost[0];
-    val0 = min(val0, inCost[1] + _params.lambdaStep);
-    val0 = min(val0, bestCost + _jumpCost);
-    val0 += error[0];
-    for (int i = 1; i < _params.dispMax-1; i++)
+    uint16_t bestCost = minElement(bestVec);
+    for (; i < dispMax; i++) bestCost = min(bestCost, inCost[i]);
+    
+    // every candidate is not smaller than bestCost, so subtracting it is exact
+    const uint16_t stepCost = min(max(_params.lambdaStep, 0), int(UINT16_MAX));
+    const uint16_t bestJump = addSat(bestCost, uint16_t(min(max(jumpCost, 0), int(UINT16_MAX))));
+    auto scalarStep = [&](int i)
     {
-        int & val = outCost[i];
-        val = inCost[i];
-        val = min(val, inCost[i + 1] + _params.lambdaStep);
-        val = min(val, inCost[i - 1] + _params.lambdaStep);
-        val = min(val, bestCost + _jumpCost);
-        val += error[i];
+        uint16_t val = inCost[i];
+        if (i > 0) val = min(val, addSat(inCost[i - 1], stepCost));
+        if (i < dispMax - 1) val = min(val, addSat(inCost[i + 1], stepCost));
+        val = min(val, bestJump);
+        outCost[i] = addSat(subSat(val, bestCost), error[i]);
+        costSum[i] = addSat(costSum[i], outCost[i]);
+    };
+    
+    scalarStep(0);
+    const U16x8 stepVec = U16x8::broadcast(stepCost);
+    const U16x8 bestCostVec = U16x8::broadcast(bestCost);
+    const U16x8 bestJumpVec = U16x8::broadcast(bestJump);
+    // the lanes read inCost[i + SIZE], so the last element goes to the scalar tail
+    for (i = 1; i + U16x8::SIZE < dispMax; i += U16x8::SIZE)
+    {
+        U16x8 val = U16x8::load(inCost + i);
+        val = minLanes(val, addSat(U16x8::load(inCost + i - 1), stepVec));
+        val = minLanes(val, addSat(U16x8::load(inCost + i + 1), stepVec));
+        val = minLanes(val, bestJumpVec);
+        val = addSat(subSat(val, bestCostVec), U16x8::load(error + i));
+        val.store(outCost + i);
+        addSat(U16x8::load(costSum + i), val).store(costSum + i);
     }
-    int & vald = outCost[_params.dispMax - 1];
-    vald = inCost[_params.dispMax - 1];
-    vald = min(vald, inCost[_params.dispMax - 2] + _params.lambdaStep);
-    vald = min(vald, bestCost + _jumpCost);
-    vald += error[_params.dispMax - 1];
+    for (; i < dispMax; i++) scalarStep(i);
 }
 
-void EnhancedSgm::computeDynamicStep2(const int32_t* inCost, const uint32_t * error, int32_t * outCost)
+void EnhancedSgm::aggregatePaths(int dx, int dy)
 {
-    int bestCost = inCost[0];
-    for (int i = 1; i < _params.dispMax; i++)
-    {
-        bestCost = min(bestCost, inCost[i]);
-    }
-    int & val0 = outCost[0];
-    val0 = inCost[0];
-    val0 = min(val0, inCost[1] + _params.lambdaStep);
-    val0 = min(val0, bestCost + _jumpCost);
-    val0 += error[0];
-    for (int i = 1; i < _params.dispMax-1; i++)
+    const int xMax = _params.xMax;
+    const int yMax = _params.yMax;
+    const int dispMax = _params.dispMax;
+    
+    // a path starts where its predecessor falls out of the image:
+    // on the first row (if dy != 0) or on the first column (if dx != 0)
+    const int xFirst = (dx > 0) ? 0 : xMax - 1;
+    const int yFirst = (dy > 0) ? 0 : yMax - 1;
+    const int rowStartCount = (dy != 0) ? xMax : 0;
+    const int colStartCount = (dx == 0) ? 0 : (dy == 0) ? yMax : yMax - 1;
+    const int colStartShift = (dy > 0) ? 1 : 0; // skip the corner counted as a row start
+    
+    _threadPool.parallelFor(rowStartCount + colStartCount, [&](int begin, int end)
     {
-        int & val = outCost[i];
-        val = inCost[i];
-        val = min(val, inCost[i + 1] + _params.lambdaStep);
-        val = min(val, inCost[i - 1] + _params.lambdaStep);
-        val = min(val, bestCost + _jumpCost);
-        val += error[i];
-    }
-    int & vald = outCost[_params.dispMax - 1];
-    vald = inCost[_params.dispMax - 1];
-    vald = min(vald, inCost[_params.dispMax - 2] + _params.lambdaStep);
-    vald = min(vald, bestCost + _jumpCost);
-    vald += error[_params.dispMax - 1];
+        vector<uint16_t> pathCost(2 * dispMax);
+        for (int pathIdx = begin; pathIdx < end; pathIdx++)
+        {
+            int x = xFirst, y = yFirst;
+            if (pathIdx < rowStartCount) x = pathIdx;
+            else y = pathIdx - rowStartCount + colStartShift;
+            
+            uint16_t * prevCost = pathCost.data();
+            uint16_t * curCost = prevCost + dispMax;
+            
+            // init with the error of the first pixel
+            const uint8_t * error = _costVolume.error.row(y).data + x*dispMax;
+            uint16_t * costSum = (uint16_t *)(_costSum.row(y).data) + x*dispMax;
+            for (int d = 0; d < dispMax; d++)
+            {
+                prevCost[d] = error[d];
+                costSum[d] = addSat(costSum[d], prevCost[d]);
+            }
+            
+            for (x += dx, y += dy; x >= 0 and x < xMax and y >= 0 and y < yMax; x += dx, y += dy)
+            {
+                const int jumpCost = _params.imageBasedCost ? 
+                        _costVolume.jumpCost(y, x) : _params.lambdaJump;
+                computeDynamicStep(prevCost, _costVolume.error.row(y).data + x*dispMax, curCost,
+                        (uint16_t *)(_costSum.row(y).data) + x*dispMax, jumpCost);
+                std::swap(prevCost, curCost);
+            }
+        }
+    });
 }
 
 void EnhancedSgm::computeDynamicProgramming()
 {
     if (_params.verbosity > 0) cout << "EnhancedSgm::computeDynamicProgramming" << endl;
-    if (_params.verbosity > 1) cout << "    left" << endl;
     
-    if (not _params.imageBasedCost) _jumpCost = _params.lambdaJump;
+    // left, right, top, bottom, then the diagonals
+    const int directionArr[8][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1},
+                                     {1, 1}, {-1, 1}, {1, -1}, {-1, -1} };
     
-    // left _tableau init
-    for (int y = 0; y < _params.yMax; y++)
-    {
-        int32_t * _tableauRow = (int32_t *)(_tableauLeft.row(y).data);
-        uint8_t * errorRow = _errorBuffer.row(y).data;
-        // init the first row
-        copy(errorRow, errorRow + _params.dispMax, _tableauRow);
-        // fill up the _tableau
-        for (int x = 1; x < _params.xMax; x++)
-        {
-            if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
-            computeDynamicStep(_tableauRow + (x - 1)*_params.dispMax,
-                    errorRow + x*_params.dispMax, _tableauRow + x*_params.dispMax);
-        }
-    }
-    if (_params.verbosity > 1) cout << "    right" << endl;  
-    // right _tableau init
-    for (int y = 0; y < _params.yMax; y++)
-    {
-        int32_t * _tableauRow = (int32_t *)(_tableauRight.row(y).data);
-        uint8_t * errorRow = _errorBuffer.row(y).data;
-        int base = (_params.xMax - 1) * _params.dispMax;
-        copy(errorRow + base, errorRow + base + _params.dispMax, _tableauRow + base);
-        
-        for (int x = _params.xMax - 2; x >= 0; x--)
-        {
-            if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
-            computeDynamicStep(_tableauRow + (x + 1)*_params.dispMax, 
-                    errorRow + x*_params.dispMax, _tableauRow + x*_params.dispMax);
-        }
-    }
-    if (_params.verbosity > 1) cout << "    top" << endl;
-    // top-down _tableau init
-    for (int x = 0; x < _params.xMax; x++)
-    {
-        auto _tableauCol = _tableauTop(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        auto errorCol = _errorBuffer(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        copy(errorCol.data, errorCol.data + _params.dispMax, (int*)(_tableauCol.data));
-        for (int y = 1; y < _params.yMax; y++)
-        {
-            if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
-            computeDynamicStep((int32_t*)(_tableauCol.row(y-1).data), 
-                    errorCol.row(y).data,
-                    (int32_t*)(_tableauCol.row(y).data));
-        }
-    }
-    if (_params.verbosity > 1) cout << "    bottom" << endl;
-    // bottom-up _tableau init
-    for (int x = 0; x < _params.xMax; x++)
+    _costSum.setTo(0);
+    for (int dirIdx = 0; dirIdx < _params.pathCount; dirIdx++)
     {
-        auto _tableauCol = _tableauBottom(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        auto errorCol = _errorBuffer(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        int vLast = _params.yMax - 1;
-        copy(errorCol.row(vLast).data, 
-                errorCol.row(vLast).data + _params.dispMax, 
-                (int32_t*)(_tableauCol.row(vLast).data));
-        for (int y = _params.yMax - 2; y >= 0; y--)
-        {
-            if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
-            computeDynamicStep((int32_t*)(_tableauCol.row(y+1).data), 
-                    errorCol.row(y).data,
-                    (int32_t*)(_tableauCol.row(y).data));
-        }
+        if (_params.verbosity > 1) cout << "    direction " << directionArr[dirIdx][0] 
+                << " " << directionArr[dirIdx][1] << endl;
+        aggregatePaths(directionArr[dirIdx][0], directionArr[dirIdx][1]);
     }
-    
 }
 
 void EnhancedSgm::reconstructDisparity()
 {
     if (_params.verbosity > 0) cout << "EnhancedSgm::reconstructDisparity" << endl;
+    // the sum counts the pixel error once per path, half of it is removed as with 4 paths
+    const int errWeight = _params.pathCount / 2;
 //    int sizeAcc = 0;
 //    int sizeCount = 0;
     for (int y = 0; y < _params.yMax; y++)
     {
-        int32_t* dynRow1 = (int32_t*)(_tableauLeft.row(y).data);
-        int32_t* dynRow2 = (int32_t*)(_tableauRight.row(y).data);
-        int32_t* dynRow3 = (int32_t*)(_tableauTop.row(y).data);
-        int32_t* dynRow4 = (int32_t*)(_tableauBottom.row(y).data);
-        uint8_t* errRow = _errorBuffer.row(y).data;
-        uint8_t* skipRow = _skipBuffer.row(y).data;
+        uint16_t* sumRow = (uint16_t*)(_costSum.row(y).data);
+        uint8_t* errRow = _costVolume.error.row(y).data;
+        uint8_t* skipRow = _costVolume.skip.row(y).data;
         for (int x = 0; x < _params.xMax; x++)
         {
-            if ((_params.salientPoints and _salientBuffer(y, x) == 0) or *(skipRow + x))
+            if ((_params.salientPoints and _costVolume.salient(y, x) == 0) or *(skipRow + x))
             {
                 _smallDisparity(y, x) = -1;
                 continue;
@@ -608,8 +836,7 @@ void EnhancedSgm::reconstructDisparity()
                 const int & err = errRow[base + d];
                 if (_params.verbosity > 4) cout << setw(8) << err;
                 if (err > _params.maxError) continue;
-                int cost = dynRow1[base + d] + dynRow2[base + d] 
-                        + dynRow3[base + d] + dynRow4[base + d] - 2 * err;
+                int cost = sumRow[base + d] - errWeight * err;
                 
                 if ( bestCost > cost)
                 {
@@ -628,19 +855,17 @@ void EnhancedSgm::reconstructDisparity()
 void EnhancedSgm::reconstructDisparityMH()
 {
     if (_params.verbosity > 0) cout << "EnhancedSgm::reconstructDisparityMH" << endl;
+    const int errWeight = _params.pathCount / 2;
     const int hypShift = _params.xMax*_params.yMax;
 //    int sizeAcc = 0;
 //    int sizeCount = 0;
     for (int y = 0; y < _params.yMax; y++)
     {
-        int32_t* dynRow1 = (int32_t*)(_tableauLeft.row(y).data);
-        int32_t* dynRow2 = (int32_t*)(_tableauRight.row(y).data);
-        int32_t* dynRow3 = (int32_t*)(_tableauTop.row(y).data);
-        int32_t* dynRow4 = (int32_t*)(_tableauBottom.row(y).data);
-        uint8_t* errRow = _errorBuffer.row(y).data;
+        uint16_t* sumRow = (uint16_t*)(_costSum.row(y).data);
+        uint8_t* errRow = _costVolume.error.row(y).data;
         for (int x = 0; x < _params.xMax; x++)
         {
-            if (_params.salientPoints and _salientBuffer(y, x) == 0)
+            if (_params.salientPoints and _costVolume.salient(y, x) == 0)
             {
                 for (int hypIdx = 0; hypIdx < _params.hypMax; hypIdx++)
                 {
@@ -696,8 +921,7 @@ void EnhancedSgm::reconstructDisparityMH()
                     if (errRow[base + d] > _params.maxError) continue;
                     acc1 = acc2;
                     acc2 = acc3;
-                    acc3 = dynRow1[base + d] + dynRow2[base + d] 
-                            + dynRow3[base + d] + dynRow4[base + d] - 2*errRow[base + d];
+                    acc3 = sumRow[base + d] - errWeight * errRow[base + d];
                             
                     bool localMin = false;
                     if ( acc2 == -1) continue;
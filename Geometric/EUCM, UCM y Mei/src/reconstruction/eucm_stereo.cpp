@@ -17,6 +17,8 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "reconstruction/eucm_stereo.h"
 
+#include "utils/simd.h"
+
 StereoParameters::StereoParameters(const ptree & params) :
         ScaleParameters(params)
 {
@@ -70,17 +72,67 @@ void EnhancedStereo::setTransformation(const Transf & T12)
     _epipolarCurves.setTransformation(T12);
 }
 
-int computeError(int v, int thMin, int thMax)
+vector<int> compareDescriptor(const vector<uint8_t> & desc,
+        const vector<uint8_t> & sampleVec, int flawCost)
 {
-    return max(0, max(thMin - v, v - thMax));
+    DescriptorScratch scratch;
+    vector<int> costVec(sampleVec.size());
+    compareDescriptor(desc.data(), desc.size(), sampleVec.data(), sampleVec.size(),
+            flawCost, scratch, costVec.data());
+    return costVec;
 }
 
-vector<int> compareDescriptor(const vector<uint8_t> & desc,
-        const vector<uint8_t> & sampleVec, int flawCost)
+namespace
 {
-    vector<int> thMinVec(desc.size()), thMaxVec(desc.size());
+    // max(0, thMin - v, v - thMax), one of the terms is always zero
+    inline uint16_t thresholdError(uint16_t v, uint16_t thMin, uint16_t thMax)
+    {
+        return addSat(subSat(thMin, v), subSat(v, thMax));
+    }
+    
+    inline U16x8 thresholdError(U16x8 v, U16x8 thMin, U16x8 thMax)
+    {
+        return addSat(subSat(thMin, v), subSat(v, thMax));
+    }
     
-    for (int i = 1; i < desc.size() - 1; i++)
+    // min(rowA[j - 2] + flawCost, rowA[j - 1], rowA[j] + flawCost), for j >= 2
+    inline uint16_t forwardCost(const uint16_t * rowA, int j, uint16_t flawCost)
+    {
+        return min(min(addSat(rowA[j], flawCost), rowA[j - 1]), addSat(rowA[j - 2], flawCost));
+    }
+    
+    inline U16x8 forwardCost(const uint16_t * rowA, int j, U16x8 flawCost)
+    {
+        return minLanes(minLanes(addSat(U16x8::load(rowA + j), flawCost), U16x8::load(rowA + j - 1)),
+                addSat(U16x8::load(rowA + j - 2), flawCost));
+    }
+    
+    // min(rowA[j] + flawCost, rowA[j + 1], rowA[j + 2] + flawCost), for j < size - 2
+    inline uint16_t backwardCost(const uint16_t * rowA, int j, uint16_t flawCost)
+    {
+        return min(min(addSat(rowA[j], flawCost), rowA[j + 1]), addSat(rowA[j + 2], flawCost));
+    }
+    
+    inline U16x8 backwardCost(const uint16_t * rowA, int j, U16x8 flawCost)
+    {
+        return minLanes(minLanes(addSat(U16x8::load(rowA + j), flawCost), U16x8::load(rowA + j + 1)),
+                addSat(U16x8::load(rowA + j + 2), flawCost));
+    }
+}
+
+void compareDescriptor(const uint8_t * desc, int descLength,
+        const uint8_t * sampleVec, int sampleCount, int flawCost,
+        DescriptorScratch & scratch, int * costVec)
+{
+    assert(descLength >= 2 and sampleCount >= 3);
+    const int SIZE = U16x8::SIZE;
+    const int last = descLength - 1;
+    
+    scratch.thMinVec.resize(descLength);
+    scratch.thMaxVec.resize(descLength);
+    uint8_t * thMinVec = scratch.thMinVec.data();
+    uint8_t * thMaxVec = scratch.thMaxVec.data();
+    for (int i = 1; i < last; i++)
     {
         const int d = desc[i];
         int d1 = (desc[i] + desc[i - 1]) / 2;
@@ -100,121 +152,100 @@ vector<int> compareDescriptor(const vector<uint8_t> & desc,
         thMinVec[0] = desc[0];
     }
     
-    const int d = desc[desc.size() - 2];
-    if (desc.back() > d)
+    const int d = desc[last - 1];
+    if (desc[last] > d)
     {
-        thMinVec.back() = (desc.back() + d) / 2;
-        thMaxVec.back() = desc.back(); 
+        thMinVec[last] = (desc[last] + d) / 2;
+        thMaxVec[last] = desc[last]; 
     }
     else
     {
-        thMaxVec.back() = (desc.back() + d) / 2;
-        thMinVec.back() = desc.back();
+        thMaxVec[last] = (desc[last] + d) / 2;
+        thMinVec[last] = desc[last];
     }
     
+    const int HALF_LENGTH = descLength / 2;
+    scratch.rowA.resize(sampleCount);
+    scratch.rowB.resize(sampleCount);
+    scratch.rowC.resize(sampleCount);
+    uint16_t * rowA = scratch.rowA.data();
+    uint16_t * rowB = scratch.rowB.data();
+    uint16_t * rowC = scratch.rowC.data();
+    const uint16_t flaw = min(max(flawCost, 0), int(UINT16_MAX));
+    const U16x8 flawVec = U16x8::broadcast(flaw);
     
-    const int HALF_LENGTH = desc.size() / 2;
-    vector<int> rowA(sampleVec.size()), rowB(sampleVec.size());
-    /////////////////////////////////////////////////////////////////
-    /*
-    //match the first half
-    for (int i = 0; i < sampleVec.size(); i++)
-    {
-        rowA[i] = abs(int(sampleVec[i]) - int(desc[0]));
-    }
-    for (int i = 1; i <= HALF_LENGTH; i++)
+    // the first row of a half
+    auto initRow = [&](uint16_t * row, int descIdx)
     {
-        rowB[0] = rowA[0] + flawCost + abs(int(sampleVec[0]) - int(desc[i]));
-        int cost = min(rowA[1] + flawCost, rowA[0]);
-        rowB[1] = cost + abs(int(sampleVec[1]) - int(desc[i]));
-        for (int j = 2; j < sampleVec.size(); j++)
+        const U16x8 thMin = U16x8::broadcast(thMinVec[descIdx]);
+        const U16x8 thMax = U16x8::broadcast(thMaxVec[descIdx]);
+        int j = 0;
+        for (; j + SIZE <= sampleCount; j += SIZE)
         {
-            cost = min(min(rowA[j] + flawCost, rowA[j - 1]), rowA[j - 2] + flawCost);
-            rowB[j] = cost + abs(int(sampleVec[j]) - int(desc[i]));
+            thresholdError(U16x8::load(sampleVec + j), thMin, thMax).store(row + j);
         }
-        swap(rowA, rowB);
-    }
-    vector<int> rowC(sampleVec.size()); //center cost
-    swap(rowA, rowC);
-    
-    //match the second half (from the last pixel to first)
-    for (int i = 0; i < sampleVec.size(); i++)
-    {
-        rowA[i] = abs(sampleVec[i] - desc.back());
-    }
-    for (int i = desc.size() - 2; i > HALF_LENGTH; i--)
-    {
-        for (int j = 0; j < sampleVec.size() - 2; j++)
+        for (; j < sampleCount; j++)
         {
-            int cost = min(min(rowA[j] + flawCost, rowA[j + 1]), rowA[j + 2] + flawCost);
-            rowB[j] = cost + abs(int(sampleVec[j]) - int(desc[i]));
+            row[j] = thresholdError(sampleVec[j], thMinVec[descIdx], thMaxVec[descIdx]);
         }
-        int j = sampleVec.size() - 2;
-        int cost = min(rowA[j] + flawCost, rowA[j + 1]);
-        rowB[j] = cost + abs(int(sampleVec[j]) - int(desc[i]));
-        rowB.back() = rowA.back() + flawCost + abs(int(sampleVec.back()) - int(desc[i]));
-        swap(rowA, rowB);
-    }
-    */
-    ////////////////////////////////////////////////////////////////////////////////
+    };
     
-        //match the first half
-    for (int i = 0; i < sampleVec.size(); i++)
-    {
-//        rowA[i] = abs(int(sampleVec[i]) - int(desc[0]));
-        rowA[i] = computeError(sampleVec[i], thMinVec[0], thMaxVec[0]);
-    }
+    //match the first half
+    initRow(rowA, 0);
     for (int i = 1; i <= HALF_LENGTH; i++)
     {
-//        rowB[0] = rowA[0] + flawCost + abs(int(sampleVec[0]) - int(desc[i]));
-        rowB[0] = rowA[0] + flawCost + computeError(sampleVec[0], thMinVec[i], thMaxVec[i]);
-        int cost = min(rowA[1] + flawCost, rowA[0]);
-//        rowB[1] = cost + abs(int(sampleVec[1]) - int(desc[i]));
-        rowB[1] = cost + computeError(sampleVec[1], thMinVec[i], thMaxVec[i]);
-        for (int j = 2; j < sampleVec.size(); j++)
+        const uint16_t thMin = thMinVec[i], thMax = thMaxVec[i];
+        const U16x8 thMinLanes = U16x8::broadcast(thMin);
+        const U16x8 thMaxLanes = U16x8::broadcast(thMax);
+        rowB[0] = addSat(addSat(rowA[0], flaw), thresholdError(sampleVec[0], thMin, thMax));
+        rowB[1] = addSat(min(addSat(rowA[1], flaw), rowA[0]), 
+                thresholdError(sampleVec[1], thMin, thMax));
+        int j = 2;
+        for (; j + SIZE <= sampleCount; j += SIZE)
         {
-            cost = min(min(rowA[j] + flawCost, rowA[j - 1]), rowA[j - 2] + flawCost);
-//            rowB[j] = cost + abs(int(sampleVec[j]) - int(desc[i]));
-            rowB[j] = cost + computeError(sampleVec[j], thMinVec[i], thMaxVec[i]);
+            addSat(forwardCost(rowA, j, flawVec), 
+                    thresholdError(U16x8::load(sampleVec + j), thMinLanes, thMaxLanes)).store(rowB + j);
         }
-        swap(rowA, rowB);
+        for (; j < sampleCount; j++)
+        {
+            rowB[j] = addSat(forwardCost(rowA, j, flaw), thresholdError(sampleVec[j], thMin, thMax));
+        }
+        std::swap(rowA, rowB);
     }
-    vector<int> rowC(sampleVec.size()); //center cost
-    swap(rowA, rowC);
+    std::swap(rowA, rowC); //center cost
     
     //match the second half (from the last pixel to first)
-    for (int i = 0; i < sampleVec.size(); i++)
-    {
-//        rowA[i] = abs(sampleVec[i] - desc.back());
-        rowA[i] = computeError(sampleVec[i], thMinVec.back(), thMaxVec.back());
-    }
-    for (int i = desc.size() - 2; i > HALF_LENGTH; i--)
+    const int n = sampleCount;
+    initRow(rowA, last);
+    for (int i = last - 1; i > HALF_LENGTH; i--)
     {
-        for (int j = 0; j < sampleVec.size() - 2; j++)
+        const uint16_t thMin = thMinVec[i], thMax = thMaxVec[i];
+        const U16x8 thMinLanes = U16x8::broadcast(thMin);
+        const U16x8 thMaxLanes = U16x8::broadcast(thMax);
+        int j = 0;
+        // the lanes read rowA[j + SIZE + 1]
+        for (; j + SIZE + 2 <= n; j += SIZE)
+        {
+            addSat(backwardCost(rowA, j, flawVec), 
+                    thresholdError(U16x8::load(sampleVec + j), thMinLanes, thMaxLanes)).store(rowB + j);
+        }
+        for (; j < n - 2; j++)
         {
-            int cost = min(min(rowA[j] + flawCost, rowA[j + 1]), rowA[j + 2] + flawCost);
-//            rowB[j] = cost + abs(int(sampleVec[j]) - int(desc[i]));
-            rowB[j] = cost + computeError(sampleVec[j], thMinVec[i], thMaxVec[i]);
+            rowB[j] = addSat(backwardCost(rowA, j, flaw), thresholdError(sampleVec[j], thMin, thMax));
         }
-        int j = sampleVec.size() - 2;
-        int cost = min(rowA[j] + flawCost, rowA[j + 1]);
-//        rowB[j] = cost + abs(int(sampleVec[j]) - int(desc[i]));
-        rowB[j] = cost + computeError(sampleVec[j], thMinVec[i], thMaxVec[i]);
-        
-//        rowB.back() = rowA.back() + flawCost + abs(int(sampleVec.back()) - int(desc[i]));
-        rowB.back() = rowA.back() + flawCost + computeError(sampleVec.back(), thMinVec[i], thMaxVec[i]);
-        swap(rowA, rowB);
+        rowB[n - 2] = addSat(min(addSat(rowA[n - 2], flaw), rowA[n - 1]), 
+                thresholdError(sampleVec[n - 2], thMin, thMax));
+        rowB[n - 1] = addSat(addSat(rowA[n - 1], flaw), thresholdError(sampleVec[n - 1], thMin, thMax));
+        std::swap(rowA, rowB);
     }
     
     //accumulate the cost
-    for (int i = 0; i < sampleVec.size() - 2; i++)
+    for (int j = 0; j < n - 2; j++)
     {
-        rowC[i] += min(min(rowA[i] + flawCost, rowA[i + 1]), rowA[i + 2] + flawCost);
+        costVec[j] = rowC[j] + backwardCost(rowA, j, flaw);
     }
-    int i = rowC.size() - 2;
-    rowC[i] += min(rowA[i] + flawCost, rowA[i + 1]);
-    rowC.back() += rowA.back() + flawCost;
-    return rowC;
+    costVec[n - 2] = rowC[n - 2] + min(addSat(rowA[n - 2], flaw), rowA[n - 1]);
+    costVec[n - 1] = rowC[n - 1] + addSat(rowA[n - 1], flaw);
 } 
 
 
@@ -44,13 +44,15 @@ bool Plane::intersection(const Vector3d & pos, const Vector3d & dir,
     
     double lambdaNum = _ez.dot(_t - pos);
     double lambdaDen = _ez.dot(dir);
+    const double dirNorm = dir.norm();
     
-    if (lambdaDen * lambdaNum < 0.01) //TODO condition to rewise, perhaps define the literal elswhere
+    // the grazing and backward rays are discarded whatever the length of dir
+    if (lambdaDen * lambdaNum < 0.01 * dirNorm) //TODO condition to rewise, perhaps define the literal elswhere
     {
         return false;
     }
     double lambda = lambdaNum / lambdaDen; 
-    depth = lambda * dir.norm();
+    depth = lambda * dirNorm;
     Vector3d pt = dir * lambda + pos - _t;
     uv[0] = _u0 + _fu * _ex.dot(pt);
     uv[1] = _v0 + _fv * _ey.dot(pt);
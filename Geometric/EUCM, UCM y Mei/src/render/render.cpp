@@ -75,6 +75,10 @@ void RenderDevice::setCamera(const ICamera * camera)
         delete _camera;
     }
     _camera = camera->clone(); //TODO check the size and reinit the buffers
+    ScaleParameters params;
+    params.uMax = params.xMax = _width;
+    params.vMax = params.yMax = _height;
+    _bearingTable = BearingTable::get(_camera, params);
 }
 
 void RenderDevice::render(Mat8u & dst)
@@ -88,13 +92,13 @@ void RenderDevice::fillBuffers()
     _idxMat.setTo(-1);
     _depthMat.setTo(1e6);
     Matrix3d R = _xiCam.rotMat();
+    const BearingTable & bearingVec = *_bearingTable;
     for (int v = 0; v < _height; v++)
     {
         for (int u = 0; u < _width; u++)
         {
-            Vector3d dir;
-            if (not  _camera->reconstructPoint(Vector2d(u, v), dir) ) continue;
-            dir = R * dir;
+            if (not bearingVec.valid(u + v*_width)) continue;
+            const Vector3d dir = R * bearingVec(u, v);
             for (int idx = 0; idx < _objectVec.size(); idx++)
             {
                 Vector2d uv; //texture coordinates
@@ -0,0 +1,221 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Wall time and final cost of the global calibration solve for several solver settings.
+A synthetic problem shaped as calib_example.json (Mei camera, 8x6 board, one pose per image)
+is written to outDir as an ir_data calibration and solved from the same initial values
+*/
+
+#include <thread>
+
+#include "std.h"
+#include "io.h"
+#include "eigen.h"
+#include "json.h"
+#include "timer.h"
+
+#include "geometry/geometry.h"
+#include "projection/mei.h"
+#include "calibration/unified_calibration.h"
+
+ptree arrayNode(const vector<double> & valVec)
+{
+    ptree node;
+    for (auto & val : valVec)
+    {
+        ptree item;
+        item.put("", val);
+        node.push_back(make_pair("", item));
+    }
+    return node;
+}
+
+//writes the calibration file and the corner file, returns the name of the former
+string writeProblem(const string & outDir, int imageCount)
+{
+    const int ROWS = 8, COLS = 6;
+    const double SQUARE_SIZE = 0.03;
+    const int WIDTH = 1280, HEIGHT = 960;
+    const array<double, 10> trueParams{0.9, -0.1, 0.02, 0, 1e-3, -1e-3, 300, 300, 640, 480};
+    MeiCamera camera(trueParams.data());
+
+    Vector3dVec board;
+    ptree pointsNode;
+    for (int i = 0; i < ROWS; i++)
+    {
+        for (int j = 0; j < COLS; j++)
+        {
+            board.emplace_back(SQUARE_SIZE * j, SQUARE_SIZE * i, 0);
+            pointsNode.push_back(make_pair("", arrayNode({SQUARE_SIZE * j, SQUARE_SIZE * i, 0})));
+        }
+    }
+
+    //random board poses in front of the camera, corner noise of 0.3 px
+    mt19937 gen(0);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    std::normal_distribution<double> noise(0, 0.3);
+    ptree cornerFile;
+    int poseCount = 0;
+    while (poseCount < imageCount)
+    {
+        Transf xi(0.4 * uniform(gen) - 0.1, 0.3 * uniform(gen) - 0.1, 0.4 + 0.15 * uniform(gen),
+                  0.5 * uniform(gen), 0.5 * uniform(gen), 0.5 * uniform(gen));
+        Vector3dVec boardCam;
+        xi.transform(board, boardCam);
+        ptree cornersNode;
+        bool visible = true;
+        for (auto & X : boardCam)
+        {
+            Vector2d pt;
+            if (not camera.projectPoint(X, pt) or pt[0] < 0 or pt[0] >= WIDTH 
+                or pt[1] < 0 or pt[1] >= HEIGHT)
+            {
+                visible = false;
+                break;
+            }
+            cornersNode.push_back(make_pair("", arrayNode({pt[0] + noise(gen), pt[1] + noise(gen)})));
+        }
+        if (not visible) continue;
+        ptree observation;
+        observation.put("camera", "camera1");
+        observation.add_child("points", cornersNode);
+        ptree imageNode;
+        imageNode.push_back(make_pair("", observation));
+        cornerFile.push_back(make_pair("", imageNode));
+        poseCount++;
+    }
+    const string cornerFileName = outDir + "/calib_bench_corners.json";
+    write_json(cornerFileName, cornerFile);
+
+    ptree transformNode;
+    transformNode.put("name", "xiCamBoard");
+    transformNode.put("global", false);
+    transformNode.put("constant", false);
+    transformNode.put("prior", false);
+    ptree transformations;
+    transformations.push_back(make_pair("", transformNode));
+
+    ptree cameraNode;
+    cameraNode.put("name", "camera1");
+    cameraNode.put("type", "mei");
+    cameraNode.put("constant", false);
+    cameraNode.add_child("value", arrayNode({0.5, 0, 0, 0, 0, 0, 280, 280, 630, 470}));
+    ptree cameras;
+    cameras.push_back(make_pair("", cameraNode));
+
+    ptree chainNode;
+    chainNode.put("name", "xiCamBoard");
+    chainNode.put("direct", true);
+    ptree chain;
+    chain.push_back(make_pair("", chainNode));
+
+    ptree dataNode;
+    dataNode.put("type", "ir_data");
+    dataNode.put("camera", "camera1");
+    dataNode.add_child("transform_chain", chain);
+    dataNode.put("init", "xiCamBoard");
+    dataNode.put("object.corner_ul", 0);
+    dataNode.put("object.corner_ur", COLS - 1);
+    dataNode.put("object.corner_bl", COLS * (ROWS - 1));
+    dataNode.put("object.corner_br", COLS * ROWS - 1);
+    dataNode.add_child("object.points", pointsNode);
+    dataNode.put("parameters", "");
+    dataNode.put("image_width", WIDTH);
+    dataNode.put("image_height", HEIGHT);
+    dataNode.put("data_file", cornerFileName);
+    ptree data;
+    data.push_back(make_pair("", dataNode));
+
+    ptree root;
+    root.add_child("transformations", transformations);
+    root.add_child("cameras", cameras);
+    root.add_child("data", data);
+    const string fileName = outDir + "/calib_bench.json";
+    write_json(fileName, root);
+    return fileName;
+}
+
+void benchmark(const string & fileName, const string & outDir, const CalibrationSolverSettings & settings)
+{
+    GenericCameraCalibration calibration;
+    calibration.addResiduals(fileName);
+    calibration.setQuiet(true);
+    calibration.setOutputPrefix(outDir + "/calib_bench_");
+    calibration.setSolverSettings(settings);
+
+    Timer timer;
+    const bool converged = calibration.compute();
+    const double solveTime = timer.elapsed();
+    vector<vector<double>> rmsVec;
+    const double rpe = calibration.computeReprojectionError(rmsVec);
+    const Solver::Summary & summary = calibration.getSolverSummary();
+
+    cout << setw(24) << settings.linearSolver << setw(16) << settings.preconditioner
+         << setw(8) << settings.threadCount;
+    if (converged)
+    {
+        cout << setw(12) << solveTime << setw(14) << summary.final_cost
+             << setw(8) << summary.iterations.size() << setw(10) << rpe << endl;
+    }
+    else
+    {
+        cout << "  FAILED : " << summary.message << endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const string outDir = (argc >= 2) ? argv[1] : ".";
+    const int imageCount = (argc >= 3) ? std::stoi(argv[2]) : 100;
+    const string fileName = writeProblem(outDir, imageCount);
+
+    const int coreCount = max(int(std::thread::hardware_concurrency()), 1);
+    
+    //what compute() used before the settings existed: the Ceres defaults, one thread
+    CalibrationSolverSettings previous;
+    previous.linearSolver = ceres::LinearSolverTypeToString(Solver::Options().linear_solver_type);
+    previous.threadCount = 1;
+
+    vector<CalibrationSolverSettings> settingsVec{previous};
+    for (string linearSolver : {"DENSE_SCHUR", "SPARSE_SCHUR"})
+    {
+        for (int threadCount : {1, coreCount})
+        {
+            CalibrationSolverSettings settings;
+            settings.linearSolver = linearSolver;
+            settings.threadCount = threadCount;
+            settingsVec.push_back(settings);
+        }
+    }
+    CalibrationSolverSettings iterative;
+    iterative.linearSolver = "ITERATIVE_SCHUR";
+    iterative.preconditioner = "SCHUR_JACOBI";
+    iterative.threadCount = coreCount;
+    settingsVec.push_back(iterative);
+
+    cout << imageCount << " images" << endl;
+    cout << setw(24) << "linear solver" << setw(16) << "preconditioner" << setw(8) << "threads"
+         << setw(12) << "time, s" << setw(14) << "final cost" << setw(8) << "iter" 
+         << setw(10) << "RPE, px" << endl;
+    for (auto & settings : settingsVec)
+    {
+        benchmark(fileName, outDir, settings);
+    }
+    return 0;
+}
+
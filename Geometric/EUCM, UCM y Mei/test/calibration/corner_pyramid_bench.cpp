@@ -0,0 +1,104 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Pyramid mode of CornerDetector vs the full-resolution detector on 12 MP frames.
+The frames are synthetic boards seen through random homographies;
+the corners are compared with the full-resolution detection and with the ground truth
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "calibration/corner_detector.h"
+
+#include "synthetic_board.h"
+
+const int NX = 8;
+const int NY = 6;
+const int SQUARE = 120;
+const int MARGIN = 120;
+const int WIDTH = 4000;
+const int HEIGHT = 3000;
+const ViewParameters VIEW_PARAMS{Size(WIDTH, HEIGHT), 1.5, 2.5, 1e-4};
+
+struct ModeStats
+{
+    int detectedCount = 0;
+    double time = 0;
+    double error = 0; // against the ground truth
+    double difference = 0; // the largest distance to the full-resolution corner
+};
+
+int main(int argc, char** argv)
+{
+    const int imageCount = (argc >= 2) ? std::stoi(argv[1]) : 5;
+    const int maxLevels = (argc >= 3) ? std::stoi(argv[2]) : 3;
+
+    mt19937 gen(0);
+    Vector2dVec boardCornerVec;
+    const Mat8u board = drawBoard(NX, NY, SQUARE, MARGIN, boardCornerVec);
+
+    //index 0 is the full resolution
+    vector<ModeStats> statsVec(maxLevels + 1);
+    CornerDetector detector(NX, NY, 3, true);
+    for (int i = 0; i < imageCount; i++)
+    {
+        Vector2dVec truthVec;
+        const Mat8u view = generateView(board, boardCornerVec, VIEW_PARAMS, gen, truthVec);
+
+        Vector2dVec fullVec;
+        for (int levels = 0; levels <= maxLevels; levels++)
+        {
+            ModeStats & stats = statsVec[levels];
+            Vector2dVec cornerVec;
+            detector.setPyramidLevels(levels);
+            Timer timer;
+            detector.setImage(view);
+            const bool detected = detector.detectPattern(cornerVec);
+            stats.time += timer.elapsed();
+            if (not detected) continue;
+            stats.detectedCount++;
+            stats.error += meanError(cornerVec, truthVec);
+            if (levels == 0) fullVec = cornerVec;
+            else if (fullVec.size() == cornerVec.size())
+            {
+                for (int j = 0; j < cornerVec.size(); j++)
+                {
+                    stats.difference = max(stats.difference, (cornerVec[j] - fullVec[j]).norm());
+                }
+            }
+        }
+    }
+
+    cout << imageCount << " frames of " << WIDTH << " x " << HEIGHT << ", "
+         << NX << " x " << NY << " corners" << endl;
+    cout << "levels   detected   ms per image   mean error px   max diff to full px" << endl;
+    for (int levels = 0; levels <= maxLevels; levels++)
+    {
+        const ModeStats & stats = statsVec[levels];
+        cout << setw(6) << levels
+             << setw(11) << stats.detectedCount
+             << setw(15) << 1e3 * stats.time / imageCount
+             << setw(16) << (stats.detectedCount ? stats.error / stats.detectedCount : 0.)
+             << setw(22) << stats.difference << endl;
+    }
+    return 0;
+}
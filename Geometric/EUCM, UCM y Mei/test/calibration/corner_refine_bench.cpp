@@ -0,0 +1,137 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Sub-pixel corner refinement time per image: the former refinement with a new problem
+for every corner vs the reused problem, in the calling thread only and with a thread pool.
+The images are synthetic boards seen through random homographies,
+so that the refined corners can be compared with the ground truth
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "utils/thread_pool.h"
+#include "calibration/corner_detector.h"
+
+#include "synthetic_board.h"
+
+const int NX = 8;
+const int NY = 6;
+const int SQUARE = 40;
+const int MARGIN = 40;
+const ViewParameters VIEW_PARAMS{Size(1280, 960), 1.2, 1.8, 4e-4};
+
+//the former refinement: a new problem for every corner
+void referenceImproveCorners(CornerDetector & detector, Vector2dVec & pointVec)
+{
+    vector<double> radVec;
+    for (int i = 0; i < pointVec.size(); i++)
+    {
+        //get the maximum radius
+        double radMax = 7;
+        if (i > NX) radMax = min( radMax, (pointVec[i] - pointVec[i - NX]).norm()*0.7 );
+        else radMax = min( radMax, (pointVec[i] - pointVec[i + NX]).norm()*0.7 );
+        if (i > 0) radMax = min( radMax, (pointVec[i] - pointVec[i - 1]).norm()*0.7 );
+        else radMax = min( radMax, (pointVec[i] - pointVec[i + 1]).norm()*0.7 );
+        radVec.push_back(radMax);
+    }
+    for (int i = 0; i < pointVec.size(); i++)
+    {
+        Vector2d x = pointVec[i];
+        array<double, 5> dataArr;
+        detector.initPoin(round(x), dataArr.data());
+        ceres::GradientProblem problem(new SubpixelCorner(detector.getGradX(), detector.getGradY(),
+                x, 7, radVec[i]));
+        ceres::GradientProblemSolver::Options options;
+        options.logging_type = ceres::SILENT;
+        options.minimizer_progress_to_stdout = true;
+        ceres::GradientProblemSolver::Summary summary;
+        ceres::Solve(options, problem, dataArr.data(), &summary);
+        pointVec[i][0] = dataArr[0];
+        pointVec[i][1] = dataArr[1];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int imageCount = (argc >= 2) ? std::stoi(argv[1]) : 20;
+    const int threadCount = (argc >= 3) ? std::stoi(argv[2]) : 0;
+
+    mt19937 gen(0);
+    Vector2dVec boardCornerVec;
+    const Mat8u board = drawBoard(NX, NY, SQUARE, MARGIN, boardCornerVec);
+
+    ThreadPool threadPool(threadCount);
+    CornerDetector detector(NX, NY, 3, false);
+    double referenceTime = 0, serialTime = 0, parallelTime = 0, rawError = 0, refinedError = 0;
+    int detectedCount = 0;
+    bool identical = true;
+    for (int i = 0; i < imageCount; i++)
+    {
+        Vector2dVec truthVec;
+        const Mat8u view = generateView(board, boardCornerVec, VIEW_PARAMS, gen, truthVec);
+
+        //detection without the refinement, it leaves the gradients in the detector
+        Vector2dVec rawVec;
+        detector.setImage(view);
+        if (not detector.detectPattern(rawVec)) continue;
+        detectedCount++;
+
+        Vector2dVec referenceVec = rawVec;
+        Timer timer;
+        referenceImproveCorners(detector, referenceVec);
+        referenceTime += timer.elapsed();
+
+        Vector2dVec serialVec = rawVec;
+        detector.setThreadPool(NULL);
+        timer.reset();
+        detector.improveCorners(serialVec);
+        serialTime += timer.elapsed();
+
+        Vector2dVec parallelVec = rawVec;
+        detector.setThreadPool(&threadPool);
+        timer.reset();
+        detector.improveCorners(parallelVec);
+        parallelTime += timer.elapsed();
+
+        if (serialVec != referenceVec or parallelVec != referenceVec) identical = false;
+        rawError += meanError(rawVec, truthVec);
+        refinedError += meanError(parallelVec, truthVec);
+    }
+
+    if (detectedCount == 0)
+    {
+        std::cerr << "ERROR: the board has not been detected" << endl;
+        return 1;
+    }
+    cout << "images      : " << detectedCount << " of " << imageCount << " detected, "
+         << NX * NY << " corners each" << endl;
+    cout << "threads     : " << threadPool.size() << endl;
+    cout << "former      : " << 1e3 * referenceTime / detectedCount << " ms per image" << endl;
+    cout << "serial      : " << 1e3 * serialTime / detectedCount << " ms per image" << endl;
+    cout << "parallel    : " << 1e3 * parallelTime / detectedCount << " ms per image" << endl;
+    cout << "speedup     : " << referenceTime / serialTime << " serial, "
+         << referenceTime / parallelTime << " parallel" << endl;
+    cout << "mean error  : " << rawError / detectedCount << " px raw, "
+         << refinedError / detectedCount << " px refined" << endl;
+    cout << "results     : " << (identical ? "identical" : "DIFFER") << endl;
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+CornerDetector::computeResponse on 5 MP fisheye frames:
+the scalar double-precision loop vs the SIMD kernel, one scale at a time vs the fused scales,
+with and without a thread pool.
+The frames are given on the command line or rendered with an EUCM camera
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "utils/thread_pool.h"
+#include "projection/eucm.h"
+#include "calibration/corner_detector.h"
+
+const double SIGMA_1 = 0.7;
+const vector<double> SIGMA_VEC = {1.4, 2, 1};
+
+//a board on the plane z = 1 seen by a fisheye camera
+Mat8u renderFrame()
+{
+    const int width = 2592, height = 1944;
+    const array<double, 6> params{0.6, 1.1, 700, 700, width / 2., height / 2.};
+    EnhancedCamera camera(params.data());
+    Mat8u frame(height, width);
+    for (int v = 0; v < height; v++)
+    {
+        for (int u = 0; u < width; u++)
+        {
+            Vector3d X;
+            if (not camera.reconstructPoint(Vector2d(u, v), X) or X[2] <= 0)
+            {
+                frame(v, u) = 0;
+                continue;
+            }
+            const int i = floor(X[0] / X[2] / 0.2), j = floor(X[1] / X[2] / 0.2);
+            frame(v, u) = ((i + j) % 2) ? 40 : 215;
+        }
+    }
+    GaussianBlur(frame, frame, Size(5, 5), 1, 1);
+    Mat16s noisy(frame.size());
+    randn(noisy, 0, 3);
+    cv::add(noisy, frame, noisy, cv::noArray(), CV_16S);
+    noisy.convertTo(frame, CV_8U);
+    return frame;
+}
+
+//the former scalar implementation, writes the same maps
+void referenceResponse(const Mat8u & img, const double SIGMA_2, Mat32f & resp)
+{
+    Mat8u src1, src2;
+    GaussianBlur(img, src1, Size(3, 3), SIGMA_1, SIGMA_1);
+    const int FILTER_SIZE_2 = 1 + 2 * ceil(SIGMA_2);
+    GaussianBlur(img, src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), SIGMA_2, SIGMA_2);
+    Mat32f gradx(img.size()), grady(img.size()), imgrad(img.size());
+    resp.create(img.size());
+    resp.setTo(0);
+    imgrad.setTo(0);
+    for (int v = 1; v < img.rows - 1; v++)
+    {
+        for (int u = 1; u < img.cols - 1; u++)
+        {
+            double gxSharp = ( src1(v, u + 1) - src1(v, u - 1)
+                    - 0.3*(src2(v, u + 1) - src2(v, u - 1)) ) / 2.;
+            double gySharp = ( src1(v + 1, u) - src1(v - 1, u)
+                    - 0.3*(src2(v + 1, u) - src2(v - 1, u)) ) / 2.;
+            gradx(v, u) = gxSharp * 0.01;
+            grady(v, u) = gySharp * 0.01;
+            imgrad(v, u) = sqrt(gxSharp*gxSharp + gySharp*gySharp) * 0.01;
+            double iuu = src2(v, u - 1) + src2(v, u + 1) - 2* src2(v, u);
+            double ivv = src2(v - 1, u) + src2(v + 1, u) - 2* src2(v, u);
+            double iuv = (src2(v - 1, u - 1) + src2(v + 1, u + 1)
+                    - src2(v + 1, u - 1) - src2(v - 1, u + 1)) / 4.;
+            double gx = (src2(v, u + 1) - src2(v, u - 1) ) / 2.;
+            double gy = (src2(v + 1, u) - src2(v - 1, u) ) / 2.;
+            double gsq = gx * gx + gy * gy;
+            double respVal = -iuu * ivv + iuv * iuv - 0.001*pow(gsq, 2);
+            if (respVal > 0.01) resp(v, u) = respVal;
+        }
+    }
+}
+
+//relative to the response magnitude, the kernel runs in single precision
+double maxDifference(const Mat32f & a, const Mat32f & b)
+{
+    double res = 0;
+    for (int v = 0; v < a.rows; v++)
+    {
+        for (int u = 0; u < a.cols; u++)
+        {
+            res = max(res, abs(double(a(v, u)) - b(v, u)) / max(1., abs(double(b(v, u)))));
+        }
+    }
+    return res;
+}
+
+template<typename Func>
+double measure(Func func, int repetitions)
+{
+    Timer timer;
+    for (int i = 0; i < repetitions; i++) func();
+    return timer.elapsed() / repetitions;
+}
+
+int main(int argc, char** argv)
+{
+    vector<Mat8u> frameVec;
+    for (int i = 1; i < argc; i++)
+    {
+        Mat8u frame = imread(argv[i], 0);
+        if (frame.empty())
+        {
+            std::cerr << "ERROR: cannot read " << argv[i] << endl;
+            return 1;
+        }
+        frameVec.push_back(frame);
+    }
+    if (frameVec.empty()) frameVec.push_back(renderFrame());
+    const int repetitions = 3;
+
+    ThreadPool threadPool;
+    CornerDetector detector(8, 6);
+    double tReference = 0, tSeparate = 0, tFused = 0, tFusedPool = 0, difference = 0;
+    for (auto & frame : frameVec)
+    {
+        detector.setImage(frame);
+        vector<Mat32f> referenceVec(SIGMA_VEC.size());
+        tReference += measure([&]()
+        {
+            for (int k = 0; k < SIGMA_VEC.size(); k++)
+            {
+                referenceResponse(frame, SIGMA_VEC[k], referenceVec[k]);
+            }
+        }, repetitions);
+
+        detector.setThreadPool(NULL);
+        tSeparate += measure([&]()
+        {
+            for (double sigma : SIGMA_VEC) detector.computeResponse(SIGMA_1, sigma);
+        }, repetitions);
+        tFused += measure([&]() { detector.computeResponses(SIGMA_1, SIGMA_VEC); }, repetitions);
+
+        detector.setThreadPool(&threadPool);
+        tFusedPool += measure([&]() { detector.computeResponses(SIGMA_1, SIGMA_VEC); }, repetitions);
+
+        for (int k = 0; k < SIGMA_VEC.size(); k++)
+        {
+            detector.useResponse(k);
+            difference = max(difference, maxDifference(detector.getResponse(), referenceVec[k]));
+        }
+    }
+
+    const int frameCount = frameVec.size();
+    cout << "frames             : " << frameCount << " of "
+         << frameVec[0].cols << " x " << frameVec[0].rows << endl;
+    cout << "times per frame, " << SIGMA_VEC.size() << " scales:" << endl;
+    cout << "scalar reference   : " << 1e3 * tReference / frameCount << " ms" << endl;
+    cout << "SIMD, separate     : " << 1e3 * tSeparate / frameCount << " ms" << endl;
+    cout << "SIMD, fused        : " << 1e3 * tFused / frameCount << " ms" << endl;
+    cout << "SIMD, fused, " << setw(2) << threadPool.size() << " th : "
+         << 1e3 * tFusedPool / frameCount << " ms" << endl;
+    //a response right at the threshold may be kept by one and dropped by the other
+    cout << "max difference     : " << difference << endl;
+    return 0;
+}
@@ -31,6 +31,17 @@ using boost::property_tree::read_json;
 
 int main(int argc, char** argv) {
     
+    //a "sweep" node in the first file calibrates the data with several models
+    ptree root;
+    if (argc > 1) read_json(argv[1], root);
+    if (root.count("sweep"))
+    {
+        const vector<string> infoFileVec(argv + 1, argv + argc);
+        calibrationSweep(infoFileVec, readVector<string>(root.get_child("sweep.models")),
+                root.get<int>("sweep.thread_count", 0)).print();
+        return 0;
+    }
+    
     GenericCameraCalibration calibration;
     
     for (int i = 1; i < argc; i++)
@@ -21,42 +21,7 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "json.h"
 
 #include "geometry/geometry.h"
-#include "projection/pinhole.h"
-#include "projection/eucm.h"
-
-void initRemap(const vector<double> & params1, const vector<double> & params2,
-    Mat32f & mapX, Mat32f & mapY, const Transf & T)
-{
-    assert(params1.size() == 6);
-    assert(params2.size() == 5);
-    EnhancedCamera cam1(params1.data());
-    Pinhole cam2(params2[2], params2[3], params2[4]);
-    Vector2dVec imagePoints;
-    mapX.create(params2[1], params2[0]);
-    mapY.create(params2[1], params2[0]);
-    for (unsigned int i = 0; i < mapX.rows; i++)
-    {
-        for (unsigned int j = 0; j < mapX.cols; j++)
-        {
-            imagePoints.push_back(Vector2d(j, i));
-        }
-    }
-    Vector3dVec pointCloud;
-    cam2.reconstructPointCloud(imagePoints, pointCloud);
-    T.transform(pointCloud, pointCloud);
-    cam1.projectPointCloud(pointCloud, imagePoints);
-    
-    auto pointIter = imagePoints.begin();
-    for (unsigned int i = 0; i < mapX.rows; i++)
-    {
-        for (unsigned int j = 0; j < mapX.cols; j++)
-        {
-            mapX(i, j) = (*pointIter)[0];
-            mapY(i, j) = (*pointIter)[1];
-            ++pointIter;
-        }
-    }
-}
+#include "calibration/rectification.h"
 
 int main(int argc, char** argv) {
 
@@ -69,17 +34,29 @@ int main(int argc, char** argv) {
     vector<double> paramsPinhole = readVector<double>(root.get_child("pinhole_params"));
     Transf xi = readTransform(root.get_child("xi_eucm_pinhole"));
       
-    Mat32f  mapX, mapY;
-    initRemap(paramsEucm, paramsPinhole, mapX, mapY, xi);
+    //the map is cached on disk, set "map_cache" to "" to disable it
+    RectificationMap rectMap;
+    getRectificationMap(paramsEucm, paramsPinhole, xi, root.get<string>("map_cache", "."), rectMap);
     
-    int count = 0;
+    vector<string> inputVec, outputVec;
     for (auto & x : root.get_child("image_names"))
     {
-        Mat32f img = imread(x.second.get_value<string>(), 0);
-        Mat32f img2;
-        remap(img, img2, mapX, mapY, cv::INTER_LINEAR);
-        imwrite("img_" + to_string(count++) + ".png", img2);
+        outputVec.push_back("img_" + to_string(inputVec.size()) + ".png");
+        inputVec.push_back(x.second.get_value<string>());
     }
+    
+    BatchReport report = rectifyBatch(inputVec, outputVec,
+        [](const string & fileName) -> Mat
+        {
+            Mat32f img = imread(fileName, 0);
+            return img;
+        },
+        [&rectMap](const Mat & src, Mat & dst)
+        {
+            remap(src, dst, rectMap.map1, rectMap.map2, cv::INTER_LINEAR);
+        },
+        readBatchSettings(root));
+    report.print();
 
     return 0;
 
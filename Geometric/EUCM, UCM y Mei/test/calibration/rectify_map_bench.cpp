@@ -0,0 +1,85 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Cold vs warm start of the rectification tools:
+computing the map from the camera model vs loading it from the cache
+*/
+
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "json.h"
+#include "timer.h"
+
+#include "geometry/geometry.h"
+#include "calibration/rectification.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <rectify_json> [repetitions]" << endl;
+        return 1;
+    }
+    ptree root;
+    read_json(argv[1], root);
+    vector<double> paramsCam = readVector<double>(root.get_child("camera_params"));
+    vector<double> paramsPinhole = readVector<double>(root.get_child("pinhole_params"));
+    Transf xi = readTransform(root.get_child("xi_eucm_pinhole"));
+    const int repetitions = (argc >= 3) ? std::stoi(argv[2]) : 5;
+    const string cacheDir = root.get<string>("map_cache", ".");
+
+    const uint64_t hash = rectificationHash(paramsCam, paramsPinhole, xi, false);
+    const string fileName = rectificationMapFileName(cacheDir, hash);
+
+    //cold start: the map is computed from the model
+    double coldTime = 0;
+    RectificationMap coldMap;
+    for (int i = 0; i < repetitions; i++)
+    {
+        Timer timer;
+        getRectificationMap(paramsCam, paramsPinhole, xi, "", coldMap);
+        coldTime += timer.elapsed();
+    }
+    if (not saveRectificationMap(fileName, hash, coldMap))
+    {
+        std::cerr << "ERROR: cannot write " << fileName << endl;
+        return 1;
+    }
+
+    //warm start: the map is read from the cache
+    double warmTime = 0;
+    RectificationMap warmMap;
+    for (int i = 0; i < repetitions; i++)
+    {
+        Timer timer;
+        getRectificationMap(paramsCam, paramsPinhole, xi, cacheDir, warmMap);
+        warmTime += timer.elapsed();
+    }
+
+    const bool identical = cv::norm(coldMap.map1, warmMap.map1, cv::NORM_INF) == 0
+                       and cv::norm(coldMap.map2, warmMap.map2, cv::NORM_INF) == 0;
+
+    cout << "map size    : " << coldMap.map1.cols << " x " << coldMap.map1.rows << endl;
+    cout << "cache file  : " << fileName << endl;
+    cout << "cold start  : " << 1e3 * coldTime / repetitions << " ms" << endl;
+    cout << "warm start  : " << 1e3 * warmTime / repetitions << " ms" << endl;
+    cout << "speed-up    : " << coldTime / warmTime << endl;
+    cout << "identical   : " << (identical ? "yes" : "NO") << endl;
+    return identical ? 0 : 1;
+}
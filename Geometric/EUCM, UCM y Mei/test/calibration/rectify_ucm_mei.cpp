@@ -11,10 +11,7 @@
 #include "json.h"
 
 #include "geometry/geometry.h"
-#include "projection/pinhole.h"
-#include "projection/eucm.h"
-#include "projection/ucm.h"
-#include "projection/mei.h"
+#include "calibration/rectification.h"
 
 using namespace std;
 using namespace cv;
@@ -56,56 +53,6 @@ bool createDirectory(const string& dir) {
     return (status == 0 || errno == EEXIST);
 }
 
-void initRemap(const vector<double>& params, const vector<double>& pinhole_params,
-               Mat32f & mapX, Mat32f & mapY, const Transf & T)
-{
-    Pinhole cam2(pinhole_params[2], pinhole_params[3], pinhole_params[4]);
-
-    Vector2dVec imagePoints;
-    mapX.create(pinhole_params[1], pinhole_params[0]);
-    mapY.create(pinhole_params[1], pinhole_params[0]);
-    for (unsigned int i = 0; i < mapX.rows; i++) {
-        for (unsigned int j = 0; j < mapX.cols; j++) {
-            imagePoints.push_back(Vector2d(j, i));
-        }
-    }
-
-    Vector3dVec pointCloud;
-    cam2.reconstructPointCloud(imagePoints, pointCloud);
-
-    T.transform(pointCloud, pointCloud);
-
-    if(params.size() == 6)
-    {
-        EnhancedCamera cam(params.data());
-        cam.projectPointCloud(pointCloud, imagePoints);
-    }
-    else if(params.size() == 5)
-    {
-        UnifiedCamera cam(params.data());
-        cam.projectPointCloud(pointCloud, imagePoints);
-    }
-    else if(params.size() == 10)
-    {
-        MeiCamera cam(params.data());
-        cam.projectPointCloud(pointCloud, imagePoints);
-    }
-    else
-    {
-        cerr << "Parámetros de cámara no soportados." << endl;
-        exit(1);
-    }
-
-    auto pointIter = imagePoints.begin();
-    for (unsigned int i = 0; i < mapX.rows; i++) {
-        for (unsigned int j = 0; j < mapX.cols; j++) {
-            mapX(i, j) = (*pointIter)[0];
-            mapY(i, j) = (*pointIter)[1];
-            ++pointIter;
-        }
-    }
-}
-
 int main(int argc, char** argv) {
     if (argc < 2) {
         cerr << "Uso: " << argv[0] << " <archivo_json> [directorio_salida]" << endl;
@@ -127,34 +74,38 @@ int main(int argc, char** argv) {
     vector<double> paramsPinhole = readVector<double>(root.get_child("pinhole_params"));
     Transf T = readTransform(root.get_child("xi_eucm_pinhole"));
 
-    Mat32f mapX, mapY;
-    initRemap(paramsCam, paramsPinhole, mapX, mapY, T);
+    // Los mapas se guardan en caché, "map_cache": "" la desactiva
+    RectificationMap rectMap;
+    try {
+        getRectificationMap(paramsCam, paramsPinhole, T, root.get<string>("map_cache", "."), rectMap);
+    } catch (const runtime_error & e) {
+        cerr << "Parámetros de cámara no soportados." << endl;
+        exit(1);
+    }
 
+    vector<string> inputVec, outputVec;
     for (auto & x : root.get_child("image_names")) {
         string input_path = x.second.get_value<string>();
-        Mat img = imread(input_path, IMREAD_COLOR);
-        if (img.empty()) {
-            cerr << "Error: No se pudo leer la imagen " << input_path << endl;
-            continue;
-        }
-
-        Mat img_float, img2;
-        img.convertTo(img_float, CV_32FC3);
-        remap(img_float, img2, mapX, mapY, INTER_LINEAR);
-
-        Mat img_output;
-        img2.convertTo(img_output, CV_8UC3);
-
         string base_name = getBaseName(input_path);
         string output_filename = "corregida_" + base_name + ".jpg";
-        string output_path = joinPath(output_dir, output_filename);
-
-        if (imwrite(output_path, img_output)) {
-            cout << "Imagen guardada en: " << output_path << endl;
-        } else {
-            cerr << "Error al guardar la imagen en: " << output_path << endl;
-        }
+        inputVec.push_back(input_path);
+        outputVec.push_back(joinPath(output_dir, output_filename));
     }
 
+    // Lectura, remapeo y escritura en paralelo (clave opcional "batch")
+    BatchReport report = rectifyBatch(inputVec, outputVec,
+        [](const string & input_path) {
+            return imread(input_path, IMREAD_COLOR);
+        },
+        [&rectMap](const Mat & img, Mat & img_output) {
+            Mat img_float, img2;
+            img.convertTo(img_float, CV_32FC3);
+            remap(img_float, img2, rectMap.map1, rectMap.map2, INTER_LINEAR);
+            img2.convertTo(img_output, CV_8UC3);
+        },
+        readBatchSettings(root));
+    report.print();
+    cout << "Imágenes guardadas en: " << output_dir << endl;
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Synthetic calibration boards for the corner detector benchmarks:
+a board seen through random homographies, with its ground truth corners
+*/
+
+#pragma once
+
+#include "std.h"
+#include "ocv.h"
+#include "eigen.h"
+
+//a board with Nx x Ny inner corners, returns the corners in the board image
+inline Mat8u drawBoard(int Nx, int Ny, int square, int margin, Vector2dVec & cornerVec)
+{
+    Mat8u board((Ny + 1) * square + 2 * margin, (Nx + 1) * square + 2 * margin);
+    board.setTo(255);
+    for (int j = 0; j <= Ny; j++)
+    {
+        for (int i = 0; i <= Nx; i++)
+        {
+            if ((i + j) % 2) continue;
+            board(cv::Rect(margin + i * square, margin + j * square, square, square)).setTo(0);
+        }
+    }
+    //the edges lie between the pixel centers
+    cornerVec.clear();
+    for (int j = 1; j <= Ny; j++)
+    {
+        for (int i = 1; i <= Nx; i++)
+        {
+            cornerVec.emplace_back(margin + i * square - 0.5, margin + j * square - 0.5);
+        }
+    }
+    return board;
+}
+
+struct ViewParameters
+{
+    Size imageSize;
+    double scaleMin, scaleMax; // board pixels to image pixels
+    double tiltMax; // perspective terms of the homography
+};
+
+//the board seen through a random homography, blurred and noisy
+//its center goes to the image center
+inline Mat8u generateView(const Mat8u & board, const Vector2dVec & boardCornerVec,
+        const ViewParameters & params, mt19937 & gen, Vector2dVec & cornerVec)
+{
+    std::uniform_real_distribution<double> angle(-0.4, 0.4), scale(params.scaleMin, params.scaleMax),
+            tilt(-params.tiltMax, params.tiltMax);
+    const double a = angle(gen), s = scale(gen);
+    Matrix3d H;
+    H << s * cos(a), -s * sin(a), 0,
+         s * sin(a),  s * cos(a), 0,
+         tilt(gen), tilt(gen), 1;
+    Vector3d center = H * Vector3d(board.cols / 2., board.rows / 2., 1);
+    Matrix3d T = Matrix3d::Identity();
+    T(0, 2) = params.imageSize.width / 2. - center[0] / center[2];
+    T(1, 2) = params.imageSize.height / 2. - center[1] / center[2];
+    H = T * H;
+
+    cv::Mat_<double> Hcv(3, 3);
+    for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) Hcv(i, j) = H(i, j);
+    Mat8u view;
+    warpPerspective(board, view, Hcv, params.imageSize, cv::INTER_LINEAR,
+            cv::BORDER_CONSTANT, Scalar(128));
+    GaussianBlur(view, view, Size(5, 5), 1, 1);
+    Mat16s noisy(view.size());
+    randn(noisy, 0, 3);
+    cv::add(noisy, view, noisy, cv::noArray(), CV_16S);
+    noisy.convertTo(view, CV_8U);
+
+    cornerVec.clear();
+    for (auto & pt : boardCornerVec)
+    {
+        Vector3d X = H * Vector3d(pt[0], pt[1], 1);
+        cornerVec.emplace_back(X[0] / X[2], X[1] / X[2]);
+    }
+    return view;
+}
+
+//the mean distance to the closest ground truth corner
+inline double meanError(const Vector2dVec & detectedVec, const Vector2dVec & truthVec)
+{
+    double acc = 0;
+    for (auto & pt : detectedVec)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (auto & gt : truthVec) best = min(best, (pt - gt).squaredNorm());
+        acc += sqrt(best);
+    }
+    return acc / detectedVec.size();
+}
@@ -0,0 +1,103 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Projection and Jacobian throughput: virtual ICamera calls vs StaticCamera instantiations
+*/
+
+#include "std.h"
+#include "io.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "projection/static_camera.h"
+
+// the same loop for ICamera and the static cameras
+template<typename Camera>
+double projectAll(const Camera & camera, const Vector3dVec & cloud)
+{
+    double acc = 0;
+    Vector2d pt;
+    for (auto & X : cloud)
+    {
+        if (camera.projectPoint(X, pt)) acc += pt[0] + pt[1];
+    }
+    return acc;
+}
+
+template<typename Camera>
+double jacobianAll(const Camera & camera, const Vector3dVec & cloud)
+{
+    double acc = 0;
+    double dudx[3], dvdx[3];
+    for (auto & X : cloud)
+    {
+        if (camera.projectionJacobian(X, dudx, dvdx)) acc += dudx[0] + dvdx[1];
+    }
+    return acc;
+}
+
+template<typename Func>
+double measure(Func func, int repetitions, double & result)
+{
+    Timer timer;
+    for (int i = 0; i < repetitions; i++) result = func();
+    return timer.elapsed() / repetitions;
+}
+
+void benchmark(const string & name, const ICamera & camera, const Vector3dVec & cloud, int repetitions)
+{
+    double resVirt = 0, resStat = 0, jacVirt = 0, jacStat = 0;
+    const double tVirt = measure([&]() { return projectAll(camera, cloud); }, repetitions, resVirt);
+    const double tStat = measure([&]()
+    {
+        return dispatchCamera(camera, [&](const auto & cam) { return projectAll(cam, cloud); });
+    }, repetitions, resStat);
+    const double tJacVirt = measure([&]() { return jacobianAll(camera, cloud); }, repetitions, jacVirt);
+    const double tJacStat = measure([&]()
+    {
+        return dispatchCamera(camera, [&](const auto & cam) { return jacobianAll(cam, cloud); });
+    }, repetitions, jacStat);
+
+    const double mega = cloud.size() * 1e-6;
+    cout << setw(6) << name
+         << "  projection: virtual " << setw(8) << mega / tVirt
+         << "  static " << setw(8) << mega / tStat << " Mpts/s"
+         << "  | jacobian: virtual " << setw(8) << mega / tJacVirt
+         << "  static " << setw(8) << mega / tJacStat << " Mpts/s"
+         << ((resVirt == resStat and jacVirt == jacStat) ? "" : "  RESULTS DIFFER") << endl;
+}
+
+int main(int argc, char** argv)
+{
+    const int pointCount = (argc >= 2) ? std::stoi(argv[1]) : 1000000;
+    const int repetitions = (argc >= 3) ? std::stoi(argv[2]) : 10;
+
+    mt19937 gen(0);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    Vector3dVec cloud(pointCount);
+    for (auto & X : cloud) X = Vector3d(dist(gen), dist(gen), dist(gen) + 0.5);
+
+    const array<double, 6> eucmParams{0.6, 1.1, 300, 300, 640, 480};
+    const array<double, 5> ucmParams{0.9, 300, 300, 640, 480};
+    const array<double, 10> meiParams{0.9, -0.1, 0.02, 0, 1e-3, -1e-3, 300, 300, 640, 480};
+
+    benchmark("EUCM", EnhancedCamera(eucmParams.data()), cloud, repetitions);
+    benchmark("UCM", UnifiedCamera(ucmParams.data()), cloud, repetitions);
+    benchmark("Mei", MeiCamera(meiParams.data()), cloud, repetitions);
+    return 0;
+}
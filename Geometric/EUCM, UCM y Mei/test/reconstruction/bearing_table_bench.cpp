@@ -0,0 +1,150 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+BearingTable on an EUCM camera at full resolution and at the depth map scale:
+per-pixel reconstructPoint vs building, loading and reading the table.
+Checks that the users of the same camera and grid share one table
+and that the cached table is the computed one
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "projection/eucm.h"
+#include "reconstruction/bearing_table.h"
+#include "reconstruction/depth_map.h"
+
+//the former per-pixel unprojection, returns a checksum
+double reconstructAll(const ICamera & camera, const ScaleParameters & params)
+{
+    double acc = 0;
+    for (int y = 0; y < params.yMax; y++)
+    {
+        for (int x = 0; x < params.xMax; x++)
+        {
+            Vector3d X;
+            if (camera.reconstructPoint(Vector2d(params.uConv(x), params.vConv(y)), X)) acc += X.normalized()[2];
+        }
+    }
+    return acc;
+}
+
+double readAll(const BearingTable & table)
+{
+    double acc = 0;
+    for (int i = 0; i < table.size(); i++) acc += table[i][2];
+    return acc;
+}
+
+//the largest angle between the table and reconstructPoint, and the mask agreement
+bool check(const ICamera & camera, const ScaleParameters & params, const BearingTable & table,
+        double & maxAngle)
+{
+    maxAngle = 0;
+    for (int y = 0; y < params.yMax; y++)
+    {
+        for (int x = 0; x < params.xMax; x++)
+        {
+            Vector3d X;
+            const bool valid = camera.reconstructPoint(Vector2d(params.uConv(x), params.vConv(y)), X);
+            if (valid != table.valid(x + y*params.xMax)) return false;
+            if (valid) maxAngle = max(maxAngle, X.normalized().cross(table(x, y)).norm());
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const int width = (argc >= 2) ? std::stoi(argv[1]) : 1280;
+    const string cacheDir = (argc >= 3) ? argv[2] : "/tmp";
+    const int height = width * 3 / 4;
+    const int repetitions = 5;
+
+    //the corners are out of the valid circle of the model
+    const array<double, 6> intrinsics{0.6, 1.5, 0.3 * width, 0.3 * width, width / 2., height / 2.};
+    EnhancedCamera camera(width, height, intrinsics.data());
+
+    bool success = true;
+    cout << "grid          per-pixel ms   build ms   load ms   read ms   max angle" << endl;
+    for (int scale : {1, 2})
+    {
+        ScaleParameters params;
+        params.scale = scale;
+        params.uMax = width;
+        params.vMax = height;
+        params.setEqualMargin();
+
+        double checksum = 0;
+        Timer timer;
+        for (int i = 0; i < repetitions; i++) checksum += reconstructAll(camera, params);
+        const double tPerPixel = timer.elapsed() / repetitions;
+
+        timer.reset();
+        for (int i = 0; i < repetitions; i++) BearingTable table(&camera, params);
+        const double tBuild = timer.elapsed() / repetitions;
+
+        //the first request computes and stores the table, the next one reads it
+        const string fileName = BearingTable::fileName(cacheDir, BearingTable::computeHash(&camera, params));
+        std::remove(fileName.c_str());
+        BearingTable::get(&camera, params, cacheDir);
+        timer.reset();
+        std::shared_ptr<const BearingTable> loaded = BearingTable::get(&camera, params, cacheDir);
+        const double tLoad = timer.elapsed();
+        const BearingTable computed(&camera, params);
+        if (loaded->rays() != computed.rays() or loaded->mask() != computed.mask())
+        {
+            cout << "ERROR: the cached table differs from the computed one" << endl;
+            success = false;
+        }
+
+        timer.reset();
+        for (int i = 0; i < repetitions; i++) checksum -= readAll(*loaded);
+        const double tRead = timer.elapsed() / repetitions;
+
+        //the depth maps of the same camera and grid and their copies use the loaded table
+        const DepthMap depth1(&camera, params), depth2(&camera, params);
+        const DepthMap depthCopy(depth1);
+        if (&depth1.bearingTable() != loaded.get() or &depth2.bearingTable() != loaded.get()
+                or &depthCopy.bearingTable() != loaded.get())
+        {
+            cout << "ERROR: the depth maps do not share the table" << endl;
+            success = false;
+        }
+
+        double maxAngle;
+        if (not check(camera, params, *loaded, maxAngle))
+        {
+            cout << "ERROR: the mask differs from reconstructPoint" << endl;
+            success = false;
+        }
+        std::remove(fileName.c_str());
+
+        cout << setw(5) << params.xMax << " x " << setw(4) << params.yMax
+             << setw(14) << 1e3 * tPerPixel
+             << setw(11) << 1e3 * tBuild
+             << setw(10) << 1e3 * tLoad
+             << setw(10) << 1e3 * tRead
+             << setw(12) << maxAngle
+             << (abs(checksum) > 1e-6 * params.xMax * params.yMax ? "   checksum differs" : "") << endl;
+    }
+    return success ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Common part of the DepthMap benchmarks: a synthetic scene, the comparison of two maps
+and the timing of the operations
+*/
+
+#pragma once
+
+#include "std.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "reconstruction/depth_map.h"
+
+//the plane through (0, 0, distance) with the normal (0, 0.3, 1);
+//the hypothesis h lies h meters farther than the plane
+struct SyntheticScene
+{
+    int hMax = 1;
+    double distance = 2;
+    bool box = false; // a box at 1.5 m occludes the middle of the image
+    double holeRatio = 0; // the share of empty hypotheses
+    double noise = 0; // relative to the depth
+    bool randomCost = false; // between DEFAULT_COST_DEPTH and DEFAULT_COST_DEPTH + 25
+};
+
+inline DepthMap generateDepth(const ICamera & camera, const ScaleParameters & params,
+        const SyntheticScene & scene, mt19937 & gen)
+{
+    std::normal_distribution<double> noise(0, 1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    const Vector3d normal = Vector3d(0, 0.3, 1).normalized();
+    DepthMap depth(&camera, params, scene.hMax);
+    for (int y = 0; y < params.yMax; y++)
+    {
+        for (int x = 0; x < params.xMax; x++)
+        {
+            Vector3d X;
+            if (not camera.reconstructPoint(Vector2d(params.uConv(x), params.vConv(y)), X)) continue;
+            X.normalize();
+            const double cosAngle = X.dot(normal);
+            if (cosAngle < 0.1) continue;
+            double d0 = scene.distance * normal[2] / cosAngle;
+            if (scene.box and X[2] > 0 and abs(X[0] / X[2]) < 0.3 and abs(X[1] / X[2]) < 0.2)
+            {
+                d0 = 1.5 / X[2];
+            }
+            for (int h = 0; h < scene.hMax; h++)
+            {
+                if (scene.holeRatio > 0 and uniform(gen) < scene.holeRatio) continue;
+                const double d = d0 + h;
+                depth.at(x, y, h) = (scene.noise > 0) ? d * (1 + scene.noise * noise(gen)) : d;
+                depth.sigma(x, y, h) = 0.02 * d;
+                if (scene.randomCost) depth.cost(x, y, h) = DEFAULT_COST_DEPTH + 25 * uniform(gen);
+            }
+        }
+    }
+    return depth;
+}
+
+//all the hypotheses, values, sigmas and costs
+inline bool identical(const DepthMap & a, const DepthMap & b)
+{
+    if (a.getHypMax() != b.getHypMax()) return false;
+    for (int h = 0; h < a.getHypMax(); h++)
+    {
+        for (int y = 0; y < a.getHeight(); y++)
+        {
+            for (int x = 0; x < a.getWidth(); x++)
+            {
+                if (a.at(x, y, h) != b.at(x, y, h) or a.sigma(x, y, h) != b.sigma(x, y, h)
+                        or a.cost(x, y, h) != b.cost(x, y, h)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+//the mean time of func over the repetitions
+template<typename Func>
+double measure(Func func, int repetitions)
+{
+    Timer timer;
+    for (int i = 0; i < repetitions; i++) func();
+    return timer.elapsed() / repetitions;
+}
+
+//runs func on a fresh copy of source, returns the mean time of func only
+template<typename Func>
+double measureInPlace(const DepthMap & source, DepthMap & result, int repetitions, Func func)
+{
+    double time = 0;
+    for (int i = 0; i < repetitions; i++)
+    {
+        result = source;
+        Timer timer;
+        func(result);
+        time += timer.elapsed();
+    }
+    return time / repetitions;
+}
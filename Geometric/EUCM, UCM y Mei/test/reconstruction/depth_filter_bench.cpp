@@ -0,0 +1,99 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+DepthMap::filterNoise, regularize and costRejection on multi-hypothesis maps:
+the calling thread only vs a thread pool.
+The maps are random stacks with holes, the results must be identical
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "utils/thread_pool.h"
+#include "projection/eucm.h"
+#include "reconstruction/depth_map.h"
+
+#include "depth_bench.h"
+
+int main(int argc, char** argv)
+{
+    const int width = (argc >= 2) ? std::stoi(argv[1]) : 1280;
+    const int threadCount = (argc >= 3) ? std::stoi(argv[2]) : 0;
+    const int height = width * 3 / 4;
+    const int repetitions = 5;
+
+    const array<double, 6> intrinsics{0.6, 1.1, 0.4 * width, 0.4 * width, width / 2., height / 2.};
+    EnhancedCamera camera(width, height, intrinsics.data());
+    ScaleParameters params;
+    params.scale = 1;
+    params.uMax = width;
+    params.vMax = height;
+    params.setEqualMargin();
+
+    ThreadPool threadPool(threadCount);
+    mt19937 gen(0);
+    bool allIdentical = true;
+    cout << "depth map : " << params.xMax << " x " << params.yMax
+         << ", " << threadPool.size() << " threads" << endl;
+    cout << "hMax   operation       serial ms   parallel ms   speedup   results" << endl;
+    for (int hMax = 3; hMax <= 5; hMax++)
+    {
+        //smooth depths with noise, a third of the hypotheses are empty
+        SyntheticScene scene;
+        scene.hMax = hMax;
+        scene.holeRatio = 0.33;
+        scene.noise = 0.01;
+        scene.randomCost = true;
+        const DepthMap source = generateDepth(camera, params, scene, gen);
+
+        vector<pair<string, std::function<void(DepthMap &, ThreadPool *)>>> operationVec;
+        operationVec.emplace_back("filterNoise", [](DepthMap & depth, ThreadPool * pool)
+        {
+            depth.filterNoise(pool);
+        });
+        operationVec.emplace_back("regularize", [](DepthMap & depth, ThreadPool * pool)
+        {
+            depth.regularize(pool);
+        });
+        operationVec.emplace_back("costRejection", [](DepthMap & depth, ThreadPool * pool)
+        {
+            depth.costRejection(DEFAULT_COST_DEPTH + 16, pool);
+        });
+
+        for (auto & operation : operationVec)
+        {
+            DepthMap serial, parallel;
+            auto & func = operation.second;
+            const double serialTime = measureInPlace(source, serial, repetitions,
+                    [&](DepthMap & depth) { func(depth, NULL); });
+            const double parallelTime = measureInPlace(source, parallel, repetitions,
+                    [&](DepthMap & depth) { func(depth, &threadPool); });
+            const bool same = identical(serial, parallel);
+            allIdentical = allIdentical and same;
+            cout << setw(4) << hMax << "   " << std::left << setw(14) << operation.first << std::right
+                 << setw(11) << 1e3 * serialTime
+                 << setw(14) << 1e3 * parallelTime
+                 << setw(10) << serialTime / parallelTime
+                 << "   " << (same ? "identical" : "DIFFER") << endl;
+        }
+    }
+    return allIdentical ? 0 : 1;
+}
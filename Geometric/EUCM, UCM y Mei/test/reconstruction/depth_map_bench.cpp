@@ -0,0 +1,140 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+DepthMap storage types on filterNoise, merge and wrapDepth:
+double or float, planar or interleaved.
+The depth maps are noisy views of a plane seen by an EUCM camera,
+every result is compared with the one of the double planar storage
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "projection/eucm.h"
+#include "reconstruction/depth_map.h"
+
+#include "depth_bench.h"
+
+//relative to the depth, the float storage rounds to about 1e-7
+template<typename Depth>
+double maxDifference(const Depth & depth, const DepthMap & reference)
+{
+    const DepthMap converted(depth);
+    double res = 0;
+    for (int y = 0; y < reference.getHeight(); y++)
+    {
+        for (int x = 0; x < reference.getWidth(); x++)
+        {
+            const double d = reference.at(x, y);
+            res = max(res, abs(converted.at(x, y) - d) / max(1., d));
+        }
+    }
+    return res;
+}
+
+struct StorageStats
+{
+    string name;
+    size_t memory = 0;
+    double filterTime = 0, mergeTime = 0, wrapTime = 0;
+    double difference = 0;
+};
+
+//the results of the double planar storage, to compare with
+struct Reference
+{
+    DepthMap filtered, merged, wrapped;
+};
+
+template<typename Depth>
+StorageStats measureStorage(const string & name, const DepthMap & source1, const DepthMap & source2,
+        const Transf & T12, int repetitions, Reference & reference)
+{
+    StorageStats stats;
+    stats.name = name;
+    const Depth depth1(source1), depth2(source2);
+    stats.memory = depth1.memorySize();
+
+    Depth filtered, merged, wrapped;
+    stats.filterTime = measure([&]() { filtered = depth1; filtered.filterNoise(); }, repetitions);
+    stats.mergeTime = measure([&]() { merged = depth1; merged.merge(depth2); }, repetitions);
+    stats.wrapTime = measure([&]() { wrapped = depth1.wrapDepth(T12); }, repetitions);
+
+    if (reference.filtered.empty())
+    {
+        reference.filtered = DepthMap(filtered);
+        reference.merged = DepthMap(merged);
+        reference.wrapped = DepthMap(wrapped);
+    }
+    stats.difference = max(maxDifference(filtered, reference.filtered),
+            max(maxDifference(merged, reference.merged), maxDifference(wrapped, reference.wrapped)));
+    return stats;
+}
+
+int main(int argc, char** argv)
+{
+    const int width = (argc >= 2) ? std::stoi(argv[1]) : 1280;
+    const int height = width * 3 / 4;
+    const int repetitions = (argc >= 3) ? std::stoi(argv[2]) : 5;
+
+    const array<double, 6> intrinsics{0.6, 1.1, 0.4 * width, 0.4 * width, width / 2., height / 2.};
+    EnhancedCamera camera(width, height, intrinsics.data());
+    ScaleParameters params;
+    params.scale = 2;
+    params.u0 = 1;
+    params.v0 = 1;
+    params.uMax = width;
+    params.vMax = height;
+    params.setEqualMargin();
+
+    //the plane with holes and noise
+    SyntheticScene scene;
+    scene.holeRatio = 0.05;
+    scene.noise = 0.01;
+    mt19937 gen(0);
+    const DepthMap source1 = generateDepth(camera, params, scene, gen);
+    const DepthMap source2 = generateDepth(camera, params, scene, gen);
+    const Transf T12(0.05, 0.01, 0.02, 0.01, 0.02, 0.005);
+
+    Reference reference;
+    vector<StorageStats> statsVec;
+    statsVec.push_back(measureStorage<DepthMap>("double planar", source1, source2, T12, repetitions, reference));
+    statsVec.push_back(measureStorage<DepthMapF>("float planar", source1, source2, T12, repetitions, reference));
+    statsVec.push_back(measureStorage<InterleavedDepthMap>("double interleaved",
+            source1, source2, T12, repetitions, reference));
+    statsVec.push_back(measureStorage<InterleavedDepthMapF>("float interleaved",
+            source1, source2, T12, repetitions, reference));
+
+    cout << "depth map : " << params.xMax << " x " << params.yMax << ", "
+         << repetitions << " repetitions" << endl;
+    cout << "storage               MB   filterNoise ms   merge ms   wrapDepth ms   max rel diff" << endl;
+    for (auto & stats : statsVec)
+    {
+        cout << std::left << setw(18) << stats.name << std::right
+             << setw(7) << std::fixed << std::setprecision(2) << stats.memory / 1e6
+             << setw(17) << 1e3 * stats.filterTime
+             << setw(11) << 1e3 * stats.mergeTime
+             << setw(15) << 1e3 * stats.wrapTime
+             << setw(15) << std::scientific << std::setprecision(1) << stats.difference << endl;
+        cout << std::defaultfloat;
+    }
+    return 0;
+}
@@ -0,0 +1,225 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Descriptor matching throughput on a synthetic 1 MP stereo pair:
+the former allocating int compareDescriptor vs the scratch-buffer SIMD version.
+The second image is the first one shifted by a known disparity
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "timer.h"
+
+#include "reconstruction/eucm_stereo.h"
+
+int referenceError(int v, int thMin, int thMax)
+{
+    return max(0, max(thMin - v, v - thMax));
+}
+
+//the former implementation, three vectors allocated at each call
+vector<int> referenceCompareDescriptor(const vector<uint8_t> & desc,
+        const vector<uint8_t> & sampleVec, int flawCost)
+{
+    vector<int> thMinVec(desc.size()), thMaxVec(desc.size());
+    for (int i = 1; i < desc.size() - 1; i++)
+    {
+        const int d = desc[i];
+        int d1 = (desc[i] + desc[i - 1]) / 2;
+        int d2 = (desc[i] + desc[i + 1]) / 2;
+        thMinVec[i] = min(d, min(d1, d2));
+        thMaxVec[i] = max(d, max(d1, d2));
+    }
+    if (desc[0] > desc[1])
+    {
+        thMinVec[0] = (desc[0] + desc[1]) / 2;
+        thMaxVec[0] = desc[0]; 
+    }
+    else
+    {
+        thMaxVec[0] = (desc[0] + desc[1]) / 2;
+        thMinVec[0] = desc[0];
+    }
+    const int d = desc[desc.size() - 2];
+    if (desc.back() > d)
+    {
+        thMinVec.back() = (desc.back() + d) / 2;
+        thMaxVec.back() = desc.back(); 
+    }
+    else
+    {
+        thMaxVec.back() = (desc.back() + d) / 2;
+        thMinVec.back() = desc.back();
+    }
+    
+    const int HALF_LENGTH = desc.size() / 2;
+    vector<int> rowA(sampleVec.size()), rowB(sampleVec.size());
+    
+    //match the first half
+    for (int i = 0; i < sampleVec.size(); i++)
+    {
+        rowA[i] = referenceError(sampleVec[i], thMinVec[0], thMaxVec[0]);
+    }
+    for (int i = 1; i <= HALF_LENGTH; i++)
+    {
+        rowB[0] = rowA[0] + flawCost + referenceError(sampleVec[0], thMinVec[i], thMaxVec[i]);
+        int cost = min(rowA[1] + flawCost, rowA[0]);
+        rowB[1] = cost + referenceError(sampleVec[1], thMinVec[i], thMaxVec[i]);
+        for (int j = 2; j < sampleVec.size(); j++)
+        {
+            cost = min(min(rowA[j] + flawCost, rowA[j - 1]), rowA[j - 2] + flawCost);
+            rowB[j] = cost + referenceError(sampleVec[j], thMinVec[i], thMaxVec[i]);
+        }
+        swap(rowA, rowB);
+    }
+    vector<int> rowC(sampleVec.size()); //center cost
+    swap(rowA, rowC);
+    
+    //match the second half (from the last pixel to first)
+    for (int i = 0; i < sampleVec.size(); i++)
+    {
+        rowA[i] = referenceError(sampleVec[i], thMinVec.back(), thMaxVec.back());
+    }
+    for (int i = desc.size() - 2; i > HALF_LENGTH; i--)
+    {
+        for (int j = 0; j < sampleVec.size() - 2; j++)
+        {
+            int cost = min(min(rowA[j] + flawCost, rowA[j + 1]), rowA[j + 2] + flawCost);
+            rowB[j] = cost + referenceError(sampleVec[j], thMinVec[i], thMaxVec[i]);
+        }
+        int j = sampleVec.size() - 2;
+        int cost = min(rowA[j] + flawCost, rowA[j + 1]);
+        rowB[j] = cost + referenceError(sampleVec[j], thMinVec[i], thMaxVec[i]);
+        rowB.back() = rowA.back() + flawCost + referenceError(sampleVec.back(), thMinVec[i], thMaxVec[i]);
+        swap(rowA, rowB);
+    }
+    
+    //accumulate the cost
+    for (int i = 0; i < sampleVec.size() - 2; i++)
+    {
+        rowC[i] += min(min(rowA[i] + flawCost, rowA[i + 1]), rowA[i + 2] + flawCost);
+    }
+    int i = rowC.size() - 2;
+    rowC[i] += min(rowA[i] + flawCost, rowA[i + 1]);
+    rowC.back() += rowA.back() + flawCost;
+    return rowC;
+}
+
+int main(int argc, char** argv)
+{
+    const int size = (argc >= 2) ? std::stoi(argv[1]) : 1000;
+    const int dispMax = (argc >= 3) ? std::stoi(argv[2]) : 48;
+    const int trueDisparity = dispMax / 4;
+    const int descLength = 5;
+    const int halfLength = descLength / 2;
+    const int flawCost = 7;
+    const int sampleCount = dispMax + descLength - 1;
+    
+    // smooth random texture
+    Mat8u img1(size, size), img2(size, size);
+    cv::randu(img1, 0, 256);
+    cv::GaussianBlur(img1, img1, Size(0, 0), 1.5);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            img2(y, x) = img1(y, min(x + trueDisparity, size - 1));
+        }
+    }
+    
+    // pixels whose curve fits in the image
+    const int xBegin = sampleCount;
+    const int xEnd = size - halfLength;
+    const int pixelCount = size * (xEnd - xBegin);
+    
+    // the former per-pixel loop and implementation: several vectors allocated for each pixel
+    long long accOld = 0;
+    int goodOld = 0;
+    Timer timer;
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = xBegin; x < xEnd; x++)
+        {
+            // both the descriptor and the samples go from right to left
+            vector<uint8_t> descriptor(img1.row(y).data + x - halfLength, 
+                    img1.row(y).data + x + halfLength + 1);
+            std::reverse(descriptor.begin(), descriptor.end());
+            // disparity d is centered at sampleVec[d + halfLength]
+            vector<uint8_t> sampleVec(img2.row(y).data + x - dispMax - halfLength + 1,
+                    img2.row(y).data + x + halfLength + 1);
+            std::reverse(sampleVec.begin(), sampleVec.end());
+            vector<int> costVec = referenceCompareDescriptor(descriptor, sampleVec, flawCost);
+            auto bestIter = min_element(costVec.begin() + halfLength, costVec.end() - halfLength);
+            accOld += *bestIter;
+            goodOld += (bestIter - costVec.begin() - halfLength == trueDisparity);
+        }
+    }
+    const double tOld = timer.elapsed();
+    
+    // the scratch-buffer version, no allocation in the loop
+    long long accNew = 0;
+    int goodNew = 0;
+    vector<uint8_t> descriptor(descLength);
+    vector<uint8_t> sampleVec(sampleCount);
+    vector<int> costVec(sampleCount);
+    DescriptorScratch scratch;
+    timer.reset();
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = xBegin; x < xEnd; x++)
+        {
+            const uint8_t * descPtr = img1.row(y).data + x + halfLength;
+            const uint8_t * samplePtr = img2.row(y).data + x + halfLength;
+            for (int i = 0; i < descLength; i++) descriptor[i] = descPtr[-i];
+            for (int i = 0; i < sampleCount; i++) sampleVec[i] = samplePtr[-i];
+            compareDescriptor(descriptor.data(), descLength, sampleVec.data(), sampleCount, 
+                    flawCost, scratch, costVec.data());
+            auto bestIter = min_element(costVec.begin() + halfLength, costVec.end() - halfLength);
+            accNew += *bestIter;
+            goodNew += (bestIter - costVec.begin() - halfLength == trueDisparity);
+        }
+    }
+    const double tNew = timer.elapsed();
+    
+    // the whole cost vectors of both versions, out of the timing
+    int mismatchCount = 0;
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = xBegin; x < xEnd; x++)
+        {
+            const uint8_t * descPtr = img1.row(y).data + x + halfLength;
+            const uint8_t * samplePtr = img2.row(y).data + x + halfLength;
+            for (int i = 0; i < descLength; i++) descriptor[i] = descPtr[-i];
+            for (int i = 0; i < sampleCount; i++) sampleVec[i] = samplePtr[-i];
+            compareDescriptor(descriptor.data(), descLength, sampleVec.data(), sampleCount, 
+                    flawCost, scratch, costVec.data());
+            mismatchCount += (costVec != referenceCompareDescriptor(descriptor, sampleVec, flawCost));
+        }
+    }
+    
+    cout << "image         : " << size << " x " << size << ", " << dispMax << " disparities" << endl;
+    cout << "allocating    : " << 1e3 * tOld << " ms  " << pixelCount * 1e-6 / tOld << " Mpx/s" << endl;
+    cout << "scratch SIMD  : " << 1e3 * tNew << " ms  " << pixelCount * 1e-6 / tNew << " Mpx/s" << endl;
+    cout << "speed-up      : " << tOld / tNew << endl;
+    cout << "correct disp. : " << 100. * goodNew / pixelCount << " %" << endl;
+    const bool identical = (accOld == accNew and goodOld == goodNew and mismatchCount == 0);
+    cout << "identical     : " << (identical ? "yes" : "NO") << endl;
+    return identical ? 0 : 1;
+}
+
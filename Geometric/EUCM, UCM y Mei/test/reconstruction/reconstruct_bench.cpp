@@ -0,0 +1,223 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+DepthMap::reconstruct into an MHPack: the former implementation vs the table-based one,
+with a new pack at every call, with a reused pack and with a thread pool.
+The whole map, the query points of the photometric localization and query indices
+are reconstructed with the flag combinations in use, the results must be identical
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "utils/thread_pool.h"
+#include "projection/eucm.h"
+#include "reconstruction/depth_map.h"
+
+#include "depth_bench.h"
+
+//the former implementation, built on the public interface
+//the output starts from an empty pack, the former one kept the image points of the pack
+//unless the query was made of points
+void referenceReconstruct(const ICamera & camera, const DepthMap & depth, MHPack & result,
+        const uint32_t reconstFlags)
+{
+    const int numHyps = (reconstFlags & ALL_HYPOTHESES) ? depth.getHypMax() : 1;
+    const int hStep = depth.getWidth() * depth.getHeight();
+    vector<int> queryIdxVec;
+    Vector2dVec queryPointVec;
+    if (reconstFlags & QUERY_INDICES)
+    {
+        swap(queryIdxVec, result.idxVec);
+        queryPointVec = depth.getPointVec(queryIdxVec);
+    }
+    else if (reconstFlags & QUERY_POINTS)
+    {
+        queryIdxVec = depth.getIdxVec(result.imagePointVec);
+        swap(queryPointVec, result.imagePointVec);
+    }
+    else
+    {
+        queryIdxVec = depth.getIdxVec();
+        queryPointVec = depth.getPointVec(queryIdxVec);
+    }
+    result = MHPack();
+
+    vector<double> depthVec;
+    for (int i = 0; i < queryIdxVec.size(); i++)
+    {
+        if (queryIdxVec[i] < 0 or queryIdxVec[i] >= hStep) continue;
+        for (int h = 0; h < numHyps; h++)
+        {
+            const int queryIdx = queryIdxVec[i];
+            double d = depth.at(queryIdx + h*hStep);
+            double sigma = depth.sigma(queryIdx + h*hStep);
+            if (d < MIN_DEPTH or d == OUT_OF_RANGE)
+            {
+                if (not (reconstFlags & DEFAULT_VALUES) or h != 0) continue;
+                d = DEFAULT_DEPTH;
+                sigma = DEFAULT_SIGMA_DEPTH;
+            }
+            if (reconstFlags & MINMAX)
+            {
+                depthVec.push_back(max(d - 3*sigma, MIN_DEPTH));
+                depthVec.push_back(d + 3*sigma);
+            }
+            else
+            {
+                depthVec.push_back(d);
+            }
+            if (reconstFlags & SIGMA_VALUE) result.sigmaVec.push_back(sigma);
+            result.idxVec.push_back(queryIdx);
+            result.hypIdxVec.push_back(h);
+            result.imagePointVec.push_back(queryPointVec[i]);
+            if (reconstFlags & INDEX_MAPPING) result.idxMapVec.push_back(i);
+        }
+    }
+
+    const int depthCount = (reconstFlags & MINMAX) ? 2 : 1;
+    vector<bool> maskVec;
+    Vector3dVec cloud;
+    camera.reconstructPointCloud(result.imagePointVec, cloud, maskVec);
+    for (int i = 0; i < cloud.size(); i++)
+    {
+        for (int k = 0; k < depthCount; k++)
+        {
+            if (maskVec[i]) result.cloud.push_back(cloud[i].normalized() * depthVec[depthCount*i + k]);
+            else result.cloud.emplace_back(0, 0, 0);
+        }
+    }
+}
+
+bool identical(const MHPack & a, const MHPack & b)
+{
+    return a.idxVec == b.idxVec and a.hypIdxVec == b.hypIdxVec and a.idxMapVec == b.idxMapVec
+            and a.sigmaVec == b.sigmaVec and a.imagePointVec == b.imagePointVec and a.cloud == b.cloud;
+}
+
+int main(int argc, char** argv)
+{
+    const int width = (argc >= 2) ? std::stoi(argv[1]) : 1280;
+    const int threadCount = (argc >= 3) ? std::stoi(argv[2]) : 0;
+    const int height = width * 3 / 4;
+    const int repetitions = 5;
+
+    const array<double, 6> intrinsics{0.6, 1.1, 0.4 * width, 0.4 * width, width / 2., height / 2.};
+    EnhancedCamera camera(width, height, intrinsics.data());
+    ScaleParameters params;
+    params.scale = 2;
+    params.u0 = 1;
+    params.v0 = 1;
+    params.uMax = width;
+    params.vMax = height;
+    params.setEqualMargin();
+
+    mt19937 gen(0);
+    //a noisy plane with holes, two hypotheses
+    SyntheticScene scene;
+    scene.hMax = 2;
+    scene.holeRatio = 0.1;
+    scene.noise = 0.01;
+    const DepthMap depth = generateDepth(camera, params, scene, gen);
+    depth.bearingTable();
+
+    //the pixels which ScalePhotometric keeps at the finest scale, about one in five
+    std::uniform_real_distribution<double> uniform(0, 1);
+    Vector2dVec queryPointVec;
+    for (int v = 0; v < height; v++)
+    {
+        for (int u = 0; u < width; u++)
+        {
+            if (uniform(gen) < 0.2) queryPointVec.emplace_back(u, v);
+        }
+    }
+    
+    //as many grid indices, a few of them out of the map
+    const int hStep = params.xMax * params.yMax;
+    std::uniform_int_distribution<int> randomIdx(-hStep / 100, hStep + hStep / 100);
+    vector<int> queryIdxVec(queryPointVec.size());
+    for (auto & idx : queryIdxVec) idx = randomIdx(gen);
+
+    struct Mode
+    {
+        string name;
+        uint32_t flags;
+    };
+    const vector<Mode> modeVec = {
+        {"whole map", SIGMA_VALUE},
+        {"map mapping", INDEX_MAPPING},
+        {"all hypotheses", ALL_HYPOTHESES | SIGMA_VALUE | INDEX_MAPPING},
+        {"map minmax", MINMAX | SIGMA_VALUE},
+        {"query points", QUERY_POINTS | INDEX_MAPPING},
+        {"points default", QUERY_POINTS | DEFAULT_VALUES | ALL_HYPOTHESES | SIGMA_VALUE},
+        {"query indices", QUERY_INDICES | INDEX_MAPPING | SIGMA_VALUE},
+        {"indices minmax", QUERY_INDICES | MINMAX | DEFAULT_VALUES | ALL_HYPOTHESES}};
+    
+    //the queries are read from the pack and replaced by the result
+    auto setQueries = [&](MHPack & pack, uint32_t flags)
+    {
+        if (flags & QUERY_INDICES) pack.idxVec.assign(queryIdxVec.begin(), queryIdxVec.end());
+        else if (flags & QUERY_POINTS) pack.imagePointVec.assign(queryPointVec.begin(), queryPointVec.end());
+    };
+
+    ThreadPool threadPool(threadCount);
+    bool allIdentical = true;
+    cout << "depth map : " << params.xMax << " x " << params.yMax << ", "
+         << queryPointVec.size() << " query points, " << threadPool.size() << " threads" << endl;
+    cout << "mode              former ms   new pack ms   reused ms   reused pool ms   results" << endl;
+    for (auto & mode : modeVec)
+    {
+        MHPack reference, fresh, reused, reusedPool;
+        const double tReference = measure([&]()
+        {
+            reference = MHPack();
+            setQueries(reference, mode.flags);
+            referenceReconstruct(camera, depth, reference, mode.flags);
+        }, repetitions);
+        const double tFresh = measure([&]()
+        {
+            fresh = MHPack();
+            setQueries(fresh, mode.flags);
+            depth.reconstruct(fresh, mode.flags);
+        }, repetitions);
+        const double tReused = measure([&]()
+        {
+            setQueries(reused, mode.flags);
+            depth.reconstruct(reused, mode.flags);
+        }, repetitions);
+        const double tReusedPool = measure([&]()
+        {
+            setQueries(reusedPool, mode.flags);
+            depth.reconstruct(reusedPool, mode.flags, &threadPool);
+        }, repetitions);
+
+        const bool same = identical(reference, fresh) and identical(reference, reused)
+                and identical(reference, reusedPool);
+        allIdentical = allIdentical and same;
+        cout << std::left << setw(16) << mode.name << std::right
+             << setw(11) << 1e3 * tReference
+             << setw(14) << 1e3 * tFresh
+             << setw(12) << 1e3 * tReused
+             << setw(17) << 1e3 * tReusedPool
+             << "   " << (same ? "identical" : "DIFFER") << endl;
+    }
+    return allIdentical ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Regression test of the parallel EnhancedSgm:
+the serial run (one thread) and the parallel run must give bit-identical results,
+and so must the streaming mode and the frame-by-frame computeStereo.
+Takes the stereo_test configuration and renders its first stereo pair
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "json.h"
+#include "timer.h"
+
+#include "geometry/geometry.h"
+#include "projection/eucm.h"
+#include "reconstruction/eucm_sgm.h"
+#include "reconstruction/depth_map.h"
+#include "render/render.h"
+
+// bitwise, so that NaN compares equal to NaN
+bool identical(const Mat & a, const Mat & b)
+{
+    if (a.size() != b.size() or a.type() != b.type()) return false;
+    for (int i = 0; i < a.rows; i++)
+    {
+        if (not std::equal(a.ptr(i), a.ptr(i) + a.cols * a.elemSize(), b.ptr(i))) return false;
+    }
+    return true;
+}
+
+struct SgmResult
+{
+    Mat32s disparity;
+    Mat32f depth, sigma;
+    double time;
+};
+
+SgmResult runSgm(const Transf & T12, const EnhancedCamera & camera, const SgmParameters & params,
+        const Mat8u & img1, const Mat8u & img2)
+{
+    SgmResult res;
+    EnhancedSgm stereo(T12, &camera, &camera, params);
+    DepthMap depth;
+    Timer timer;
+    stereo.computeStereo(img1, img2, depth);
+    res.time = timer.elapsed();
+    res.disparity = stereo.disparity().clone();
+    depth.toMat(res.depth);
+    depth.sigmaToMat(res.sigma);
+    return res;
+}
+
+// the second frame swaps the images, so that stale buffers would show up
+bool checkStream(const Transf & T12, const EnhancedCamera & camera, const SgmParameters & params,
+        const Mat8u & img1, const Mat8u & img2)
+{
+    const vector<pair<Mat8u, Mat8u>> frameVec = { {img1, img2}, {img2, img1}, {img1, img2} };
+    
+    vector<Mat32f> expectedVec(frameVec.size());
+    {
+        EnhancedSgm stereo(T12, &camera, &camera, params);
+        DepthMap depth;
+        for (int i = 0; i < int(frameVec.size()); i++)
+        {
+            stereo.computeStereo(frameVec[i].first, frameVec[i].second, depth);
+            depth.toMat(expectedVec[i]);
+        }
+    }
+    
+    EnhancedSgm stereo(T12, &camera, &camera, params);
+    int nextIdx = 0;
+    auto source = [&](Mat8u & left, Mat8u & right)
+    {
+        if (nextIdx == int(frameVec.size())) return false;
+        left = frameVec[nextIdx].first;
+        right = frameVec[nextIdx].second;
+        nextIdx++;
+        return true;
+    };
+    bool same = true;
+    Mat32f depthMat;
+    auto sink = [&](int frameIdx, const DepthMap & depth)
+    {
+        depth.toMat(depthMat);
+        same = same and identical(depthMat, expectedVec[frameIdx]);
+    };
+    DepthMap depth;
+    const StereoStreamReport report = stereo.computeStereoStream(source, depth, sink);
+    same = same and report.frameCount == int(frameVec.size());
+    cout << "stream " << report.frameCount / report.wallTime << " frames/s"
+         << "  identical : " << (same ? "yes" : "NO") << endl;
+    return same;
+}
+
+int main(int argc, char** argv) 
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <stereo_test_json>" << endl;
+        return 1;
+    }
+    ptree root;
+    read_json(argv[1], root);
+    
+    Transf xiCam0 = readTransform(root.get_child("trajectory.initial"));
+    Transf zeta = readTransform(root.get_child("trajectory.increment"));
+    EnhancedCamera camera(readVector<double>(root.get_child("camera_params")).data());
+    SgmParameters stereoParams(root.get_child("stereo_parameters"));
+    
+    ptree world;     
+    read_json(root.get<string>("render"), world);
+    RenderDevice device(world);
+    device.setCamera(&camera);
+    
+    Mat8u img1, img2;
+    device.setCameraTransform(xiCam0);
+    device.render(img1);
+    const Transf xiCam = xiCam0.compose(zeta);
+    device.setCameraTransform(xiCam);
+    device.render(img2);
+    const Transf TleftRight = xiCam0.inverseCompose(xiCam);
+    
+    bool success = true;
+    for (int pathCount : {4, 8})
+    {
+        SgmParameters serialParams = stereoParams;
+        serialParams.pathCount = pathCount;
+        serialParams.threadCount = 1;
+        SgmParameters parallelParams = serialParams;
+        parallelParams.threadCount = 0;
+        
+        const SgmResult serial = runSgm(TleftRight, camera, serialParams, img1, img2);
+        const SgmResult parallel = runSgm(TleftRight, camera, parallelParams, img1, img2);
+        const bool same = identical(serial.disparity, parallel.disparity)
+                      and identical(serial.depth, parallel.depth)
+                      and identical(serial.sigma, parallel.sigma);
+        cout << pathCount << " paths  serial : " << 1e3 * serial.time << " ms"
+             << "  parallel : " << 1e3 * parallel.time << " ms"
+             << "  identical : " << (same ? "yes" : "NO") << endl;
+        success = success and same;
+    }
+    success = checkStream(TleftRight, camera, stereoParams, img1, img2) and success;
+    return success ? 0 : 1;
+}
+
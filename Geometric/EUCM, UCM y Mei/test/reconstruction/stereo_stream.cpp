@@ -0,0 +1,103 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Streaming stereo over a sequence of synchronized image pairs.
+Uses the configuration of stereo_single_pair; the pairs are given by
+"images_left" and "images_right", otherwise the single pair is repeated
+argv[2] times (10 by default).
+If "depth_output" is set, the inverse depth of every frame is written there.
+*/
+
+#include <sstream>
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "json.h"
+
+#include "geometry/geometry.h"
+#include "projection/eucm.h"
+#include "reconstruction/eucm_sgm.h"
+#include "reconstruction/depth_map.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " config.json [repetitions]" << endl;
+        return 1;
+    }
+    ptree root;
+    read_json(argv[1], root);
+    Transf zeta = readTransform(root.get_child("stereo_transformation"));
+    EnhancedCamera camera_left( readVector<double>(root.get_child("camera_params_left")).data() );
+    EnhancedCamera camera_right( readVector<double>(root.get_child("camera_params_right")).data() );
+    SgmParameters stereoParams(root.get_child("stereo_parameters"));
+
+    vector<string> leftVec, rightVec;
+    if (root.count("images_left") and root.count("images_right"))
+    {
+        leftVec = readVector<string>(root.get_child("images_left"));
+        rightVec = readVector<string>(root.get_child("images_right"));
+    }
+    else
+    {
+        const int repetitions = (argc >= 3) ? std::stoi(argv[2]) : 10;
+        leftVec.assign(repetitions, root.get<string>("image_left"));
+        rightVec.assign(repetitions, root.get<string>("image_right"));
+    }
+    if (leftVec.size() != rightVec.size())
+    {
+        std::cerr << "images_left and images_right must have the same length" << endl;
+        return 1;
+    }
+    const string outputDir = root.get<string>("depth_output", "");
+
+    EnhancedSgm sgm(zeta, &camera_left, &camera_right, stereoParams);
+
+    int nextIdx = 0;
+    auto source = [&](Mat8u & img1, Mat8u & img2)
+    {
+        while (nextIdx < int(leftVec.size()))
+        {
+            const int idx = nextIdx++;
+            img1 = imread(leftVec[idx], 0);
+            img2 = imread(rightVec[idx], 0);
+            if (not img1.empty() and not img2.empty()) return true;
+            std::cerr << "cannot read the pair " << leftVec[idx] << " " << rightVec[idx] << endl;
+        }
+        return false;
+    };
+
+    Mat32f inverseDepth;
+    Mat8u depthImage;
+    auto sink = [&](int frameIdx, const DepthMap & depth)
+    {
+        if (outputDir.empty()) return;
+        depth.toInverseMat(inverseDepth);
+        inverseDepth.convertTo(depthImage, CV_8U, 255 * root.get<int>("brightness", 50) / 100.);
+        std::ostringstream fileName;
+        fileName << outputDir << "/depth_" << std::setfill('0') << setw(5) << frameIdx << ".png";
+        imwrite(fileName.str(), depthImage);
+    };
+
+    DepthMap depth;
+    sgm.computeStereoStream(source, depth, sink).print();
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+DepthMap::wrapDepth on 1 and 2 MP depth maps:
+the former MHPack pipeline vs the fused kernel, with and without a thread pool.
+The depth is a tilted plane with a box in front of it, seen by an EUCM camera
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "utils/thread_pool.h"
+#include "projection/eucm.h"
+#include "reconstruction/depth_map.h"
+
+#include "depth_bench.h"
+
+//the former implementation
+DepthMap referenceWrap(const DepthMap & depth, const Transf & T12)
+{
+    DepthMap dMap2(depth);
+    dMap2.setTo(OUT_OF_RANGE, DEFAULT_SIGMA_DEPTH, DEFAULT_COST_DEPTH);
+    MHPack cloud11MH;
+    depth.reconstruct(cloud11MH, 0);
+    Vector3dVec cloud12;
+    T12.inverseTransform(cloud11MH.cloud, cloud12);
+    Vector2dVec point12Vec;
+    depth.project(cloud12, point12Vec);
+    vector<int> idx12Vec = depth.getIdxVec(point12Vec);
+    for (int i = 0; i < idx12Vec.size(); i++)
+    {
+        const int idx2 = idx12Vec[i];
+        const int idx1 = cloud11MH.idxVec[i];
+        if (idx2 == -1) continue;
+        const double dist = cloud12[i].norm();
+        double & depthOld = dMap2.at(idx2);
+        if (depthOld == OUT_OF_RANGE or dist < depthOld)
+        {
+            dMap2.at(idx2) = dist;
+            dMap2.sigma(idx2) = depth.sigma(idx1) + 0.005*dist;
+            dMap2.cost(idx2) = depth.cost(idx1);
+        }
+    }
+    return dMap2;
+}
+
+struct Comparison
+{
+    int mismatchCount = 0; // filled in one map only
+    double maxDifference = 0; // relative, where both are filled
+};
+
+Comparison compare(const DepthMap & a, const DepthMap & b)
+{
+    Comparison res;
+    for (int y = 0; y < a.getHeight(); y++)
+    {
+        for (int x = 0; x < a.getWidth(); x++)
+        {
+            const double da = a.at(x, y), db = b.at(x, y);
+            if ((da == OUT_OF_RANGE) != (db == OUT_OF_RANGE)) res.mismatchCount++;
+            else if (da != OUT_OF_RANGE) res.maxDifference = max(res.maxDifference, abs(da - db) / db);
+        }
+    }
+    return res;
+}
+
+int main(int argc, char** argv)
+{
+    const int threadCount = (argc >= 2) ? std::stoi(argv[1]) : 0;
+    const int repetitions = 3;
+    ThreadPool threadPool(threadCount);
+    const Transf T12(0.05, 0.01, 0.02, 0.01, 0.02, 0.005);
+
+    bool allIdentical = true;
+    cout << threadPool.size() << " threads" << endl;
+    cout << "pixels      former ms   fused ms   fused pool ms   mismatches   max rel diff   pool" << endl;
+    for (int width : {1280, 1600})
+    {
+        const int height = width * 3 / 4;
+        const array<double, 6> intrinsics{0.6, 1.1, 0.4 * width, 0.4 * width, width / 2., height / 2.};
+        EnhancedCamera camera(width, height, intrinsics.data());
+        ScaleParameters params;
+        params.uMax = width;
+        params.vMax = height;
+        params.setEqualMargin();
+        //a plane occluded by a box, without noise
+        SyntheticScene scene;
+        scene.distance = 3;
+        scene.box = true;
+        mt19937 gen(0);
+        const DepthMap depth = generateDepth(camera, params, scene, gen);
+
+        DepthMap reference, fused, fusedPool;
+        const double tReference = measure([&]() { reference = referenceWrap(depth, T12); }, repetitions);
+        const double tFused = measure([&]() { fused = depth.wrapDepth(T12); }, repetitions);
+        const double tFusedPool = measure([&]() { fusedPool = depth.wrapDepth(T12, &threadPool); },
+                repetitions);
+
+        const Comparison comparison = compare(fused, reference);
+        const bool same = identical(fused, fusedPool);
+        allIdentical = allIdentical and same;
+        cout << setw(6) << std::setprecision(2) << params.xMax * params.yMax / 1e6 << " MP"
+             << std::setprecision(6)
+             << setw(12) << 1e3 * tReference
+             << setw(11) << 1e3 * tFused
+             << setw(16) << 1e3 * tFusedPool
+             << setw(13) << comparison.mismatchCount
+             << setw(15) << comparison.maxDifference
+             << "   " << (same ? "identical" : "DIFFER") << endl;
+    }
+    return allIdentical ? 0 : 1;
+}